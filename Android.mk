@@ -34,6 +34,24 @@ LOCAL_SRC_FILES += \
     rearcamera.cpp \
     helper.cpp \
     videocapture.cpp \
+    framesource.cpp \
+    pacedframesource.cpp \
+    latencystats.cpp \
+    statsserver.cpp \
+    streaminguploader.cpp \
+    colorconvert.cpp \
+    boottrace.cpp \
+    reversepredictor.cpp \
+    bufferpool.cpp \
+    queuedepth.cpp \
+    overlay.cpp \
+    overlaypack.cpp \
+    atlaspacker.cpp \
+    pngdecode.cpp \
+    guidelines.cpp \
+    dewarp.cpp \
+    remap.cpp \
+    deinterlace.cpp \
 
 LOCAL_STATIC_LIBRARIES += cpufeatures
 
@@ -46,3 +64,49 @@ ifdef TARGET_32_BIT_SURFACEFLINGER
 endif
 
 include $(BUILD_EXECUTABLE)
+
+# Offline overlay asset pack builder, see tools/overlaypack.cpp
+include $(CLEAR_VARS)
+
+LOCAL_CFLAGS += -Wall -Werror -Wunused -Wunreachable-code
+
+LOCAL_C_INCLUDES += external/libpng
+
+LOCAL_SRC_FILES := \
+    tools/overlaypack.cpp \
+    atlaspacker.cpp \
+    pngdecode.cpp \
+
+LOCAL_STATIC_LIBRARIES := libpng libz
+
+LOCAL_MODULE := rearcam_overlaypack
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# Runs a frame source through deinterlacing and colour conversion on the
+# build machine, to benchmark and regression test without the car, see
+# tools/replaybench.cpp
+include $(CLEAR_VARS)
+
+LOCAL_CFLAGS += -Wall -Werror -Wunused -Wunreachable-code -pthread
+
+LOCAL_SRC_FILES := \
+    tools/replaybench.cpp \
+    framesource.cpp \
+    pacedframesource.cpp \
+    videocapture.cpp \
+    bufferpool.cpp \
+    queuedepth.cpp \
+    colorconvert.cpp \
+    deinterlace.cpp \
+
+LOCAL_STATIC_LIBRARIES := libutils libcutils liblog libbase
+LOCAL_LDLIBS := -lpthread
+
+LOCAL_MODULE := rearcam_replaybench
+# V4L2 and eventfd
+LOCAL_MODULE_HOST_OS := linux
+
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(call all-makefiles-under,$(LOCAL_PATH))
@@ -0,0 +1,46 @@
+#include <algorithm>
+
+#include "atlaspacker.h"
+
+static int packShelves(std::vector<AtlasRect> &rects, const std::vector<int> &order, int padding, int width)
+{
+    int x = 0;
+    int y = 0;
+    int shelfHeight = 0;
+    for (int index : order)
+    {
+        AtlasRect &rect = rects[index];
+        const int paddedWidth = rect.width + 2 * padding;
+        const int paddedHeight = rect.height + 2 * padding;
+        if (paddedWidth > width)
+            return -1;
+
+        if (x + paddedWidth > width)
+        {
+            y += shelfHeight;
+            x = 0;
+            shelfHeight = 0;
+        }
+        rect.x = x + padding;
+        rect.y = y + padding;
+        x += paddedWidth;
+        shelfHeight = std::max(shelfHeight, paddedHeight);
+    }
+    return y + shelfHeight;
+}
+
+bool packAtlas(std::vector<AtlasRect> &rects, int padding, int maxSize, int &width, int &height)
+{
+    std::vector<int> order(rects.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&rects](int a, int b) { return rects[a].height > rects[b].height; });
+
+    for (width = 64; width <= maxSize; width *= 2)
+    {
+        height = packShelves(rects, order, padding, width);
+        if (height >= 0 && (height <= width || width * 2 > maxSize))
+            return height <= maxSize;
+    }
+    return false;
+}
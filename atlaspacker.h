@@ -0,0 +1,22 @@
+#ifndef ATLAS_PACKER_H_
+#define ATLAS_PACKER_H_
+
+#include <vector>
+
+// One image to place, x and y are filled in by packAtlas()
+struct AtlasRect
+{
+    int width = 0;
+    int height = 0;
+    int x = 0;
+    int y = 0;
+};
+
+// Shelf packing, tallest rectangles first so each shelf wastes little
+// height, with padding texels kept clear around every rectangle. Picks the
+// narrowest power of two width keeping the atlas roughly square. Shared by
+// the runtime overlay atlas and the offline pack tool, so both lay out the
+// same images the same way. Returns false if it does not fit in maxSize.
+bool packAtlas(std::vector<AtlasRect> &rects, int padding, int maxSize, int &width, int &height);
+
+#endif //ATLAS_PACKER_H_
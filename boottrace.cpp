@@ -0,0 +1,79 @@
+#define LOG_TAG "RearCameraBoot"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <cutils/log.h>
+#include <utils/SystemClock.h>
+
+#include "boottrace.h"
+
+BootTrace &BootTrace::get()
+{
+    static BootTrace trace;
+    return trace;
+}
+
+void BootTrace::begin(const char *phase)
+{
+    int64_t now = android::elapsedRealtimeNano();
+    const std::lock_guard<std::mutex> lock(mMutex);
+    mPhases.push_back({phase, gettid(), now, 0});
+}
+
+void BootTrace::end(const char *phase)
+{
+    int64_t now = android::elapsedRealtimeNano();
+    const std::lock_guard<std::mutex> lock(mMutex);
+    for (auto it = mPhases.rbegin(); it != mPhases.rend(); ++it)
+    {
+        if (it->endNs == 0 && strcmp(it->name, phase) == 0)
+        {
+            it->endNs = now;
+            return;
+        }
+    }
+    ALOGD("end of unknown boot phase %s", phase);
+}
+
+void BootTrace::mark(const char *event)
+{
+    int64_t now = android::elapsedRealtimeNano();
+    const std::lock_guard<std::mutex> lock(mMutex);
+    mPhases.push_back({event, gettid(), now, now});
+}
+
+void BootTrace::dump(std::string &out)
+{
+    const std::lock_guard<std::mutex> lock(mMutex);
+    for (const Phase &phase : mPhases)
+    {
+        char line[160];
+        if (phase.endNs == 0)
+        {
+            snprintf(line, sizeof(line), "boot.%s start=%.1fms running tid=%d\n", phase.name,
+                     phase.startNs / 1e6, static_cast<int>(phase.tid));
+        }
+        else
+        {
+            snprintf(line, sizeof(line), "boot.%s start=%.1fms end=%.1fms duration=%.1fms tid=%d\n", phase.name,
+                     phase.startNs / 1e6, phase.endNs / 1e6, (phase.endNs - phase.startNs) / 1e6,
+                     static_cast<int>(phase.tid));
+        }
+        out += line;
+    }
+}
+
+void BootTrace::report()
+{
+    std::string out;
+    dump(out);
+
+    size_t start = 0;
+    while (start < out.size())
+    {
+        size_t end = out.find('\n', start);
+        ALOGI("%s", out.substr(start, end - start).c_str());
+        start = end + 1;
+    }
+}
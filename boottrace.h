@@ -0,0 +1,52 @@
+#ifndef BOOT_TRACE_H_
+#define BOOT_TRACE_H_
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Start and end of every startup phase, on the boot clock so the numbers
+// line up with init's own timestamps. Phases may overlap and be recorded
+// from any thread.
+class BootTrace
+{
+public:
+    static BootTrace &get();
+
+    void begin(const char *phase);
+    void end(const char *phase);
+    // Zero length phase, e.g. the first frame on screen
+    void mark(const char *event);
+
+    void dump(std::string &out);
+    // Logs the whole trace
+    void report();
+
+    // Records a phase for the lifetime of the object
+    class Scope
+    {
+    public:
+        explicit Scope(const char *phase) : mPhase(phase) { BootTrace::get().begin(phase); }
+        ~Scope() { BootTrace::get().end(mPhase); }
+
+    private:
+        const char *mPhase;
+    };
+
+private:
+    struct Phase
+    {
+        const char *name;
+        pid_t tid;
+        int64_t startNs;
+        // 0 while running
+        int64_t endNs;
+    };
+
+    std::mutex mMutex;
+    std::vector<Phase> mPhases;
+};
+
+#endif //BOOT_TRACE_H_
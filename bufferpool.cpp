@@ -0,0 +1,91 @@
+#define LOG_TAG "RearCamera"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <cutils/log.h>
+
+#include "bufferpool.h"
+
+static size_t alignTo(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+BufferPool::~BufferPool()
+{
+    release();
+}
+
+size_t BufferPool::alignToPage(size_t size)
+{
+    return alignTo(size, sysconf(_SC_PAGESIZE));
+}
+
+bool BufferPool::init(size_t chunkSize, int count, bool hugePages)
+{
+    release();
+    if (chunkSize == 0 || count <= 0)
+        return false;
+
+    size_t size = alignToPage(chunkSize) * count;
+    void *base = MAP_FAILED;
+    const char *backing = "pages";
+
+    if (hugePages)
+    {
+        // Reserved hugetlb pages, only there when the platform set some aside
+        size_t hugeSize = alignTo(size, BUFFER_POOL_HUGE_PAGE_SIZE);
+        base = mmap(NULL, hugeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        if (base != MAP_FAILED)
+        {
+            size = hugeSize;
+            backing = "hugetlb pages";
+        }
+    }
+
+    if (base == MAP_FAILED)
+    {
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED)
+        {
+            ALOGD("failed to map a %zu byte buffer pool (%d = %s)", size, errno, strerror(errno));
+            return false;
+        }
+
+        // Has to be asked for before the pages are touched
+        if (hugePages && madvise(base, size, MADV_HUGEPAGE) == 0)
+        {
+            backing = "transparent huge pages";
+        }
+        // Fault everything in now rather than during the first frames
+        memset(base, 0, size);
+    }
+
+    mBase = static_cast<unsigned char *>(base);
+    mSize = size;
+    mChunkSize = alignToPage(chunkSize);
+    mCount = count;
+    ALOGD("Buffer pool of %d x %zu bytes on %s", mCount, mChunkSize, backing);
+    return true;
+}
+
+void BufferPool::release()
+{
+    if (mBase != nullptr)
+    {
+        munmap(mBase, mSize);
+        mBase = nullptr;
+    }
+    mSize = 0;
+    mChunkSize = 0;
+    mCount = 0;
+}
+
+void *BufferPool::get(int index)
+{
+    if (mBase == nullptr || index < 0 || index >= mCount)
+        return nullptr;
+    return mBase + index * mChunkSize;
+}
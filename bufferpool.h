@@ -0,0 +1,35 @@
+#ifndef BUFFER_POOL_H_
+#define BUFFER_POOL_H_
+
+#include <stddef.h>
+
+// Transparent huge pages are 2 MiB on every platform we run on
+static constexpr size_t BUFFER_POOL_HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+// Equal, page aligned chunks carved out of one anonymous mapping, backing
+// USERPTR capture buffers. A single mapping faulted in up front keeps page
+// faults out of the capture path, and huge pages cut the TLB misses of the
+// DMA and of the CPU reading frames.
+class BufferPool
+{
+public:
+    ~BufferPool();
+
+    // Tries hugetlb pages, then transparent huge pages, when asked to
+    bool init(size_t chunkSize, int count, bool hugePages);
+    void release();
+
+    // Start of chunk index, nullptr when out of range
+    void *get(int index);
+    size_t getChunkSize() { return mChunkSize; };
+
+    static size_t alignToPage(size_t size);
+
+private:
+    unsigned char *mBase = nullptr;
+    size_t mSize = 0;
+    size_t mChunkSize = 0;
+    int mCount = 0;
+};
+
+#endif //BUFFER_POOL_H_
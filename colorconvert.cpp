@@ -0,0 +1,397 @@
+#define LOG_TAG "RearCameraColor"
+
+#ifdef __ANDROID__
+#include <cpu-features.h>
+#endif
+#include <cutils/log.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define COLOR_CONVERT_X86 1
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define COLOR_CONVERT_NEON 1
+#endif
+
+#include "colorconvert.h"
+
+// Q6 fixed point, chosen so every intermediate fits in int16 and the SIMD
+// kernels can use 16-bit multiplies and saturating adds. The scalar kernel
+// saturates at the same points, which keeps all kernels bit-exact.
+struct FixedCoefficients
+{
+    int16_t yOffset;
+    int16_t yMul;
+    int16_t vr;
+    int16_t ug;
+    int16_t vg;
+    int16_t ub;
+};
+
+static constexpr int FIXED_SHIFT = 6;
+static constexpr int FIXED_ROUND = 1 << (FIXED_SHIFT - 1);
+
+static constexpr int16_t toFixed(float value)
+{
+    return static_cast<int16_t>(value * (1 << FIXED_SHIFT) + 0.5f);
+}
+
+static constexpr FixedCoefficients makeFixed(const YuvCoefficients &c)
+{
+    return {static_cast<int16_t>(c.yOffset), toFixed(c.yScale), toFixed(c.vr), toFixed(c.ug), toFixed(c.vg), toFixed(c.ub)};
+}
+
+static constexpr FixedCoefficients gFixedCoefficients[2][2] = {
+    {makeFixed(gYuvCoefficients[MATRIX_BT601][RANGE_LIMITED]), makeFixed(gYuvCoefficients[MATRIX_BT601][RANGE_FULL])},
+    {makeFixed(gYuvCoefficients[MATRIX_BT709][RANGE_LIMITED]), makeFixed(gYuvCoefficients[MATRIX_BT709][RANGE_FULL])},
+};
+
+typedef void (*RowKernel)(const uint8_t *y, const uint8_t *uv, uint8_t *rgba, int width,
+                          const FixedCoefficients &c, bool nv21);
+
+static inline int saturate16(int value)
+{
+    return value < -32768 ? -32768 : (value > 32767 ? 32767 : value);
+}
+
+static inline uint8_t clampPixel(int value)
+{
+    value >>= FIXED_SHIFT;
+    return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+static inline void convertPixel(int y, int u, int v, uint8_t *rgba, const FixedCoefficients &c)
+{
+    int y1 = (y - c.yOffset) * c.yMul + FIXED_ROUND;
+    rgba[0] = clampPixel(saturate16(y1 + c.vr * v));
+    rgba[1] = clampPixel(saturate16(saturate16(y1 - c.ug * u) - c.vg * v));
+    rgba[2] = clampPixel(saturate16(y1 + c.ub * u));
+    rgba[3] = 255;
+}
+
+// Reference, also converts the tail the SIMD kernels leave over. Starts on
+// an even pixel so each chroma pair is shared by two pixels.
+static void convertRowScalar(const uint8_t *y, const uint8_t *uv, uint8_t *rgba, int width,
+                             const FixedCoefficients &c, bool nv21)
+{
+    const int uIndex = nv21 ? 1 : 0;
+    for (int x = 0; x < width; x += 2)
+    {
+        int u = uv[x + uIndex] - 128;
+        int v = uv[x + (1 - uIndex)] - 128;
+        convertPixel(y[x], u, v, rgba + x * 4, c);
+        if (x + 1 < width)
+        {
+            convertPixel(y[x + 1], u, v, rgba + (x + 1) * 4, c);
+        }
+    }
+}
+
+#ifdef COLOR_CONVERT_X86
+// 8 pixels of luma and the chroma terms already duplicated per pixel
+static inline __m128i convertChannelSSE2(__m128i y1, __m128i term)
+{
+    return _mm_srai_epi16(_mm_adds_epi16(y1, term), FIXED_SHIFT);
+}
+
+static inline void storeRgbaSSE2(uint8_t *rgba, __m128i r, __m128i g, __m128i b)
+{
+    const __m128i alpha = _mm_set1_epi8(static_cast<char>(0xff));
+    __m128i rgLo = _mm_unpacklo_epi8(r, g);
+    __m128i rgHi = _mm_unpackhi_epi8(r, g);
+    __m128i baLo = _mm_unpacklo_epi8(b, alpha);
+    __m128i baHi = _mm_unpackhi_epi8(b, alpha);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(rgba), _mm_unpacklo_epi16(rgLo, baLo));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(rgba + 16), _mm_unpackhi_epi16(rgLo, baLo));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(rgba + 32), _mm_unpacklo_epi16(rgHi, baHi));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(rgba + 48), _mm_unpackhi_epi16(rgHi, baHi));
+}
+
+// 16 pixels per iteration
+static void convertRowSSE2(const uint8_t *y, const uint8_t *uv, uint8_t *rgba, int width,
+                           const FixedCoefficients &c, bool nv21)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lowBytes = _mm_set1_epi16(0x00ff);
+    const __m128i bias = _mm_set1_epi16(128);
+    const __m128i yOffset = _mm_set1_epi16(c.yOffset);
+    const __m128i yMul = _mm_set1_epi16(c.yMul);
+    const __m128i round = _mm_set1_epi16(FIXED_ROUND);
+    const __m128i vr = _mm_set1_epi16(c.vr);
+    const __m128i ug = _mm_set1_epi16(c.ug);
+    const __m128i vg = _mm_set1_epi16(c.vg);
+    const __m128i ub = _mm_set1_epi16(c.ub);
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i yv = _mm_loadu_si128(reinterpret_cast<const __m128i *>(y + x));
+        __m128i uvv = _mm_loadu_si128(reinterpret_cast<const __m128i *>(uv + x));
+
+        __m128i even = _mm_sub_epi16(_mm_and_si128(uvv, lowBytes), bias);
+        __m128i odd = _mm_sub_epi16(_mm_srli_epi16(uvv, 8), bias);
+        __m128i u = nv21 ? odd : even;
+        __m128i v = nv21 ? even : odd;
+
+        __m128i rv = _mm_mullo_epi16(v, vr);
+        __m128i gu = _mm_mullo_epi16(u, ug);
+        __m128i gv = _mm_mullo_epi16(v, vg);
+        __m128i bu = _mm_mullo_epi16(u, ub);
+
+        __m128i yLo = _mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(yv, zero), yOffset), yMul), round);
+        __m128i yHi = _mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(yv, zero), yOffset), yMul), round);
+
+        __m128i rLo = convertChannelSSE2(yLo, _mm_unpacklo_epi16(rv, rv));
+        __m128i rHi = convertChannelSSE2(yHi, _mm_unpackhi_epi16(rv, rv));
+        __m128i gLo = _mm_srai_epi16(_mm_subs_epi16(_mm_subs_epi16(yLo, _mm_unpacklo_epi16(gu, gu)), _mm_unpacklo_epi16(gv, gv)), FIXED_SHIFT);
+        __m128i gHi = _mm_srai_epi16(_mm_subs_epi16(_mm_subs_epi16(yHi, _mm_unpackhi_epi16(gu, gu)), _mm_unpackhi_epi16(gv, gv)), FIXED_SHIFT);
+        __m128i bLo = convertChannelSSE2(yLo, _mm_unpacklo_epi16(bu, bu));
+        __m128i bHi = convertChannelSSE2(yHi, _mm_unpackhi_epi16(bu, bu));
+
+        storeRgbaSSE2(rgba + x * 4, _mm_packus_epi16(rLo, rHi), _mm_packus_epi16(gLo, gHi), _mm_packus_epi16(bLo, bHi));
+    }
+
+    convertRowScalar(y + x, uv + x, rgba + x * 4, width - x, c, nv21);
+}
+
+// 32 pixels per iteration, chroma duplicated per pixel up front so each
+// channel is a single 16 lane pass
+__attribute__((target("avx2"))) static inline __m256i loadChromaAVX2(const uint8_t *uv, __m128i shuffle)
+{
+    return _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(uv)), shuffle)),
+                            _mm256_set1_epi16(128));
+}
+
+__attribute__((target("avx2"))) static void convertRowAVX2(const uint8_t *y, const uint8_t *uv, uint8_t *rgba, int width,
+                                                           const FixedCoefficients &c, bool nv21)
+{
+    const __m128i dupEven = _mm_setr_epi8(0, 0, 2, 2, 4, 4, 6, 6, 8, 8, 10, 10, 12, 12, 14, 14);
+    const __m128i dupOdd = _mm_setr_epi8(1, 1, 3, 3, 5, 5, 7, 7, 9, 9, 11, 11, 13, 13, 15, 15);
+    const __m128i dupU = nv21 ? dupOdd : dupEven;
+    const __m128i dupV = nv21 ? dupEven : dupOdd;
+    const __m256i yOffset = _mm256_set1_epi16(c.yOffset);
+    const __m256i yMul = _mm256_set1_epi16(c.yMul);
+    const __m256i round = _mm256_set1_epi16(FIXED_ROUND);
+    const __m256i vr = _mm256_set1_epi16(c.vr);
+    const __m256i ug = _mm256_set1_epi16(c.ug);
+    const __m256i vg = _mm256_set1_epi16(c.vg);
+    const __m256i ub = _mm256_set1_epi16(c.ub);
+
+    int x = 0;
+    for (; x + 32 <= width; x += 32)
+    {
+        __m256i r[2], g[2], b[2];
+        for (int half = 0; half < 2; half++)
+        {
+            const int offset = x + half * 16;
+            __m256i yv = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(y + offset)));
+            __m256i y1 = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(yv, yOffset), yMul), round);
+            __m256i u = loadChromaAVX2(uv + offset, dupU);
+            __m256i v = loadChromaAVX2(uv + offset, dupV);
+
+            r[half] = _mm256_srai_epi16(_mm256_adds_epi16(y1, _mm256_mullo_epi16(v, vr)), FIXED_SHIFT);
+            g[half] = _mm256_srai_epi16(_mm256_subs_epi16(_mm256_subs_epi16(y1, _mm256_mullo_epi16(u, ug)), _mm256_mullo_epi16(v, vg)), FIXED_SHIFT);
+            b[half] = _mm256_srai_epi16(_mm256_adds_epi16(y1, _mm256_mullo_epi16(u, ub)), FIXED_SHIFT);
+        }
+
+        __m256i r8 = _mm256_permute4x64_epi64(_mm256_packus_epi16(r[0], r[1]), 0xd8);
+        __m256i g8 = _mm256_permute4x64_epi64(_mm256_packus_epi16(g[0], g[1]), 0xd8);
+        __m256i b8 = _mm256_permute4x64_epi64(_mm256_packus_epi16(b[0], b[1]), 0xd8);
+        storeRgbaSSE2(rgba + x * 4, _mm256_castsi256_si128(r8), _mm256_castsi256_si128(g8), _mm256_castsi256_si128(b8));
+        storeRgbaSSE2(rgba + x * 4 + 64, _mm256_extracti128_si256(r8, 1), _mm256_extracti128_si256(g8, 1), _mm256_extracti128_si256(b8, 1));
+    }
+
+    convertRowSSE2(y + x, uv + x, rgba + x * 4, width - x, c, nv21);
+}
+#endif
+
+#ifdef COLOR_CONVERT_NEON
+// 16 pixels per iteration, vld2 splits the chroma pairs and vst4 interleaves
+// the output
+static void convertRowNEON(const uint8_t *y, const uint8_t *uv, uint8_t *rgba, int width,
+                           const FixedCoefficients &c, bool nv21)
+{
+    const uint8x8_t bias = vdup_n_u8(128);
+    const uint8x16_t alpha = vdupq_n_u8(255);
+    const int16x8_t yOffset = vdupq_n_s16(c.yOffset);
+    const int16x8_t round = vdupq_n_s16(FIXED_ROUND);
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        uint8x16_t yv = vld1q_u8(y + x);
+        uint8x8x2_t uvv = vld2_u8(uv + x);
+
+        // Widening subtract wraps modulo 2^16, which is the right signed value
+        int16x8_t even = vreinterpretq_s16_u16(vsubl_u8(uvv.val[0], bias));
+        int16x8_t odd = vreinterpretq_s16_u16(vsubl_u8(uvv.val[1], bias));
+        int16x8_t u = nv21 ? odd : even;
+        int16x8_t v = nv21 ? even : odd;
+
+        const int16x8_t rvPairs = vmulq_n_s16(v, c.vr);
+        int16x8x2_t rv = vzipq_s16(rvPairs, rvPairs);
+        const int16x8_t guPairs = vmulq_n_s16(u, c.ug);
+        int16x8x2_t gu = vzipq_s16(guPairs, guPairs);
+        const int16x8_t gvPairs = vmulq_n_s16(v, c.vg);
+        int16x8x2_t gv = vzipq_s16(gvPairs, gvPairs);
+        const int16x8_t buPairs = vmulq_n_s16(u, c.ub);
+        int16x8x2_t bu = vzipq_s16(buPairs, buPairs);
+
+        int16x8_t y1[2];
+        y1[0] = vaddq_s16(vmulq_n_s16(vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(yv))), yOffset), c.yMul), round);
+        y1[1] = vaddq_s16(vmulq_n_s16(vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(yv))), yOffset), c.yMul), round);
+
+        uint8x8_t r[2], g[2], b[2];
+        for (int half = 0; half < 2; half++)
+        {
+            r[half] = vqmovun_s16(vshrq_n_s16(vqaddq_s16(y1[half], rv.val[half]), FIXED_SHIFT));
+            g[half] = vqmovun_s16(vshrq_n_s16(vqsubq_s16(vqsubq_s16(y1[half], gu.val[half]), gv.val[half]), FIXED_SHIFT));
+            b[half] = vqmovun_s16(vshrq_n_s16(vqaddq_s16(y1[half], bu.val[half]), FIXED_SHIFT));
+        }
+
+        uint8x16x4_t out;
+        out.val[0] = vcombine_u8(r[0], r[1]);
+        out.val[1] = vcombine_u8(g[0], g[1]);
+        out.val[2] = vcombine_u8(b[0], b[1]);
+        out.val[3] = alpha;
+        vst4q_u8(rgba + x * 4, out);
+    }
+
+    convertRowScalar(y + x, uv + x, rgba + x * 4, width - x, c, nv21);
+}
+#endif
+
+#ifndef __ANDROID__
+// Host builds (tools, tests) have no cpufeatures, the compiler probes the CPU
+bool isConvertKernelSupported(ConvertKernel kernel)
+{
+    switch (kernel)
+    {
+    case KERNEL_SCALAR:
+        return true;
+#ifdef COLOR_CONVERT_X86
+    case KERNEL_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case KERNEL_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+#ifdef COLOR_CONVERT_NEON
+    case KERNEL_NEON:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+#else
+bool isConvertKernelSupported(ConvertKernel kernel)
+{
+    const AndroidCpuFamily family = android_getCpuFamily();
+    const uint64_t features = android_getCpuFeatures();
+
+    switch (kernel)
+    {
+    case KERNEL_SCALAR:
+        return true;
+#ifdef COLOR_CONVERT_X86
+    case KERNEL_SSE2:
+        // Baseline on every x86 ABI Android supports
+        return family == ANDROID_CPU_FAMILY_X86 || family == ANDROID_CPU_FAMILY_X86_64;
+    case KERNEL_AVX2:
+        return (family == ANDROID_CPU_FAMILY_X86 || family == ANDROID_CPU_FAMILY_X86_64) &&
+               (features & ANDROID_CPU_X86_FEATURE_AVX2) != 0;
+#endif
+#ifdef COLOR_CONVERT_NEON
+    case KERNEL_NEON:
+        if (family == ANDROID_CPU_FAMILY_ARM64)
+            return (features & ANDROID_CPU_ARM64_FEATURE_ASIMD) != 0;
+        return family == ANDROID_CPU_FAMILY_ARM && (features & ANDROID_CPU_ARM_FEATURE_NEON) != 0;
+#endif
+    default:
+        return false;
+    }
+}
+#endif
+
+ConvertKernel getBestConvertKernel()
+{
+    static const ConvertKernel best = []() {
+        // SSE2 before AVX2: the wider kernel is not faster on every x86 part
+        // measured so far (slower at 720x480 on one host, faster at 1280x720
+        // on another) and has not been measured on the target SoC. It stays
+        // available through the explicit kernel argument.
+        static const ConvertKernel candidates[] = {KERNEL_SSE2, KERNEL_NEON};
+        ConvertKernel kernel = KERNEL_SCALAR;
+        for (ConvertKernel candidate : candidates)
+        {
+            if (isConvertKernelSupported(candidate))
+            {
+                kernel = candidate;
+                break;
+            }
+        }
+        ALOGD("Color conversion uses the %s kernel", getConvertKernelName(kernel));
+        return kernel;
+    }();
+    return best;
+}
+
+const char *getConvertKernelName(ConvertKernel kernel)
+{
+    switch (kernel)
+    {
+    case KERNEL_SCALAR:
+        return "scalar";
+    case KERNEL_SSE2:
+        return "sse2";
+    case KERNEL_AVX2:
+        return "avx2";
+    case KERNEL_NEON:
+        return "neon";
+    }
+    return "unknown";
+}
+
+static RowKernel getRowKernel(ConvertKernel kernel)
+{
+    if (!isConvertKernelSupported(kernel))
+        return convertRowScalar;
+
+    switch (kernel)
+    {
+#ifdef COLOR_CONVERT_X86
+    case KERNEL_SSE2:
+        return convertRowSSE2;
+    case KERNEL_AVX2:
+        return convertRowAVX2;
+#endif
+#ifdef COLOR_CONVERT_NEON
+    case KERNEL_NEON:
+        return convertRowNEON;
+#endif
+    default:
+        return convertRowScalar;
+    }
+}
+
+void convertYuv420spToRgba(const uint8_t *y, int yStride, const uint8_t *uv, int uvStride,
+                           uint8_t *rgba, int rgbaStride, int width, int height,
+                           const ColorFormat &format, ConvertKernel kernel)
+{
+    const RowKernel convertRow = getRowKernel(kernel);
+    const FixedCoefficients &c = gFixedCoefficients[format.matrix][format.range];
+    const bool nv21 = format.order == CHROMA_NV21;
+
+    for (int row = 0; row < height; row++)
+    {
+        convertRow(y + row * yStride, uv + (row / 2) * uvStride, rgba + row * rgbaStride, width, c, nv21);
+    }
+}
+
+void convertYuv420spToRgba(const uint8_t *y, int yStride, const uint8_t *uv, int uvStride,
+                           uint8_t *rgba, int rgbaStride, int width, int height,
+                           const ColorFormat &format)
+{
+    convertYuv420spToRgba(y, yStride, uv, uvStride, rgba, rgbaStride, width, height, format, getBestConvertKernel());
+}
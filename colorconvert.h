@@ -0,0 +1,88 @@
+#ifndef COLOR_CONVERT_H_
+#define COLOR_CONVERT_H_
+
+#include <stdint.h>
+
+// Byte order of the interleaved chroma plane
+enum ChromaOrder
+{
+    CHROMA_NV12 = 0, // U then V
+    CHROMA_NV21 = 1, // V then U
+};
+
+enum ColorMatrix
+{
+    MATRIX_BT601 = 0,
+    MATRIX_BT709 = 1,
+};
+
+enum ColorRange
+{
+    RANGE_LIMITED = 0, // Y 16..235, UV 16..240
+    RANGE_FULL = 1,
+};
+
+struct ColorFormat
+{
+    ChromaOrder order;
+    ColorMatrix matrix;
+    ColorRange range;
+};
+
+// R = yScale * (Y - yOffset) + vr * V
+// G = yScale * (Y - yOffset) - ug * U - vg * V
+// B = yScale * (Y - yOffset) + ub * U
+// with U and V centred on zero, everything on the 0..255 scale
+struct YuvCoefficients
+{
+    float yOffset;
+    float yScale;
+    float vr;
+    float ug;
+    float vg;
+    float ub;
+};
+
+constexpr YuvCoefficients gYuvCoefficients[2][2] = {
+    // BT.601 limited, full
+    {{16.0f, 1.164383f, 1.596027f, 0.391762f, 0.812968f, 2.017232f},
+     {0.0f, 1.0f, 1.402000f, 0.344136f, 0.714136f, 1.772000f}},
+    // BT.709 limited, full
+    {{16.0f, 1.164383f, 1.792741f, 0.213249f, 0.532909f, 2.112402f},
+     {0.0f, 1.0f, 1.574800f, 0.187324f, 0.468124f, 1.855600f}},
+};
+
+constexpr const YuvCoefficients &getYuvCoefficients(ColorMatrix matrix, ColorRange range)
+{
+    return gYuvCoefficients[matrix][range];
+}
+
+enum ConvertKernel
+{
+    KERNEL_SCALAR = 0,
+    KERNEL_SSE2,
+    KERNEL_AVX2,
+    KERNEL_NEON,
+};
+
+// Kernel used by default on this CPU, probed once through cpufeatures
+ConvertKernel getBestConvertKernel();
+const char *getConvertKernelName(ConvertKernel kernel);
+// False if the kernel is not compiled in or not supported by the CPU
+bool isConvertKernelSupported(ConvertKernel kernel);
+
+// The fixed point kernels round their coefficients to 1/64, so they differ
+// from the float math of the camera shader (buildCameraFragmentShader()) by
+// up to this many code values per channel, limited range being the worst
+static constexpr int COLOR_CONVERT_SHADER_TOLERANCE = 3;
+
+// Semi-planar YUV 4:2:0 to RGBA8888 (alpha 255). All kernels produce
+// bit-identical output, the scalar one is the reference.
+void convertYuv420spToRgba(const uint8_t *y, int yStride, const uint8_t *uv, int uvStride,
+                           uint8_t *rgba, int rgbaStride, int width, int height,
+                           const ColorFormat &format);
+void convertYuv420spToRgba(const uint8_t *y, int yStride, const uint8_t *uv, int uvStride,
+                           uint8_t *rgba, int rgbaStride, int width, int height,
+                           const ColorFormat &format, ConvertKernel kernel);
+
+#endif //COLOR_CONVERT_H_
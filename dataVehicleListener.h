@@ -20,17 +20,48 @@ using namespace android::hardware;
 using namespace android::hardware::automotive::vehicle::V2_0;
 
 constexpr int GEAR_SELECTION = static_cast<int>(VehicleProperty::GEAR_SELECTION);
+constexpr int PERF_VEHICLE_SPEED = static_cast<int>(VehicleProperty::PERF_VEHICLE_SPEED);
+constexpr int PARKING_BRAKE_ON = static_cast<int>(VehicleProperty::PARKING_BRAKE_ON);
+constexpr int TURN_SIGNAL_STATE = static_cast<int>(VehicleProperty::TURN_SIGNAL_STATE);
+constexpr int PERF_STEERING_ANGLE = static_cast<int>(VehicleProperty::PERF_STEERING_ANGLE);
 
 class DataVehicleListener : public IVehicleCallback
 {
 public:
     Return<void> onPropertyEvent(const hidl_vec<VehiclePropValue> &values) override
     {
-        ALOGD("onPropertyEvent");
+        // Speed and steering arrive several times a second, nothing is logged here
         for (auto it = values.begin(); it != values.end(); it++)
         {
-            ALOGD("Prop:0x%x", it->prop);
-            if (it->prop == GEAR_SELECTION)
+            if (it->prop == PERF_VEHICLE_SPEED)
+            {
+                if (mCallbackSpeedData != nullptr && it->value.floatValues.size() > 0)
+                {
+                    mCallbackSpeedData(it->value.floatValues[0]);
+                }
+            }
+            else if (it->prop == PARKING_BRAKE_ON)
+            {
+                if (mCallbackParkingBrakeData != nullptr && it->value.int32Values.size() > 0)
+                {
+                    mCallbackParkingBrakeData(it->value.int32Values[0] != 0);
+                }
+            }
+            else if (it->prop == TURN_SIGNAL_STATE)
+            {
+                if (mCallbackTurnSignalData != nullptr && it->value.int32Values.size() > 0)
+                {
+                    mCallbackTurnSignalData(it->value.int32Values[0] != static_cast<int>(VehicleTurnSignal::NONE));
+                }
+            }
+            else if (it->prop == PERF_STEERING_ANGLE)
+            {
+                if (mCallbackSteeringData != nullptr && it->value.floatValues.size() > 0)
+                {
+                    mCallbackSteeringData(it->value.floatValues[0]);
+                }
+            }
+            else if (it->prop == GEAR_SELECTION)
             {
                 if (mCallbackGearData != nullptr)
                 {
@@ -63,9 +94,20 @@ public:
     }
 
     void setCallback(std::function<void(bool)> callback = nullptr) { mCallbackGearData = callback; }
+    // Vehicle speed in m/s
+    void setSpeedCallback(std::function<void(float)> callback = nullptr) { mCallbackSpeedData = callback; }
+    void setParkingBrakeCallback(std::function<void(bool)> callback = nullptr) { mCallbackParkingBrakeData = callback; }
+    // True while either turn signal is on
+    void setTurnSignalCallback(std::function<void(bool)> callback = nullptr) { mCallbackTurnSignalData = callback; }
+    // Steering angle in degrees, left negative
+    void setSteeringCallback(std::function<void(float)> callback = nullptr) { mCallbackSteeringData = callback; }
 
 private:
     std::function<void(bool)> mCallbackGearData;
+    std::function<void(float)> mCallbackSpeedData;
+    std::function<void(bool)> mCallbackParkingBrakeData;
+    std::function<void(bool)> mCallbackTurnSignalData;
+    std::function<void(float)> mCallbackSteeringData;
 };
 
 #endif //DATAVEHICLELISTENER_H
@@ -0,0 +1,289 @@
+#define LOG_TAG "RearCameraColor"
+
+#include <string.h>
+#include <algorithm>
+#include <cutils/log.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define DEINTERLACE_X86 1
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DEINTERLACE_NEON 1
+#endif
+
+#include "deinterlace.h"
+
+static constexpr const char *gModeNames[] = {"weave", "bob", "adaptive"};
+
+DeinterlaceMode parseDeinterlaceMode(const char *name, DeinterlaceMode fallback)
+{
+    for (int mode = DEINTERLACE_WEAVE; mode <= DEINTERLACE_ADAPTIVE; mode++)
+    {
+        if (strcmp(name, gModeNames[mode]) == 0)
+            return static_cast<DeinterlaceMode>(mode);
+    }
+    return fallback;
+}
+
+const char *getDeinterlaceModeName(DeinterlaceMode mode)
+{
+    return gModeNames[mode];
+}
+
+// One missing line from the lines around it, and for the adaptive mode the
+// line of the older field in its place
+typedef void (*BobKernel)(const uint8_t *above, const uint8_t *below, uint8_t *out, int count);
+typedef void (*AdaptiveKernel)(const uint8_t *above, const uint8_t *woven, const uint8_t *below, uint8_t *out, int count);
+
+static void bobScalar(const uint8_t *above, const uint8_t *below, uint8_t *out, int count)
+{
+    for (int i = 0; i < count; i++)
+        out[i] = (above[i] + below[i] + 1) >> 1;
+}
+
+static void adaptiveScalar(const uint8_t *above, const uint8_t *woven, const uint8_t *below, uint8_t *out, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        const int low = std::max(std::min(above[i], below[i]) - DEINTERLACE_COMB_THRESHOLD, 0);
+        const int high = std::min(std::max(above[i], below[i]) + DEINTERLACE_COMB_THRESHOLD, 255);
+        const bool combs = woven[i] < low || woven[i] > high;
+        out[i] = combs ? (above[i] + below[i] + 1) >> 1 : woven[i];
+    }
+}
+
+#ifdef DEINTERLACE_X86
+static void bobSSE2(const uint8_t *above, const uint8_t *below, uint8_t *out, int count)
+{
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(above + i));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(below + i));
+        // Rounds up like the scalar kernel
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_avg_epu8(a, b));
+    }
+
+    bobScalar(above + i, below + i, out + i, count - i);
+}
+
+static void adaptiveSSE2(const uint8_t *above, const uint8_t *woven, const uint8_t *below, uint8_t *out, int count)
+{
+    const __m128i threshold = _mm_set1_epi8(DEINTERLACE_COMB_THRESHOLD);
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(above + i));
+        const __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i *>(woven + i));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(below + i));
+        // Saturation clamps the range to 0..255 like the scalar kernel
+        const __m128i low = _mm_subs_epu8(_mm_min_epu8(a, b), threshold);
+        const __m128i high = _mm_adds_epu8(_mm_max_epu8(a, b), threshold);
+        // No unsigned byte compare: w >= low and w <= high through min and max
+        const __m128i keep = _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(w, low), w), _mm_cmpeq_epi8(_mm_min_epu8(w, high), w));
+        const __m128i result = _mm_or_si128(_mm_and_si128(keep, w), _mm_andnot_si128(keep, _mm_avg_epu8(a, b)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), result);
+    }
+
+    adaptiveScalar(above + i, woven + i, below + i, out + i, count - i);
+}
+#endif
+
+#ifdef DEINTERLACE_NEON
+static void bobNEON(const uint8_t *above, const uint8_t *below, uint8_t *out, int count)
+{
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+        vst1q_u8(out + i, vrhaddq_u8(vld1q_u8(above + i), vld1q_u8(below + i)));
+
+    bobScalar(above + i, below + i, out + i, count - i);
+}
+
+static void adaptiveNEON(const uint8_t *above, const uint8_t *woven, const uint8_t *below, uint8_t *out, int count)
+{
+    const uint8x16_t threshold = vdupq_n_u8(DEINTERLACE_COMB_THRESHOLD);
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        const uint8x16_t a = vld1q_u8(above + i);
+        const uint8x16_t w = vld1q_u8(woven + i);
+        const uint8x16_t b = vld1q_u8(below + i);
+        const uint8x16_t low = vqsubq_u8(vminq_u8(a, b), threshold);
+        const uint8x16_t high = vqaddq_u8(vmaxq_u8(a, b), threshold);
+        const uint8x16_t keep = vandq_u8(vcgeq_u8(w, low), vcleq_u8(w, high));
+        vst1q_u8(out + i, vbslq_u8(keep, w, vrhaddq_u8(a, b)));
+    }
+
+    adaptiveScalar(above + i, woven + i, below + i, out + i, count - i);
+}
+#endif
+
+static BobKernel getBobKernel(ConvertKernel kernel)
+{
+    if (!isConvertKernelSupported(kernel))
+        return bobScalar;
+
+    switch (kernel)
+    {
+#ifdef DEINTERLACE_X86
+    // Bound by memory, AVX2 would not filter any faster
+    case KERNEL_SSE2:
+    case KERNEL_AVX2:
+        return bobSSE2;
+#endif
+#ifdef DEINTERLACE_NEON
+    case KERNEL_NEON:
+        return bobNEON;
+#endif
+    default:
+        return bobScalar;
+    }
+}
+
+static AdaptiveKernel getAdaptiveKernel(ConvertKernel kernel)
+{
+    if (!isConvertKernelSupported(kernel))
+        return adaptiveScalar;
+
+    switch (kernel)
+    {
+#ifdef DEINTERLACE_X86
+    case KERNEL_SSE2:
+    case KERNEL_AVX2:
+        return adaptiveSSE2;
+#endif
+#ifdef DEINTERLACE_NEON
+    case KERNEL_NEON:
+        return adaptiveNEON;
+#endif
+    default:
+        return adaptiveScalar;
+    }
+}
+
+bool Deinterlacer::init(int width, int frameHeight, int yStride, int uvStride, DeinterlaceMode mode)
+{
+    // Each field needs whole chroma rows
+    if (width < 2 || frameHeight < 4 || (frameHeight & 3) != 0 || yStride < width || uvStride < width)
+        return false;
+
+    mMode = mode;
+    mWidth = width;
+    mHeight = frameHeight;
+    mYStride = yStride;
+    mUVStride = uvStride;
+
+    const size_t ySize = static_cast<size_t>(yStride) * frameHeight;
+    const size_t uvSize = static_cast<size_t>(uvStride) * frameHeight / 2;
+    mWovenPlanes.assign(ySize + uvSize, 0);
+    mWoven = CameraFrame();
+    mWoven.y = mWovenPlanes.data();
+    mWoven.uv = mWovenPlanes.data() + ySize;
+    mWoven.yStride = yStride;
+    mWoven.uvStride = uvStride;
+    mHasField[0] = mHasField[1] = false;
+
+    // Weave mode never writes a frame of its own
+    mOutputPlanes.clear();
+    if (mode != DEINTERLACE_WEAVE)
+        mOutputPlanes.resize(ySize + uvSize);
+    mOutput = CameraFrame();
+    mOutput.y = mOutputPlanes.data();
+    mOutput.uv = mOutputPlanes.data() + ySize;
+    mOutput.yStride = yStride;
+    mOutput.uvStride = uvStride;
+
+    ALOGD("Deinterlacing %dx%d, %s", width, frameHeight, getDeinterlaceModeName(mode));
+    return true;
+}
+
+// rows counts the lines of the frame, the field has half of them
+void Deinterlacer::weavePlane(const unsigned char *src, int stride, unsigned char *dst, int dstStride, int rows, int parity,
+                              bool fillOther)
+{
+    for (int row = 0; row < rows / 2; row++)
+    {
+        const unsigned char *line = src + static_cast<size_t>(row) * stride;
+        memcpy(dst + static_cast<size_t>(row * 2 + parity) * dstStride, line, mWidth);
+        if (fillOther)
+            memcpy(dst + static_cast<size_t>(row * 2 + (parity ^ 1)) * dstStride, line, mWidth);
+    }
+}
+
+const CameraFrame &Deinterlacer::weave(const CameraFrame &frame)
+{
+    if ((frame.field != FIELD_TOP && frame.field != FIELD_BOTTOM) || mWovenPlanes.empty())
+        return frame;
+
+    const int parity = frame.field == FIELD_BOTTOM ? 1 : 0;
+    const bool fillOther = !mHasField[parity ^ 1];
+    unsigned char *y = mWovenPlanes.data();
+    unsigned char *uv = y + static_cast<size_t>(mYStride) * mHeight;
+    weavePlane(frame.y, frame.yStride, y, mYStride, mHeight, parity, fillOther);
+    weavePlane(frame.uv, frame.uvStride, uv, mUVStride, mHeight / 2, parity, fillOther);
+    mHasField[parity] = true;
+
+    // The field just copied is the newest one
+    mWoven.index = frame.index;
+    mWoven.generation = frame.generation;
+    mWoven.sequence = frame.sequence;
+    mWoven.timestamp = frame.timestamp;
+    mWoven.dequeueTime = frame.dequeueTime;
+    mWoven.field = parity == 0 ? FIELD_INTERLACED_BT : FIELD_INTERLACED_TB;
+    return mWoven;
+}
+
+// Lines of the newest field are copied, the others rebuilt from it
+void Deinterlacer::deinterlacePlane(const unsigned char *src, int stride, unsigned char *dst, int dstStride, int rows,
+                                    int newest, ConvertKernel kernel)
+{
+    const BobKernel bob = getBobKernel(kernel);
+    const AdaptiveKernel adaptive = getAdaptiveKernel(kernel);
+
+    for (int row = 0; row < rows; row++)
+    {
+        const unsigned char *line = src + static_cast<size_t>(row) * stride;
+        unsigned char *out = dst + static_cast<size_t>(row) * dstStride;
+        if ((row & 1) == newest)
+        {
+            memcpy(out, line, mWidth);
+            continue;
+        }
+
+        // The first and last lines only have one neighbour in the field
+        const unsigned char *above = row > 0 ? line - stride : line + stride;
+        const unsigned char *below = row + 1 < rows ? line + stride : line - stride;
+        if (mMode == DEINTERLACE_BOB)
+            bob(above, below, out, mWidth);
+        else
+            adaptive(above, line, below, out, mWidth);
+    }
+}
+
+const CameraFrame &Deinterlacer::deinterlace(const CameraFrame &frame, ConvertKernel kernel)
+{
+    if ((frame.field != FIELD_INTERLACED_TB && frame.field != FIELD_INTERLACED_BT) || mOutputPlanes.empty())
+        return frame;
+
+    // Parity of the lines of the field captured last
+    const int newest = frame.field == FIELD_INTERLACED_TB ? 1 : 0;
+    unsigned char *y = mOutputPlanes.data();
+    unsigned char *uv = y + static_cast<size_t>(mYStride) * mHeight;
+    deinterlacePlane(frame.y, frame.yStride, y, mYStride, mHeight, newest, kernel);
+    deinterlacePlane(frame.uv, frame.uvStride, uv, mUVStride, mHeight / 2, newest, kernel);
+
+    mOutput.index = frame.index;
+    mOutput.generation = frame.generation;
+    mOutput.sequence = frame.sequence;
+    mOutput.timestamp = frame.timestamp;
+    mOutput.dequeueTime = frame.dequeueTime;
+    mOutput.field = FIELD_PROGRESSIVE;
+    return mOutput;
+}
+
+const CameraFrame &Deinterlacer::deinterlace(const CameraFrame &frame)
+{
+    return deinterlace(frame, getBestConvertKernel());
+}
@@ -0,0 +1,76 @@
+#ifndef DEINTERLACE_H_
+#define DEINTERLACE_H_
+
+#include <stdint.h>
+#include <vector>
+
+#include "colorconvert.h"
+#include "framesource.h"
+
+enum DeinterlaceMode
+{
+    // Both fields as they are, sharpest when nothing moves
+    DEINTERLACE_WEAVE = 0,
+    // Only the newest field, missing lines averaged from their neighbours
+    DEINTERLACE_BOB,
+    // Weave where the older field agrees with its neighbours, bob where it
+    // combs because something moved between the fields
+    DEINTERLACE_ADAPTIVE,
+};
+
+// An older field line is taken as is while it stays within this many code
+// values of the range spanned by the lines around it
+static constexpr int DEINTERLACE_COMB_THRESHOLD = 12;
+
+// "weave", "bob" or "adaptive", anything else gives fallback
+DeinterlaceMode parseDeinterlaceMode(const char *name, DeinterlaceMode fallback);
+const char *getDeinterlaceModeName(DeinterlaceMode mode);
+
+// Turns interlaced camera frames into progressive ones and weaves single
+// fields back into frames, for the software path. The GPU does the same
+// filtering in the camera shader (see getCameraProgram()) and takes single
+// fields as they are (see StreamingUploader).
+class Deinterlacer
+{
+public:
+    // Strides are the camera frame strides, fixed while the stream runs.
+    // frameHeight counts the lines of both fields.
+    bool init(int width, int frameHeight, int yStride, int uvStride, DeinterlaceMode mode);
+    DeinterlaceMode getMode() const { return mMode; };
+
+    // A frame holding both fields. Single fields are copied over the lines
+    // of the same parity of the previous ones, the result is owned by the
+    // deinterlacer and valid until the next call. Other frames are given
+    // back as they are.
+    const CameraFrame &weave(const CameraFrame &frame);
+
+    // Progressive version of a frame holding both fields, owned by the
+    // deinterlacer and valid until the next call. Progressive frames and
+    // weave mode give the frame back. All kernels produce bit-identical
+    // output, the scalar one is the reference.
+    const CameraFrame &deinterlace(const CameraFrame &frame);
+    const CameraFrame &deinterlace(const CameraFrame &frame, ConvertKernel kernel);
+
+private:
+    void weavePlane(const unsigned char *src, int stride, unsigned char *dst, int dstStride, int rows, int parity,
+                    bool fillOther);
+    void deinterlacePlane(const unsigned char *src, int stride, unsigned char *dst, int dstStride, int rows, int newest,
+                          ConvertKernel kernel);
+
+    DeinterlaceMode mMode = DEINTERLACE_ADAPTIVE;
+    int mWidth = 0;
+    int mHeight = 0;
+    int mYStride = 0;
+    int mUVStride = 0;
+
+    // Single fields woven together, the second one is line doubled until
+    // its first field arrives
+    std::vector<unsigned char> mWovenPlanes;
+    CameraFrame mWoven;
+    bool mHasField[2] = {};
+
+    std::vector<unsigned char> mOutputPlanes;
+    CameraFrame mOutput;
+};
+
+#endif //DEINTERLACE_H_
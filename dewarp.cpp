@@ -0,0 +1,325 @@
+#define LOG_TAG "RearCameraGL"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <utils/Log.h>
+
+#include "dewarp.h"
+#include "helper.h"
+
+// Written in front of the cached grid
+struct DewarpCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    // Hash of the calibration, the crop and the grid size
+    uint64_t key;
+    uint32_t count;
+    // Hash of the grid, catches truncated or corrupted files
+    uint32_t checksum;
+};
+
+static constexpr uint32_t DEWARP_CACHE_MAGIC = 0x57445243; // "CRDW"
+static constexpr uint32_t DEWARP_CACHE_VERSION = 1;
+
+static uint64_t fnv1a64(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static float toRadians(float degrees)
+{
+    return degrees * static_cast<float>(M_PI) / 180.0f;
+}
+
+bool loadLensCalibration(const std::string &fileName, LensCalibration &calibration)
+{
+    FILE *fp = fopen(fileName.c_str(), "r");
+    if (fp == NULL)
+    {
+        ALOGD("No lens calibration at %s", fileName.c_str());
+        return false;
+    }
+
+    LensCalibration parsed;
+    bool hasSize = false, hasFocal = false, hasCenter = false, hasModel = false;
+    char line[256];
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        char *comment = strchr(line, '#');
+        if (comment != NULL)
+            *comment = '\0';
+
+        float *k = parsed.k;
+        if (sscanf(line, " size %d %d", &parsed.width, &parsed.height) == 2)
+            hasSize = true;
+        else if (sscanf(line, " focal %f %f", &parsed.fx, &parsed.fy) == 2)
+            hasFocal = true;
+        else if (sscanf(line, " center %f %f", &parsed.cx, &parsed.cy) == 2)
+            hasCenter = true;
+        else if (sscanf(line, " fisheye %f %f %f %f", &k[0], &k[1], &k[2], &k[3]) == 4)
+        {
+            parsed.model = LensCalibration::MODEL_FISHEYE;
+            hasModel = true;
+        }
+        else if (sscanf(line, " radtan %f %f %f %f %f", &k[0], &k[1], &k[2], &k[3], &k[4]) == 5)
+        {
+            parsed.model = LensCalibration::MODEL_RADTAN;
+            hasModel = true;
+        }
+        else if (sscanf(line, " output %f %f", &parsed.hfov, &parsed.vfov) == 2)
+            continue;
+        else if (sscanf(line, " tilt %f", &parsed.tilt) == 1)
+            continue;
+    }
+    fclose(fp);
+
+    if (!hasSize || !hasFocal || !hasCenter || !hasModel || parsed.width <= 0 || parsed.height <= 0 ||
+        parsed.fx <= 0.0f || parsed.fy <= 0.0f || parsed.hfov <= 0.0f || parsed.hfov >= 180.0f ||
+        parsed.vfov <= 0.0f || parsed.vfov >= 180.0f)
+    {
+        ALOGD("Ignoring incomplete lens calibration %s", fileName.c_str());
+        return false;
+    }
+    calibration = parsed;
+    return true;
+}
+
+DewarpMesh::~DewarpMesh()
+{
+    destroy();
+}
+
+void DewarpMesh::build(const LensCalibration &calibration, const ViewRect &crop, const std::string &cachePath)
+{
+    const int grid[2] = {DEWARP_GRID_COLUMNS, DEWARP_GRID_ROWS};
+    uint64_t key = 0xcbf29ce484222325ULL;
+    key = fnv1a64(key, &calibration, sizeof(calibration));
+    key = fnv1a64(key, &crop, sizeof(crop));
+    key = fnv1a64(key, grid, sizeof(grid));
+
+    // The grid is loaded back unchecked beyond its checksum
+    std::string cache = cachePath;
+    const size_t slash = cache.rfind('/');
+    const std::string dir = slash == std::string::npos ? "." : cache.substr(0, std::max<size_t>(slash, 1));
+    if (!cache.empty() && !Helper::isPrivateDirectory(dir))
+    {
+        ALOGD("Dewarp cache %s is not in a private directory, not using it", cache.c_str());
+        cache.clear();
+    }
+
+    if (!cache.empty() && loadCache(cache, key))
+        return;
+
+    compute(calibration, crop);
+    if (!cache.empty())
+        storeCache(cache, key);
+}
+
+// Every grid point is a ray of the virtual pinhole camera, tilted down,
+// projected through the lens model into the camera image
+void DewarpMesh::compute(const LensCalibration &calibration, const ViewRect &crop)
+{
+    const float tanX = tanf(toRadians(calibration.hfov) / 2.0f);
+    const float tanY = tanf(toRadians(calibration.vfov) / 2.0f);
+    const float tiltCos = cosf(toRadians(calibration.tilt));
+    const float tiltSin = sinf(toRadians(calibration.tilt));
+    const float *k = calibration.k;
+
+    mGrid.resize((DEWARP_GRID_COLUMNS + 1) * (DEWARP_GRID_ROWS + 1) * 2);
+    for (int row = 0; row <= DEWARP_GRID_ROWS; row++)
+    {
+        for (int column = 0; column <= DEWARP_GRID_COLUMNS; column++)
+        {
+            // Camera coordinates, x right, y down, z forward
+            const float a = crop.x + crop.w * column / DEWARP_GRID_COLUMNS;
+            const float b = crop.y + crop.h * row / DEWARP_GRID_ROWS;
+            const float rayX = (2.0f * a - 1.0f) * tanX;
+            const float virtualY = (2.0f * b - 1.0f) * tanY;
+            const float rayY = virtualY * tiltCos + tiltSin;
+            const float rayZ = tiltCos - virtualY * tiltSin;
+
+            float xd, yd;
+            if (calibration.model == LensCalibration::MODEL_FISHEYE)
+            {
+                // Equidistant, also past 90 degrees off axis
+                const float radius = hypotf(rayX, rayY);
+                const float theta = atan2f(radius, rayZ);
+                const float theta2 = theta * theta;
+                const float thetaD = theta * (1.0f + theta2 * (k[0] + theta2 * (k[1] + theta2 * (k[2] + theta2 * k[3]))));
+                const float scale = radius > 1e-6f ? thetaD / radius : 1.0f;
+                xd = rayX * scale;
+                yd = rayY * scale;
+            }
+            else if (rayZ > 1e-3f)
+            {
+                const float x = rayX / rayZ;
+                const float y = rayY / rayZ;
+                const float r2 = x * x + y * y;
+                const float radial = 1.0f + r2 * (k[0] + r2 * (k[1] + r2 * k[4]));
+                xd = x * radial + 2.0f * k[2] * x * y + k[3] * (r2 + 2.0f * x * x);
+                yd = y * radial + k[2] * (r2 + 2.0f * y * y) + 2.0f * k[3] * x * y;
+            }
+            else
+            {
+                // Behind a pinhole lens, never visible
+                xd = yd = -1e6f;
+            }
+
+            float *point = &mGrid[(row * (DEWARP_GRID_COLUMNS + 1) + column) * 2];
+            point[0] = (calibration.fx * xd + calibration.cx) / calibration.width;
+            point[1] = (calibration.fy * yd + calibration.cy) / calibration.height;
+        }
+    }
+    ALOGD("Dewarp mesh computed, %dx%d cells", DEWARP_GRID_COLUMNS, DEWARP_GRID_ROWS);
+}
+
+bool DewarpMesh::loadCache(const std::string &path, uint64_t key)
+{
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (fp == NULL)
+        return false;
+
+    DewarpCacheHeader header;
+    std::vector<float> grid((DEWARP_GRID_COLUMNS + 1) * (DEWARP_GRID_ROWS + 1) * 2);
+    bool valid = fread(&header, sizeof(header), 1, fp) == 1 && header.magic == DEWARP_CACHE_MAGIC &&
+                 header.version == DEWARP_CACHE_VERSION && header.key == key && header.count == grid.size() &&
+                 fread(grid.data(), sizeof(float), grid.size(), fp) == grid.size() &&
+                 header.checksum == static_cast<uint32_t>(fnv1a64(0xcbf29ce484222325ULL, grid.data(), grid.size() * sizeof(float)));
+    fclose(fp);
+
+    if (!valid)
+    {
+        // Stale or broken, rebuilt and stored again
+        unlink(path.c_str());
+        return false;
+    }
+    mGrid = std::move(grid);
+    ALOGD("Dewarp mesh loaded from %s", path.c_str());
+    return true;
+}
+
+void DewarpMesh::storeCache(const std::string &path, uint64_t key)
+{
+    DewarpCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = DEWARP_CACHE_MAGIC;
+    header.version = DEWARP_CACHE_VERSION;
+    header.key = key;
+    header.count = mGrid.size();
+    header.checksum = static_cast<uint32_t>(fnv1a64(0xcbf29ce484222325ULL, mGrid.data(), mGrid.size() * sizeof(float)));
+
+    // Written aside and renamed, a power cut never leaves a half written grid
+    const std::string tmpPath = path + ".tmp";
+    FILE *fp = fopen(tmpPath.c_str(), "wb");
+    if (fp == NULL)
+    {
+        ALOGD("Can not write dewarp cache %s (%d = %s)", tmpPath.c_str(), errno, strerror(errno));
+        return;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+                   fwrite(mGrid.data(), sizeof(float), mGrid.size(), fp) == mGrid.size() &&
+                   fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    written = fclose(fp) == 0 && written;
+
+    if (!written || rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        ALOGD("Failed to store dewarp cache %s", path.c_str());
+        unlink(tmpPath.c_str());
+    }
+}
+
+bool DewarpMesh::upload(const ViewRect &view, int surfaceWidth, int surfaceHeight)
+{
+    if (mGrid.empty())
+        return false;
+
+    // x, y in surface pixels from the bottom left, then u, v
+    std::vector<GLfloat> vertices;
+    vertices.reserve((DEWARP_GRID_COLUMNS + 1) * (DEWARP_GRID_ROWS + 1) * 4);
+    for (int row = 0; row <= DEWARP_GRID_ROWS; row++)
+    {
+        for (int column = 0; column <= DEWARP_GRID_COLUMNS; column++)
+        {
+            const float *point = getPoint(column, row);
+            vertices.push_back((view.x + view.w * column / DEWARP_GRID_COLUMNS) * surfaceWidth);
+            vertices.push_back((1.0f - view.y - view.h * row / DEWARP_GRID_ROWS) * surfaceHeight);
+            vertices.push_back(point[0]);
+            vertices.push_back(point[1]);
+        }
+    }
+
+    // Cells reaching outside the camera image are left out rather than
+    // smeared from the texture edge
+    std::vector<GLushort> indices;
+    for (int row = 0; row < DEWARP_GRID_ROWS; row++)
+    {
+        for (int column = 0; column < DEWARP_GRID_COLUMNS; column++)
+        {
+            const GLushort corners[4] = {
+                static_cast<GLushort>(row * (DEWARP_GRID_COLUMNS + 1) + column),
+                static_cast<GLushort>(row * (DEWARP_GRID_COLUMNS + 1) + column + 1),
+                static_cast<GLushort>((row + 1) * (DEWARP_GRID_COLUMNS + 1) + column),
+                static_cast<GLushort>((row + 1) * (DEWARP_GRID_COLUMNS + 1) + column + 1)};
+            bool inside = true;
+            for (GLushort corner : corners)
+            {
+                const float *point = &mGrid[corner * 2];
+                inside = inside && point[0] >= 0.0f && point[0] <= 1.0f && point[1] >= 0.0f && point[1] <= 1.0f;
+            }
+            if (!inside)
+                continue;
+            indices.insert(indices.end(), {corners[0], corners[2], corners[1], corners[1], corners[2], corners[3]});
+        }
+    }
+    mIndexCount = indices.size();
+
+    glGenVertexArrays(1, &mVAO);
+    glGenBuffers(2, mBuffers);
+    glBindVertexArray(mVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, mBuffers[0]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mBuffers[1]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * indices.size(), indices.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(GL_ZERO);
+    glVertexAttribPointer(GL_ZERO, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), GL_ZERO);
+    glBindVertexArray(GL_ZERO);
+    glBindBuffer(GL_ARRAY_BUFFER, GL_ZERO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, GL_ZERO);
+
+    ALOGD("Dewarp mesh uploaded, %zu vertices, %d of %d cells visible", vertices.size() / 4, mIndexCount / 6,
+          DEWARP_GRID_COLUMNS * DEWARP_GRID_ROWS);
+    return glGetError() == GL_NO_ERROR;
+}
+
+void DewarpMesh::draw()
+{
+    glBindVertexArray(mVAO);
+    glDrawElements(GL_TRIANGLES, mIndexCount, GL_UNSIGNED_SHORT, GL_ZERO);
+    glBindVertexArray(GL_ZERO);
+}
+
+void DewarpMesh::destroy()
+{
+    if (mVAO != 0)
+    {
+        glDeleteVertexArrays(1, &mVAO);
+        mVAO = 0;
+    }
+    if (mBuffers[0] != 0)
+    {
+        glDeleteBuffers(2, mBuffers);
+        mBuffers[0] = mBuffers[1] = 0;
+    }
+    mIndexCount = 0;
+}
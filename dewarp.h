@@ -0,0 +1,88 @@
+#ifndef DEWARP_H_
+#define DEWARP_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "shader.h"
+#include "framesource.h"
+
+// Grid of the warp mesh over the shown view, in cells
+static constexpr int DEWARP_GRID_COLUMNS = 32;
+static constexpr int DEWARP_GRID_ROWS = 24;
+
+// Rear lens calibration, read from a text file of "<key> <values>" lines:
+//   size 1280 720             image size the intrinsics were measured at
+//   focal 420.5 421.0         fx fy in pixels
+//   center 640.2 361.7        cx cy in pixels
+//   fisheye k1 k2 k3 k4       equidistant model (OpenCV fisheye), or
+//   radtan k1 k2 p1 p2 k3     polynomial model (OpenCV default)
+//   output 100 75             fields of view of the corrected image, degrees
+//   tilt 0                    extra downward tilt of the corrected view,
+//                             90 minus the camera pitch gives a top view
+// "#" starts a comment.
+struct LensCalibration
+{
+    enum Model
+    {
+        MODEL_RADTAN = 0,
+        MODEL_FISHEYE,
+    };
+
+    int width = 0;
+    int height = 0;
+    float fx = 0.0f;
+    float fy = 0.0f;
+    float cx = 0.0f;
+    float cy = 0.0f;
+    Model model = MODEL_RADTAN;
+    float k[5] = {};
+    float hfov = 100.0f;
+    float vfov = 75.0f;
+    float tilt = 0.0f;
+};
+
+bool loadLensCalibration(const std::string &fileName, LensCalibration &calibration);
+
+// Corrected (pinhole) view to camera image mapping, sampled on a grid so
+// the GPU interpolates it across each cell like any other texture
+// coordinate and the fragment shader stays a plain lookup. The software
+// path turns the same mesh into a per pixel table, see RemapTable.
+class DewarpMesh
+{
+public:
+    ~DewarpMesh();
+
+    // crop is the part of the corrected image shown. The grid is loaded
+    // from cachePath when it was built from the same inputs, else computed
+    // and stored there, an empty path disables the cache.
+    void build(const LensCalibration &calibration, const ViewRect &crop, const std::string &cachePath);
+    bool isBuilt() const { return !mGrid.empty(); };
+
+    // Source position of grid point column, row (row 0 at the top) as
+    // fractions of the camera image, top first, outside 0..1 when the lens
+    // does not see that direction
+    const float *getPoint(int column, int row) const { return &mGrid[(row * (DEWARP_GRID_COLUMNS + 1) + column) * 2]; };
+
+    // Needs a current GL context. The mesh covers view, in fractions of the
+    // surface from the top left, with the vertex layout of the camera quad.
+    bool upload(const ViewRect &view, int surfaceWidth, int surfaceHeight);
+    // Draws with whatever program and camera textures are bound
+    void draw();
+    void destroy();
+
+private:
+    void compute(const LensCalibration &calibration, const ViewRect &crop);
+    bool loadCache(const std::string &path, uint64_t key);
+    void storeCache(const std::string &path, uint64_t key);
+
+    // u, v per grid point
+    std::vector<float> mGrid;
+
+    GLuint mVAO = 0;
+    GLuint mBuffers[2] = {};
+    GLsizei mIndexCount = 0;
+};
+
+#endif //DEWARP_H_
@@ -0,0 +1,81 @@
+#ifndef EVENT_QUEUE_H_
+#define EVENT_QUEUE_H_
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bounded lock-free queue, many producers and a single consumer. Each cell
+// carries a sequence number telling whose turn it is (Vyukov's bounded
+// queue), so producers only contend on one compare-exchange and the
+// consumer never takes a lock. T must be trivially copyable.
+template <typename T, size_t N>
+class EventQueue
+{
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "capacity must be a power of two");
+
+public:
+    EventQueue()
+    {
+        for (size_t i = 0; i < N; i++)
+            mCells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    // Any thread. Returns false when the queue is full.
+    bool push(const T &value)
+    {
+        size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Cell &cell = mCells[pos & (N - 1)];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0)
+            {
+                if (mEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    cell.value = value;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                // The consumer has not freed this cell yet
+                return false;
+            }
+            else
+            {
+                pos = mEnqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Consumer thread only. Returns false when empty.
+    bool pop(T &value)
+    {
+        Cell &cell = mCells[mDequeuePos & (N - 1)];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        if (sequence != mDequeuePos + 1)
+            return false;
+
+        value = cell.value;
+        cell.sequence.store(mDequeuePos + N, std::memory_order_release);
+        mDequeuePos++;
+        return true;
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    Cell mCells[N];
+    // Producers and consumer on separate cache lines
+    alignas(64) std::atomic<size_t> mEnqueuePos{0};
+    alignas(64) size_t mDequeuePos = 0;
+};
+
+#endif //EVENT_QUEUE_H_
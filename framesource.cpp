@@ -0,0 +1,123 @@
+#define LOG_TAG "RearCamera"
+
+#include <stdio.h>
+#include <string.h>
+#include <cutils/log.h>
+#include <cutils/properties.h>
+#include <utils/Timers.h>
+
+#include "framesource.h"
+#include "videocapture.h"
+#include "pacedframesource.h"
+
+// Parses the optional ":WxH@fps" tail of a spec, keeping defaults when absent
+// or invalid. NV21 needs an even size, every second pixel and line carries
+// chroma.
+static void parseGeometry(const std::string &geometry, int *width, int *height, int *fps)
+{
+    if (geometry.empty())
+        return;
+
+    int parsedWidth = 0;
+    int parsedHeight = 0;
+    int parsedFps = *fps;
+    int count = sscanf(geometry.c_str(), "%dx%d@%d", &parsedWidth, &parsedHeight, &parsedFps);
+    if (count < 2 || parsedWidth <= 0 || parsedHeight <= 0 || (parsedWidth & 1) != 0 || (parsedHeight & 1) != 0 ||
+        parsedFps <= 0)
+    {
+        ALOGD("Ignoring invalid geometry \"%s\"", geometry.c_str());
+        return;
+    }
+    *width = parsedWidth;
+    *height = parsedHeight;
+    *fps = parsedFps;
+}
+
+FrameSource *FrameSource::create(const std::string &spec)
+{
+    int width = CAMERA_WIDTH;
+    int height = CAMERA_HEIGHT;
+    int fps = PACED_SOURCE_DEFAULT_FPS;
+
+    if (spec.compare(0, 9, "synthetic") == 0)
+    {
+        if (spec.size() > 10)
+            parseGeometry(spec.substr(10), &width, &height, &fps);
+        ALOGD("Using synthetic frame source %dx%d@%d", width, height, fps);
+        return new SyntheticFrameSource(width, height, fps);
+    }
+
+    if (spec.compare(0, 5, "file:") == 0)
+    {
+        std::string path = spec.substr(5);
+        size_t colon = path.find(':');
+        if (colon != std::string::npos)
+        {
+            parseGeometry(path.substr(colon + 1), &width, &height, &fps);
+            path.resize(colon);
+        }
+        ALOGD("Using replay frame source %s %dx%d@%d", path.c_str(), width, height, fps);
+        return new FileReplaySource(path, width, height, fps);
+    }
+
+    VideoCapture *capture = new VideoCapture();
+
+    char memory[PROPERTY_VALUE_MAX];
+    property_get(CAMERA_MEMORY_PROPERTY, memory, "mmap");
+    int mode = VideoCapture::MEMORY_MMAP;
+    if (strcmp(memory, "userptr") == 0)
+        mode = VideoCapture::MEMORY_USERPTR;
+    else if (strcmp(memory, "dmabuf") == 0)
+        mode = VideoCapture::MEMORY_DMABUF;
+    capture->setMemoryMode(mode, property_get_bool(CAMERA_HUGEPAGES_PROPERTY, false));
+    capture->setBufferCount(property_get_int32(CAMERA_BUFFERS_PROPERTY, CAMERA_DEFAULT_BUFFERS));
+    capture->setQueueLatencyTarget(property_get_int32(CAMERA_QUEUE_LATENCY_PROPERTY, CAMERA_QUEUE_LATENCY_MS));
+    capture->setFieldRate(property_get_bool(CAMERA_FIELD_RATE_PROPERTY, false));
+    ALOGD("Using V4L2 frame source %s, %s memory", spec.c_str(), memory);
+    return capture;
+}
+
+void FrameSource::publishFrame(CameraFrame *frame, const FrameLease &lease)
+{
+    // Overwriting the back slot releases whatever frame it held, unless the
+    // renderer still has a lease on it
+    frame->generation = mMailbox.generation() + 1;
+    frame->dequeueTime = systemTime(SYSTEM_TIME_MONOTONIC);
+    mMailbox.back() = lease;
+    mMailbox.publish();
+    {
+        const std::lock_guard<std::mutex> lock(mFrameMutex);
+    }
+    mFrameCondition.notify_one();
+}
+
+void FrameSource::flushFrames()
+{
+    mMailbox.back() = FrameLease();
+    mMailbox.publish();
+    mMailbox.back() = FrameLease();
+}
+
+bool FrameSource::waitForFrame(uint32_t lastGeneration, int timeoutMs)
+{
+    std::unique_lock<std::mutex> lock(mFrameMutex);
+    bool woken = mFrameCondition.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                                          [this, lastGeneration]() { return mWakeRequested || mMailbox.generation() != lastGeneration; });
+    mWakeRequested = false;
+    return woken;
+}
+
+void FrameSource::wakeUp()
+{
+    {
+        const std::lock_guard<std::mutex> lock(mFrameMutex);
+        mWakeRequested = true;
+    }
+    mFrameCondition.notify_one();
+}
+
+FrameLease FrameSource::acquireFrame()
+{
+    mMailbox.update();
+    return mMailbox.front();
+}
@@ -0,0 +1,164 @@
+#ifndef FRAME_SOURCE_H_
+#define FRAME_SOURCE_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <stdint.h>
+
+#include "colorconvert.h"
+#include "triplebuffer.h"
+#include "stats.h"
+
+// How a frame carries interlaced video. Fields alternate line by line, the
+// top field holds the even lines (chroma rows too).
+enum FrameField
+{
+    FIELD_PROGRESSIVE = 0,
+    // Both fields, the one named last was captured last
+    FIELD_INTERLACED_TB,
+    FIELD_INTERLACED_BT,
+    // A single field, half the lines of a frame
+    FIELD_TOP,
+    FIELD_BOTTOM,
+};
+
+// One NV21 frame owned by a source, planes are only valid while leased.
+struct CameraFrame
+{
+    int index = -1;
+    uint32_t generation = 0;
+    uint32_t sequence = 0;
+    // Capture time, CLOCK_MONOTONIC in ns, 0 when the driver gives none
+    int64_t timestamp = 0;
+    // When the capture thread published the frame, CLOCK_MONOTONIC in ns
+    int64_t dequeueTime = 0;
+    const unsigned char *y = nullptr;
+    const unsigned char *uv = nullptr;
+    // Bytes between the start of two lines, at least the width
+    int yStride = 0;
+    int uvStride = 0;
+    // dma-buf fds of the planes for zero copy consumers, -1 unless the
+    // source exports them. Owned by the source, dup() to keep one.
+    int yFd = -1;
+    int uvFd = -1;
+    // Where the UV plane starts within uvFd, non zero when it shares yFd
+    int uvOffset = 0;
+    FrameField field = FIELD_PROGRESSIVE;
+};
+
+// Normalized rectangle, 0..1 on both axes from the top left corner
+struct ViewRect
+{
+    float x = 0.0f;
+    float y = 0.0f;
+    float w = 1.0f;
+    float h = 1.0f;
+
+    bool isFull() const { return x <= 0.0f && y <= 0.0f && w >= 1.0f && h >= 1.0f; };
+};
+
+// Refcounted handle on a frame. The buffer goes back to its source (for
+// V4L2, queueFrame) when the last lease on it is dropped.
+typedef std::shared_ptr<const CameraFrame> FrameLease;
+
+// Anything able to deliver NV21 frames to the renderer: the V4L2 camera, or
+// a synthetic/replay source to run the pipeline without the car.
+class FrameSource
+{
+public:
+    virtual ~FrameSource() {}
+
+    // Build a source from a spec string:
+    //   /dev/videoN                   V4L2 capture device
+    //   synthetic[:WxH[@fps]]         generated test pattern
+    //   file:<path>[:WxH[@fps]]       raw NV21 frames, looped
+    static FrameSource *create(const std::string &spec);
+
+    virtual bool open(const char *name) = 0;
+    virtual void close() = 0;
+    virtual bool isOpen() = 0;
+
+    virtual bool startStream() = 0;
+    virtual void stopStream() = 0;
+
+    // Valid only after open()
+    virtual int getWidth() = 0;
+    virtual int getHeight() = 0;
+    // Plane line pitch in bytes, what every frame carries in CameraFrame
+    virtual int getYStride() = 0;
+    virtual int getUVStride() = 0;
+
+    // True when frames carry interlaced video, see CameraFrame::field
+    bool isInterlaced() { return mInterlaced; };
+    // Lines of a whole frame: twice getHeight() when every frame is a
+    // single field. Valid only after open().
+    int getFrameHeight() { return mFieldRate ? getHeight() * 2 : getHeight(); };
+
+    // Borrow the most recent frame, or nullptr if none was captured yet.
+    // Keep the lease only as long as the planes are being read. Must only be
+    // called from the render thread (single consumer of the mailbox).
+    FrameLease acquireFrame();
+
+    // Number of frames published so far, compare with CameraFrame::generation
+    uint32_t getFrameGeneration() { return mMailbox.generation(); };
+
+    // Block until a frame newer than lastGeneration is published or
+    // wakeUp() is called. Returns false on timeout.
+    bool waitForFrame(uint32_t lastGeneration, int timeoutMs);
+    // Any thread: gets the render thread out of waitForFrame() early
+    void wakeUp();
+
+    // Part of the image to show and its size on screen in pixels, 0 when
+    // unknown. Call before open(): sources able to crop and scale in
+    // hardware then deliver only that, the others deliver the full image.
+    void setViewport(const ViewRect &crop, int width, int height)
+    {
+        mRequestedCrop = mCrop = crop;
+        mViewWidth = width;
+        mViewHeight = height;
+    };
+    // What the renderer still has to crop out of each frame, valid only
+    // after open()
+    ViewRect getCrop() { return mCrop; };
+
+    // Layout and colour encoding of the frames, valid only after open()
+    ColorFormat getColorFormat() { return mColorFormat; };
+
+    // Counters of the capture thread, safe to read from any thread
+    const CaptureStats &getCaptureStats() { return mCaptureStats; };
+
+protected:
+    // Producer side, only ever called from the source's capture thread
+    void publishFrame(CameraFrame *frame, const FrameLease &lease);
+    // Drops pending frames so a restart never shows a stale one
+    void flushFrames();
+
+    // Capture thread -> render thread hand-off, latest frame wins. Frames the
+    // renderer never picked up are released when their slot is overwritten.
+    TripleBuffer<FrameLease> mMailbox;
+
+    CaptureStats mCaptureStats;
+
+    // What the source delivers, sources negotiating a format overwrite it
+    ColorFormat mColorFormat = {CHROMA_NV21, MATRIX_BT601, RANGE_LIMITED};
+    bool mInterlaced = false;
+    // One field per frame
+    bool mFieldRate = false;
+
+    ViewRect mRequestedCrop;
+    int mViewWidth = 0;
+    int mViewHeight = 0;
+    // Sources cropping in hardware overwrite it with what is left
+    ViewRect mCrop;
+
+private:
+    // Only used to wake up the render thread, never held while publishing
+    std::mutex mFrameMutex;
+    std::condition_variable mFrameCondition;
+    bool mWakeRequested = false;
+};
+
+#endif //FRAME_SOURCE_H_
@@ -0,0 +1,197 @@
+#define LOG_TAG "RearCameraGL"
+
+#include <math.h>
+#include <algorithm>
+
+#include "guidelines.h"
+
+// Vertices per corner path, both edges of every sample
+static constexpr int GUIDELINE_PATH_VERTICES = (GUIDELINE_SEGMENTS + 1) * 2;
+static constexpr int GUIDELINE_VERTEX_FLOATS = 3;
+
+static float toRadians(float degrees)
+{
+    return degrees * static_cast<float>(M_PI) / 180.0f;
+}
+
+GuidelineRenderer::~GuidelineRenderer()
+{
+    destroy();
+}
+
+bool GuidelineRenderer::init(const VehicleGeometry &vehicle, const CameraPose &camera, const ViewRect &crop,
+                             const ViewRect &view, int surfaceWidth, int surfaceHeight)
+{
+    destroy();
+    mVehicle = vehicle;
+    mCamera = camera;
+    mCrop = crop;
+    mView = view;
+    mSurfaceWidth = surfaceWidth;
+    mSurfaceHeight = surfaceHeight;
+
+    // Both paths in one strip, joined by two degenerate vertices
+    mVertexCount = GUIDELINE_PATH_VERTICES * 2 + 2;
+    mEntryCount = lroundf(2.0f * GUIDELINE_MAX_ANGLE / GUIDELINE_ANGLE_STEP) + 1;
+    mTable.resize(static_cast<size_t>(mEntryCount) * mVertexCount * GUIDELINE_VERTEX_FLOATS);
+    for (int entry = 0; entry < mEntryCount; entry++)
+    {
+        buildEntry(entry * GUIDELINE_ANGLE_STEP - GUIDELINE_MAX_ANGLE,
+                   &mTable[static_cast<size_t>(entry) * mVertexCount * GUIDELINE_VERTEX_FLOATS]);
+    }
+    mCurrent = mEntryCount / 2;
+    mUploaded = -1;
+
+    mProgram = buildShaderProgram(gGuidelineVertexShader, gGuidelineFragmentShader, "guideline");
+    if (!mProgram)
+    {
+        ALOGD("Guideline renderer unavailable");
+        destroy();
+        return false;
+    }
+    glUseProgram(mProgram);
+    glUniform2f(glGetUniformLocation(mProgram, "bands"), GUIDELINE_NEAR_M, GUIDELINE_MID_M);
+    mProjectionHandle = glGetUniformLocation(mProgram, "projection");
+
+    glGenVertexArrays(1, &mVAO);
+    glBindVertexArray(mVAO);
+    glGenBuffers(1, &mBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, mBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * mVertexCount * GUIDELINE_VERTEX_FLOATS, nullptr, GL_DYNAMIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, GUIDELINE_VERTEX_FLOATS, GL_FLOAT, GL_FALSE, GUIDELINE_VERTEX_FLOATS * sizeof(float), 0);
+    glBindVertexArray(GL_ZERO);
+    glBindBuffer(GL_ARRAY_BUFFER, GL_ZERO);
+
+    ALOGD("Guidelines precomputed for %d angles", mEntryCount);
+    return true;
+}
+
+void GuidelineRenderer::destroy()
+{
+    if (mBuffer != 0)
+    {
+        glDeleteBuffers(1, &mBuffer);
+        mBuffer = 0;
+    }
+    if (mVAO != 0)
+    {
+        glDeleteVertexArrays(1, &mVAO);
+        mVAO = 0;
+    }
+    if (mProgram != 0)
+    {
+        glDeleteProgram(mProgram);
+        mProgram = 0;
+    }
+    mTable.clear();
+    mTable.shrink_to_fit();
+    mEntryCount = 0;
+    mUploaded = -1;
+}
+
+void GuidelineRenderer::setSteeringAngle(float degrees)
+{
+    if (mEntryCount == 0 || !std::isfinite(degrees))
+        return;
+
+    const float wheel = std::min(std::max(degrees / mVehicle.steeringRatio, -GUIDELINE_MAX_ANGLE), GUIDELINE_MAX_ANGLE);
+    mCurrent = lroundf((wheel + GUIDELINE_MAX_ANGLE) / GUIDELINE_ANGLE_STEP);
+}
+
+void GuidelineRenderer::draw(const float *projection)
+{
+    if (mProgram == 0)
+        return;
+
+    glBindBuffer(GL_ARRAY_BUFFER, mBuffer);
+    if (mCurrent != mUploaded)
+    {
+        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(float) * mVertexCount * GUIDELINE_VERTEX_FLOATS,
+                        &mTable[static_cast<size_t>(mCurrent) * mVertexCount * GUIDELINE_VERTEX_FLOATS]);
+        mUploaded = mCurrent;
+    }
+
+    glUseProgram(mProgram);
+    glUniformMatrix4fv(mProjectionHandle, 1, GL_FALSE, projection);
+
+    // Paths leaving the camera view are cut at its edges
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(lroundf(mView.x * mSurfaceWidth), lroundf((1.0f - mView.y - mView.h) * mSurfaceHeight),
+              lroundf(mView.w * mSurfaceWidth), lroundf(mView.h * mSurfaceHeight));
+    glBindVertexArray(mVAO);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, mVertexCount);
+    glBindVertexArray(GL_ZERO);
+    glDisable(GL_SCISSOR_TEST);
+    glBindBuffer(GL_ARRAY_BUFFER, GL_ZERO);
+}
+
+// Ground coordinates are metres, x to the right of the car and y behind the
+// bumper. The rear axle is rearOverhang ahead of the bumper and the car
+// turns about a point on its line, radius wheelbase / tan(angle) out.
+void GuidelineRenderer::buildEntry(float degrees, float *out) const
+{
+    const bool straight = fabsf(degrees) < GUIDELINE_ANGLE_STEP / 2.0f;
+    const float radius = straight ? 0.0f : mVehicle.wheelbase / tanf(toRadians(degrees));
+    const float centerX = radius;
+    const float centerY = -mVehicle.rearOverhang;
+
+    // Left corner path, two degenerate vertices, right corner path
+    float *paths[2] = {out, out + (GUIDELINE_PATH_VERTICES + 2) * GUIDELINE_VERTEX_FLOATS};
+    for (int side = 0; side < 2; side++)
+    {
+        const float startX = (side == 0 ? -0.5f : 0.5f) * mVehicle.track;
+        float *vertex = paths[side];
+        for (int i = 0; i <= GUIDELINE_SEGMENTS; i++)
+        {
+            // Distance travelled by the rear axle centre
+            const float distance = GUIDELINE_LENGTH_M * i / GUIDELINE_SEGMENTS;
+            float x = startX;
+            float y = distance;
+            // Unit normal of the path, across the line
+            float normalX = 1.0f;
+            float normalY = 0.0f;
+            if (!straight)
+            {
+                const float angle = -distance / radius;
+                const float dx = startX - centerX;
+                const float dy = -centerY;
+                x = centerX + dx * cosf(angle) - dy * sinf(angle);
+                y = centerY + dx * sinf(angle) + dy * cosf(angle);
+                const float length = hypotf(x - centerX, y - centerY);
+                normalX = (x - centerX) / length;
+                normalY = (y - centerY) / length;
+            }
+
+            for (int edge = 0; edge < 2; edge++)
+            {
+                const float offset = (edge == 0 ? -0.5f : 0.5f) * GUIDELINE_WIDTH_M;
+                project(x + normalX * offset, y + normalY * offset, vertex);
+                vertex[2] = distance;
+                vertex += GUIDELINE_VERTEX_FLOATS;
+            }
+        }
+    }
+
+    float *join = paths[1] - 2 * GUIDELINE_VERTEX_FLOATS;
+    std::copy(join - GUIDELINE_VERTEX_FLOATS, join, join);
+    std::copy(paths[1], paths[1] + GUIDELINE_VERTEX_FLOATS, join + GUIDELINE_VERTEX_FLOATS);
+}
+
+// Pinhole camera at height above the ground point 0, 0, looking back and
+// pitched down. Projects to the full camera image, then through the crop
+// into the view rectangle, in surface pixels from the bottom left.
+void GuidelineRenderer::project(float x, float y, float *out) const
+{
+    const float pitch = toRadians(mCamera.pitch);
+    const float depth = std::max(y * cosf(pitch) + mCamera.height * sinf(pitch), 0.01f);
+    const float up = y * sinf(pitch) - mCamera.height * cosf(pitch);
+
+    const float u = 0.5f + x / depth / (2.0f * tanf(toRadians(mCamera.hfov) / 2.0f));
+    const float v = 0.5f - up / depth / (2.0f * tanf(toRadians(mCamera.vfov) / 2.0f));
+
+    const float viewX = mView.x + (u - mCrop.x) / mCrop.w * mView.w;
+    const float viewY = mView.y + (v - mCrop.y) / mCrop.h * mView.h;
+    out[0] = viewX * mSurfaceWidth;
+    out[1] = (1.0f - viewY) * mSurfaceHeight;
+}
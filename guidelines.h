@@ -0,0 +1,89 @@
+#ifndef GUIDELINES_H_
+#define GUIDELINES_H_
+
+#include <vector>
+
+#include "shader.h"
+#include "framesource.h"
+
+// Road wheel angles covered by the lookup table, degrees either way
+static constexpr float GUIDELINE_MAX_ANGLE = 40.0f;
+// Table resolution, the drawn angle snaps to it
+static constexpr float GUIDELINE_ANGLE_STEP = 0.5f;
+// Path length drawn behind the bumper and its sampling, metres
+static constexpr float GUIDELINE_LENGTH_M = 3.0f;
+static constexpr int GUIDELINE_SEGMENTS = 32;
+static constexpr float GUIDELINE_WIDTH_M = 0.06f;
+// Colour bands, red up to the first distance, yellow to the second, then green
+static constexpr float GUIDELINE_NEAR_M = 1.0f;
+static constexpr float GUIDELINE_MID_M = 2.0f;
+
+// Metres, except steeringRatio: steering wheel to road wheel angle, 1 when
+// the VHAL reports the road wheel angle
+struct VehicleGeometry
+{
+    float wheelbase = 2.7f;
+    float track = 1.6f;
+    float rearOverhang = 0.9f;
+    float steeringRatio = 1.0f;
+};
+
+// Rear camera above the middle of the bumper: height in metres, downward
+// pitch and fields of view in degrees of the full camera image
+struct CameraPose
+{
+    float height = 1.0f;
+    float pitch = 35.0f;
+    float hfov = 100.0f;
+    float vfov = 75.0f;
+};
+
+// Predicted paths of the rear corners while reversing, from a bicycle model
+// turning about a point on the rear axle line. The strips for every
+// quantised angle are projected once by init(), so a steering change costs
+// a table lookup and the frame after it a single glBufferSubData(). The
+// image is assumed mirrored, as rear cameras deliver it: steering right
+// bends the paths to the right of the screen.
+class GuidelineRenderer
+{
+public:
+    ~GuidelineRenderer();
+
+    // Needs a current GL context. crop is the part of the full camera image
+    // shown, view where it is on the surface, both as fractions from the top
+    // left corner.
+    bool init(const VehicleGeometry &vehicle, const CameraPose &camera, const ViewRect &crop, const ViewRect &view,
+              int surfaceWidth, int surfaceHeight);
+    void destroy();
+
+    // Angle reported by the VHAL in degrees, left negative
+    void setSteeringAngle(float degrees);
+    // Leaves the guideline program bound
+    void draw(const float *projection);
+
+private:
+    void buildEntry(float degrees, float *out) const;
+    void project(float x, float y, float *out) const;
+
+    VehicleGeometry mVehicle;
+    CameraPose mCamera;
+    ViewRect mCrop;
+    ViewRect mView;
+    int mSurfaceWidth = 0;
+    int mSurfaceHeight = 0;
+
+    // Every entry is one strip of x, y, distance vertices
+    std::vector<float> mTable;
+    int mVertexCount = 0;
+    int mEntryCount = 0;
+    int mCurrent = 0;
+    // Entry in the vertex buffer, -1 for none
+    int mUploaded = -1;
+
+    GLuint mProgram = 0;
+    GLint mProjectionHandle = -1;
+    GLuint mVAO = 0;
+    GLuint mBuffer = 0;
+};
+
+#endif //GUIDELINES_H_
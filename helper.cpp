@@ -14,7 +14,7 @@ std::string Helper::basename(const std::string &pathname)
             pathname.end()};
 }
 
-std::vector<std::string> Helper::listDirectory(const std::string &path, const std::string &)
+std::vector<std::string> Helper::listDirectory(const std::string &path, const std::string &extension)
 {
     std::vector<std::string> vec;
     DIR *dir = opendir(path.c_str());
@@ -23,10 +23,16 @@ std::vector<std::string> Helper::listDirectory(const std::string &path, const st
         struct dirent *entry;
         while ((entry = readdir(dir)) != nullptr)
         {
+            const size_t length = strlen(entry->d_name);
             if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
             {
                 continue;
             }
+            else if (length < extension.size() ||
+                     extension.compare(0, std::string::npos, entry->d_name + length - extension.size()) != 0)
+            {
+                continue;
+            }
             else
             {
                 std::string fullpath(path);
@@ -34,6 +40,7 @@ std::vector<std::string> Helper::listDirectory(const std::string &path, const st
                 vec.push_back(fullpath);
             }
         }
+        closedir(dir);
     }
     else
     {
@@ -45,4 +52,12 @@ std::vector<std::string> Helper::listDirectory(const std::string &path, const st
 
 Helper::~Helper()
 {
-}
\ No newline at end of file
+}
+
+bool Helper::isPrivateDirectory(const std::string &path)
+{
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+        return false;
+    return st.st_uid == geteuid() && (st.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
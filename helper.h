@@ -8,6 +8,7 @@
 #include <vector>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <dirent.h>
 #include <list>
 #include <inttypes.h>
@@ -23,7 +24,12 @@ public:
 	~Helper();
 
 	static std::string basename(const std::string &);
+	// Full paths of the entries whose name ends in the extension, every
+	// entry for an empty one
 	static std::vector<std::string> listDirectory(const std::string &, const std::string &);
+	// True for a directory owned by our user that nobody else can write to,
+	// where loading files back as they are is safe
+	static bool isPrivateDirectory(const std::string &);
 };
 
 #endif // !HELPER_H_
@@ -0,0 +1,86 @@
+#define LOG_TAG "RearCameraLatency"
+
+#include <stdio.h>
+#include <cutils/log.h>
+
+#include "latencystats.h"
+
+static const char *gStageNames[LatencyBenchmark::STAGE_COUNT] = {
+    "capture", "mailbox", "upload", "swap", "total"};
+
+void LatencyHistogram::record(int64_t ns)
+{
+    if (ns < 0)
+        ns = 0;
+    int64_t bucket = ns / BUCKET_NS;
+    mBuckets[bucket < BUCKETS ? bucket : BUCKETS]++;
+    mCount++;
+    if (ns > mMax)
+        mMax = ns;
+}
+
+void LatencyHistogram::reset()
+{
+    for (uint32_t &bucket : mBuckets)
+        bucket = 0;
+    mCount = 0;
+    mMax = 0;
+}
+
+int64_t LatencyHistogram::percentile(int p) const
+{
+    if (mCount == 0)
+        return 0;
+
+    uint64_t target = (static_cast<uint64_t>(mCount) * p + 99) / 100;
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++)
+    {
+        seen += mBuckets[i];
+        if (seen >= target)
+            return (i + 1) * BUCKET_NS;
+    }
+    return mMax;
+}
+
+void LatencyBenchmark::recordFrame(int64_t captureTime, int64_t dequeueTime, int64_t acquireTime,
+                                   int64_t drawTime, int64_t swapTime)
+{
+    // Not every driver stamps buffers with CLOCK_MONOTONIC
+    if (captureTime > 0)
+    {
+        mStages[CAPTURE].record(dequeueTime - captureTime);
+        mStages[TOTAL].record(swapTime - captureTime);
+    }
+    mStages[MAILBOX].record(acquireTime - dequeueTime);
+    mStages[UPLOAD].record(drawTime - acquireTime);
+    mStages[SWAP].record(swapTime - drawTime);
+
+    if (++mFrames >= mReportInterval)
+    {
+        report();
+        for (LatencyHistogram &stage : mStages)
+            stage.reset();
+        mFrames = 0;
+    }
+}
+
+std::string LatencyBenchmark::dump() const
+{
+    std::string out;
+    char line[128];
+    for (int i = 0; i < STAGE_COUNT; i++)
+    {
+        const LatencyHistogram &stage = mStages[i];
+        snprintf(line, sizeof(line), "%-8s n=%-6u p50=%.2fms p95=%.2fms p99=%.2fms max=%.2fms\n",
+                 gStageNames[i], stage.count(), stage.percentile(50) / 1e6, stage.percentile(95) / 1e6,
+                 stage.percentile(99) / 1e6, stage.max() / 1e6);
+        out += line;
+    }
+    return out;
+}
+
+void LatencyBenchmark::report()
+{
+    ALOGI("Latency over %u frames:\n%s", mFrames, dump().c_str());
+}
@@ -0,0 +1,60 @@
+#ifndef LATENCY_STATS_H_
+#define LATENCY_STATS_H_
+
+#include <stdint.h>
+#include <string>
+
+// Fixed-bucket latency histogram, cheap enough to feed once per frame.
+class LatencyHistogram
+{
+public:
+    static constexpr int64_t BUCKET_NS = 250000; // 0.25 ms
+    static constexpr int BUCKETS = 1000;         // up to 250 ms, then overflow
+
+    void record(int64_t ns);
+    void reset();
+
+    // Upper bound of the bucket holding the given percentile, in ns
+    int64_t percentile(int p) const;
+    int64_t max() const { return mMax; };
+    uint32_t count() const { return mCount; };
+
+private:
+    uint32_t mBuckets[BUCKETS + 1] = {};
+    uint32_t mCount = 0;
+    int64_t mMax = 0;
+};
+
+// Per-stage glass-to-glass latency, from the sensor timestamp of a frame to
+// eglSwapBuffers() returning. Only touched by the render thread.
+class LatencyBenchmark
+{
+public:
+    enum Stages
+    {
+        CAPTURE = 0, // sensor timestamp -> dequeued by the capture thread
+        MAILBOX,     // dequeued -> picked up by the render thread
+        UPLOAD,      // picked up -> textures uploaded and quad drawn
+        SWAP,        // eglSwapBuffers()
+        TOTAL,       // sensor timestamp -> swap returned
+        STAGE_COUNT,
+    };
+
+    // Report every reportInterval frames, 0 disables the benchmark
+    void setReportInterval(uint32_t reportInterval) { mReportInterval = reportInterval; };
+    bool isEnabled() const { return mReportInterval > 0; };
+
+    // Timestamps in CLOCK_MONOTONIC ns, captureTime is 0 when unknown
+    void recordFrame(int64_t captureTime, int64_t dequeueTime, int64_t acquireTime,
+                     int64_t drawTime, int64_t swapTime);
+
+    void report();
+    std::string dump() const;
+
+private:
+    LatencyHistogram mStages[STAGE_COUNT];
+    uint32_t mReportInterval = 0;
+    uint32_t mFrames = 0;
+};
+
+#endif //LATENCY_STATS_H_
@@ -0,0 +1,357 @@
+#define LOG_TAG "RearCameraGL"
+
+#include <string.h>
+#include <algorithm>
+
+#include "overlay.h"
+#include "atlaspacker.h"
+
+OverlayRenderer::~OverlayRenderer()
+{
+    destroy();
+}
+
+void OverlayRenderer::addImage(const std::string &name, int width, int height, std::vector<uint8_t> &&pixels)
+{
+    if (width <= 0 || height <= 0 || pixels.size() < static_cast<size_t>(width) * height * 4)
+    {
+        ALOGD("Ignoring overlay %s, bad size %dx%d", name.c_str(), width, height);
+        return;
+    }
+
+    Image image;
+    image.name = name;
+    image.width = width;
+    image.height = height;
+    image.pixels = std::move(pixels);
+    mImages.push_back(std::move(image));
+}
+
+void OverlayRenderer::addEntry(const std::string &name, int page, int x, int y, int width, int height,
+                               int atlasWidth, int atlasHeight)
+{
+    Entry entry;
+    entry.page = page;
+    entry.uv[0] = static_cast<float>(x) / atlasWidth;
+    entry.uv[1] = static_cast<float>(y) / atlasHeight;
+    entry.uv[2] = static_cast<float>(x + width) / atlasWidth;
+    entry.uv[3] = static_cast<float>(y + height) / atlasHeight;
+    mEntries[name] = entry;
+}
+
+bool OverlayRenderer::addPack(const OverlayPack &pack)
+{
+    const OverlayPackHeader &header = pack.getHeader();
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    if (mPageCount == OVERLAY_MAX_PAGES || header.width > static_cast<uint32_t>(maxSize) ||
+        header.height > static_cast<uint32_t>(maxSize))
+    {
+        ALOGD("Overlay pack of %ux%u not loadable", header.width, header.height);
+        return false;
+    }
+
+    // Errors left over from earlier calls would be blamed on the pack
+    while (glGetError() != GL_NO_ERROR)
+    {
+    }
+
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (uint32_t level = 0; level < header.levelCount; level++)
+    {
+        const GLsizei width = std::max(header.width >> level, 1u);
+        const GLsizei height = std::max(header.height >> level, 1u);
+        if (header.format == OVERLAY_PACK_ETC2_RGBA8)
+        {
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, GL_COMPRESSED_RGBA8_ETC2_EAC, width, height, GL_ZERO,
+                                   header.levels[level].size, pack.getLevel(level));
+        }
+        else
+        {
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA, width, height, GL_ZERO, GL_RGBA, GL_UNSIGNED_BYTE,
+                         pack.getLevel(level));
+        }
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header.levelCount - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, header.levelCount > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, GL_ZERO);
+
+    if (glGetError() != GL_NO_ERROR)
+    {
+        ALOGD("Overlay pack upload failed");
+        glDeleteTextures(1, &texture);
+        return false;
+    }
+
+    const int page = mPageCount++;
+    mTextures[page] = texture;
+    for (uint32_t index = 0; index < header.imageCount; index++)
+    {
+        const OverlayPackImage &image = pack.getImage(index);
+        addEntry(image.name, page, image.x, image.y, image.width, image.height, header.width, header.height);
+    }
+
+    ALOGD("Loaded %u overlay images from a %ux%u pack, %u levels", header.imageCount, header.width, header.height,
+          header.levelCount);
+    return initProgram();
+}
+
+bool OverlayRenderer::buildAtlas()
+{
+    if (mImages.empty())
+        return mPageCount > 0;
+
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+
+    std::vector<AtlasRect> rects(mImages.size());
+    for (size_t i = 0; i < mImages.size(); i++)
+    {
+        rects[i].width = mImages[i].width;
+        rects[i].height = mImages[i].height;
+    }
+
+    int atlasWidth = 0;
+    int atlasHeight = 0;
+    if (mPageCount == OVERLAY_MAX_PAGES || !packAtlas(rects, OVERLAY_ATLAS_PADDING, maxSize, atlasWidth, atlasHeight))
+    {
+        ALOGD("Overlay images do not fit in a %dx%d atlas", maxSize, maxSize);
+        mImages.clear();
+        return mPageCount > 0;
+    }
+
+    // One upload of the whole atlas, the padding stays transparent
+    const int page = mPageCount;
+    std::vector<uint8_t> pixels(static_cast<size_t>(atlasWidth) * atlasHeight * 4, 0);
+    for (size_t i = 0; i < mImages.size(); i++)
+    {
+        const Image &image = mImages[i];
+        const AtlasRect &rect = rects[i];
+        for (int row = 0; row < image.height; row++)
+        {
+            memcpy(&pixels[(static_cast<size_t>(rect.y + row) * atlasWidth + rect.x) * 4],
+                   &image.pixels[static_cast<size_t>(row) * image.width * 4], image.width * 4);
+        }
+    }
+
+    // Errors left over from earlier calls would be blamed on the atlas
+    while (glGetError() != GL_NO_ERROR)
+    {
+    }
+
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, GL_ZERO, GL_RGBA, atlasWidth, atlasHeight, GL_ZERO, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, GL_ZERO);
+
+    // Out of memory for a large atlas shows up here, not as a null texture
+    const GLenum error = glGetError();
+    if (error != GL_NO_ERROR)
+    {
+        ALOGD("Overlay atlas upload of %dx%d failed (0x%x)", atlasWidth, atlasHeight, error);
+        glDeleteTextures(1, &texture);
+        mImages.clear();
+        mImages.shrink_to_fit();
+        return false;
+    }
+
+    mTextures[page] = texture;
+    mPageCount++;
+    for (size_t i = 0; i < mImages.size(); i++)
+    {
+        addEntry(mImages[i].name, page, rects[i].x, rects[i].y, mImages[i].width, mImages[i].height, atlasWidth,
+                 atlasHeight);
+    }
+
+    ALOGD("Packed %zu overlay images into a %dx%d atlas", mImages.size(), atlasWidth, atlasHeight);
+    mImages.clear();
+    mImages.shrink_to_fit();
+
+    return initProgram();
+}
+
+bool OverlayRenderer::initProgram()
+{
+    if (mProgram != 0)
+        return true;
+
+    mProgram = buildShaderProgram(gOverlayVertexShader, gOverlayFragmentShader, "overlay");
+    if (!mProgram || !initInstanceBuffer())
+    {
+        ALOGD("Overlay renderer unavailable");
+        destroy();
+        return false;
+    }
+    glUseProgram(mProgram);
+    glUniform1i(glGetUniformLocation(mProgram, "atlas"), GL_ZERO);
+    mProjectionHandle = glGetUniformLocation(mProgram, "projection");
+    return true;
+}
+
+bool OverlayRenderer::initInstanceBuffer()
+{
+    const GLsizeiptr size = sizeof(Sprite) * OVERLAY_MAX_SPRITES * OVERLAY_RING_SIZE;
+    const char *extensions = reinterpret_cast<const char *>(glGetString(GL_EXTENSIONS));
+    const bool persistent = extensions != nullptr && strstr(extensions, "GL_EXT_buffer_storage") != nullptr;
+
+    glGenVertexArrays(1, &mVAO);
+    glBindVertexArray(mVAO);
+    glGenBuffers(1, &mBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, mBuffer);
+    if (persistent)
+    {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT_EXT | GL_MAP_COHERENT_BIT_EXT;
+        glBufferStorageEXT(GL_ARRAY_BUFFER, size, nullptr, flags);
+        mMapped = static_cast<unsigned char *>(glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags));
+    }
+    else
+    {
+        glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    }
+
+    // Per instance attributes, pointed at the current segment in flush()
+    for (GLuint attribute = 0; attribute < 3; attribute++)
+    {
+        glEnableVertexAttribArray(attribute);
+        glVertexAttribDivisor(attribute, 1);
+    }
+    glBindVertexArray(GL_ZERO);
+    glBindBuffer(GL_ARRAY_BUFFER, GL_ZERO);
+
+    return glGetError() == GL_NO_ERROR && (!persistent || mMapped != nullptr);
+}
+
+void OverlayRenderer::destroy()
+{
+    for (GLsync &fence : mFences)
+    {
+        if (fence != nullptr)
+        {
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+    }
+    if (mBuffer != 0)
+    {
+        if (mMapped != nullptr)
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, mBuffer);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+            glBindBuffer(GL_ARRAY_BUFFER, GL_ZERO);
+            mMapped = nullptr;
+        }
+        glDeleteBuffers(1, &mBuffer);
+        mBuffer = 0;
+    }
+    if (mVAO != 0)
+    {
+        glDeleteVertexArrays(1, &mVAO);
+        mVAO = 0;
+    }
+    if (mPageCount > 0)
+    {
+        glDeleteTextures(mPageCount, mTextures);
+        mPageCount = 0;
+    }
+    // Ours alone, unlike the cached camera programs
+    if (mProgram != 0)
+    {
+        glDeleteProgram(mProgram);
+        mProgram = 0;
+    }
+    mEntries.clear();
+    for (std::vector<Sprite> &sprites : mSprites)
+        sprites.clear();
+    mSpriteCount = 0;
+    mNext = 0;
+}
+
+bool OverlayRenderer::draw(const std::string &name, float x, float y, float width, float height, const float tint[4])
+{
+    std::map<std::string, Entry>::const_iterator entry = mEntries.find(name);
+    if (entry == mEntries.end() || mSpriteCount >= OVERLAY_MAX_SPRITES)
+        return false;
+
+    Sprite sprite;
+    sprite.rect[0] = x;
+    sprite.rect[1] = y;
+    sprite.rect[2] = width;
+    sprite.rect[3] = height;
+    memcpy(sprite.uv, entry->second.uv, sizeof(sprite.uv));
+    memcpy(sprite.tint, tint, sizeof(sprite.tint));
+    mSprites[entry->second.page].push_back(sprite);
+    mSpriteCount++;
+    return true;
+}
+
+void OverlayRenderer::flush(const float *projection)
+{
+    if (mSpriteCount == 0 || mProgram == 0)
+    {
+        for (std::vector<Sprite> &sprites : mSprites)
+            sprites.clear();
+        mSpriteCount = 0;
+        return;
+    }
+
+    // Normally long signaled: the segment was last drawn OVERLAY_RING_SIZE frames ago
+    GLsync &fence = mFences[mNext];
+    if (fence != nullptr)
+    {
+        if (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, OVERLAY_FENCE_TIMEOUT_NS) == GL_TIMEOUT_EXPIRED)
+        {
+            ALOGD("Overlay buffer still busy after %llu ns", static_cast<unsigned long long>(OVERLAY_FENCE_TIMEOUT_NS));
+        }
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, mBuffer);
+    glUseProgram(mProgram);
+    glUniformMatrix4fv(mProjectionHandle, 1, GL_FALSE, projection);
+    glActiveTexture(GL_TEXTURE0);
+    glBindVertexArray(mVAO);
+
+    // Pages back to back in the segment, one draw each
+    size_t offset = sizeof(Sprite) * OVERLAY_MAX_SPRITES * mNext;
+    for (int page = 0; page < mPageCount; page++)
+    {
+        std::vector<Sprite> &sprites = mSprites[page];
+        if (sprites.empty())
+            continue;
+
+        const size_t bytes = sizeof(Sprite) * sprites.size();
+        if (mMapped != nullptr)
+            memcpy(mMapped + offset, sprites.data(), bytes);
+        else
+            glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, sprites.data());
+
+        glBindTexture(GL_TEXTURE_2D, mTextures[page]);
+        for (GLuint attribute = 0; attribute < 3; attribute++)
+        {
+            glVertexAttribPointer(attribute, 4, GL_FLOAT, GL_FALSE, sizeof(Sprite),
+                                  reinterpret_cast<const void *>(offset + attribute * 4 * sizeof(float)));
+        }
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, sprites.size());
+        offset += bytes;
+        sprites.clear();
+    }
+    glBindVertexArray(GL_ZERO);
+    glBindBuffer(GL_ARRAY_BUFFER, GL_ZERO);
+
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    mNext = (mNext + 1) % OVERLAY_RING_SIZE;
+    mSpriteCount = 0;
+}
@@ -0,0 +1,103 @@
+#ifndef OVERLAY_H_
+#define OVERLAY_H_
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "shader.h"
+#include "overlaypack.h"
+
+// Transparent gap around every image, so linear filtering never picks up a
+// neighbour in the atlas
+static constexpr int OVERLAY_ATLAS_PADDING = 1;
+// Sprites drawn per frame at most, the rest are dropped
+static constexpr int OVERLAY_MAX_SPRITES = 256;
+// Frames in flight on the instance buffer
+static constexpr int OVERLAY_RING_SIZE = 3;
+// Upper bound on waiting for the GPU to drain a ring segment
+static constexpr GLuint64 OVERLAY_FENCE_TIMEOUT_NS = 20000000;
+// Atlas textures: the prebuilt pack and the one packed from loose images
+static constexpr int OVERLAY_MAX_PAGES = 2;
+
+// Draws every overlay of a frame (guidelines, warning icons, logos) with one
+// texture bind and one instanced draw call per atlas page. The prebuilt
+// asset pack is uploaded as one page by addPack(), loose images are handed
+// over while loading and packed into another by buildAtlas(). Sprites are
+// then queued with draw() and submitted together by flush(). Sprite instances go through a
+// ring of fenced segments in one buffer, persistently mapped when
+// GL_EXT_buffer_storage is there, written with glBufferSubData otherwise.
+class OverlayRenderer
+{
+public:
+    ~OverlayRenderer();
+
+    // Needs a current GL context. Uploads the pack levels straight from the
+    // mapping, which may be closed afterwards.
+    bool addPack(const OverlayPack &pack);
+
+    // Any time before buildAtlas(), RGBA8 pixels with packed rows, top first
+    void addImage(const std::string &name, int width, int height, std::vector<uint8_t> &&pixels);
+
+    // Needs a current GL context. Packs and uploads everything added so far
+    // and drops the CPU copies. True when any overlay can be drawn, false
+    // as well when the atlas upload failed.
+    bool buildAtlas();
+    void destroy();
+
+    bool hasImage(const std::string &name) { return mEntries.count(name) != 0; };
+
+    // Queues image name with its bottom left corner at x, y in surface
+    // pixels, stretched to width x height and multiplied by tint
+    bool draw(const std::string &name, float x, float y, float width, float height, const float tint[4]);
+    // Submits whatever was queued since the last flush. projection maps
+    // surface pixels to clip space. Leaves the overlay program bound.
+    // Sprites on the pack page are drawn below the loose ones.
+    void flush(const float *projection);
+
+private:
+    struct Image
+    {
+        std::string name;
+        int width;
+        int height;
+        std::vector<uint8_t> pixels;
+    };
+
+    // Atlas page and region of an image: u0, v0, u1, v1
+    struct Entry
+    {
+        int page;
+        float uv[4];
+    };
+
+    // Matches the instance attributes of gOverlayVertexShader
+    struct Sprite
+    {
+        float rect[4];
+        float uv[4];
+        float tint[4];
+    };
+
+    bool initProgram();
+    bool initInstanceBuffer();
+    void addEntry(const std::string &name, int page, int x, int y, int width, int height, int atlasWidth, int atlasHeight);
+
+    std::vector<Image> mImages;
+    std::map<std::string, Entry> mEntries;
+    std::vector<Sprite> mSprites[OVERLAY_MAX_PAGES];
+    size_t mSpriteCount = 0;
+
+    GLuint mTextures[OVERLAY_MAX_PAGES] = {};
+    int mPageCount = 0;
+    GLuint mProgram = 0;
+    GLint mProjectionHandle = -1;
+    GLuint mVAO = 0;
+    GLuint mBuffer = 0;
+    unsigned char *mMapped = nullptr;
+    GLsync mFences[OVERLAY_RING_SIZE] = {};
+    int mNext = 0;
+};
+
+#endif //OVERLAY_H_
@@ -0,0 +1,106 @@
+#define LOG_TAG "RearCameraGL"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <utils/Log.h>
+#include <algorithm>
+
+#include "overlaypack.h"
+
+OverlayPack::~OverlayPack()
+{
+    close();
+}
+
+bool OverlayPack::open(const std::string &fileName)
+{
+    close();
+
+    int fd = ::open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(OverlayPackHeader))
+    {
+        ALOGD("Overlay pack %s is truncated", fileName.c_str());
+        ::close(fd);
+        return false;
+    }
+
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+    {
+        ALOGD("Failed to map overlay pack %s: %s", fileName.c_str(), strerror(errno));
+        return false;
+    }
+    // Read ahead now, the upload touches every page anyway
+    madvise(data, st.st_size, MADV_WILLNEED);
+
+    mData = static_cast<const uint8_t *>(data);
+    mSize = st.st_size;
+    if (!validate())
+    {
+        ALOGD("Overlay pack %s is invalid", fileName.c_str());
+        close();
+        return false;
+    }
+    return true;
+}
+
+void OverlayPack::close()
+{
+    if (mData != nullptr)
+    {
+        munmap(const_cast<uint8_t *>(mData), mSize);
+        mData = nullptr;
+        mSize = 0;
+    }
+}
+
+const OverlayPackImage &OverlayPack::getImage(uint32_t index) const
+{
+    return reinterpret_cast<const OverlayPackImage *>(mData + sizeof(OverlayPackHeader))[index];
+}
+
+const void *OverlayPack::getLevel(uint32_t level) const
+{
+    return mData + getHeader().levels[level].offset;
+}
+
+bool OverlayPack::validate() const
+{
+    const OverlayPackHeader &header = getHeader();
+    if (memcmp(header.magic, OVERLAY_PACK_MAGIC, sizeof(header.magic)) != 0 || header.version != OVERLAY_PACK_VERSION)
+        return false;
+    if (header.format > OVERLAY_PACK_ETC2_RGBA8 || header.width == 0 || header.height == 0 ||
+        header.levelCount == 0 || header.levelCount > OVERLAY_PACK_MAX_LEVELS)
+        return false;
+    if (header.imageCount > (mSize - sizeof(OverlayPackHeader)) / sizeof(OverlayPackImage))
+        return false;
+
+    for (uint32_t level = 0; level < header.levelCount; level++)
+    {
+        const OverlayPackLevel &data = header.levels[level];
+        const uint32_t width = std::max(header.width >> level, 1u);
+        const uint32_t height = std::max(header.height >> level, 1u);
+        if (data.size != overlayPackLevelSize(header.format, width, height) || data.offset > mSize ||
+            data.size > mSize - data.offset)
+            return false;
+    }
+
+    for (uint32_t index = 0; index < header.imageCount; index++)
+    {
+        const OverlayPackImage &image = getImage(index);
+        if (memchr(image.name, '\0', sizeof(image.name)) == nullptr || image.width == 0 || image.height == 0 ||
+            image.x > header.width || image.width > header.width - image.x ||
+            image.y > header.height || image.height > header.height - image.y)
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,87 @@
+#ifndef OVERLAY_PACK_H_
+#define OVERLAY_PACK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// Overlay asset pack, written offline by tools/overlaypack.cpp from the
+// overlay PNGs and mapped as is at startup. Layout, little endian:
+//   OverlayPackHeader
+//   OverlayPackImage[imageCount], where each image sits in the atlas
+//   level data, each level at an OVERLAY_PACK_ALIGNMENT boundary
+// Level 0 is the full atlas, every further level half the size of the
+// previous one down to levelCount. RGBA8 levels hold packed rows top first,
+// ETC2 levels the 4x4 blocks as glCompressedTexImage2D() takes them.
+static constexpr char OVERLAY_PACK_MAGIC[4] = {'R', 'C', 'O', 'P'};
+static constexpr uint32_t OVERLAY_PACK_VERSION = 1;
+static constexpr int OVERLAY_PACK_MAX_LEVELS = 4;
+static constexpr int OVERLAY_PACK_NAME_SIZE = 64;
+static constexpr size_t OVERLAY_PACK_ALIGNMENT = 16;
+
+enum OverlayPackFormat
+{
+    OVERLAY_PACK_RGBA8 = 0,
+    // GL_COMPRESSED_RGBA8_ETC2_EAC, core in GLES 3.0
+    OVERLAY_PACK_ETC2_RGBA8,
+};
+
+struct OverlayPackLevel
+{
+    uint32_t offset;
+    uint32_t size;
+};
+
+struct OverlayPackHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t levelCount;
+    uint32_t imageCount;
+    uint32_t reserved;
+    OverlayPackLevel levels[OVERLAY_PACK_MAX_LEVELS];
+};
+
+struct OverlayPackImage
+{
+    // NUL terminated file name of the source PNG, e.g. "park_guide.png"
+    char name[OVERLAY_PACK_NAME_SIZE];
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+};
+
+// Bytes a level of the given size takes in the pack
+static inline size_t overlayPackLevelSize(uint32_t format, uint32_t width, uint32_t height)
+{
+    if (format == OVERLAY_PACK_ETC2_RGBA8)
+        return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * 16;
+    return static_cast<size_t>(width) * height * 4;
+}
+
+// Read only mapping of a pack, validated once by open() so the accessors
+// can trust it. Uploads read straight from the page cache.
+class OverlayPack
+{
+public:
+    ~OverlayPack();
+
+    bool open(const std::string &fileName);
+    void close();
+
+    const OverlayPackHeader &getHeader() const { return *reinterpret_cast<const OverlayPackHeader *>(mData); };
+    const OverlayPackImage &getImage(uint32_t index) const;
+    const void *getLevel(uint32_t level) const;
+
+private:
+    bool validate() const;
+
+    const uint8_t *mData = nullptr;
+    size_t mSize = 0;
+};
+
+#endif //OVERLAY_PACK_H_
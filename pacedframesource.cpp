@@ -0,0 +1,224 @@
+#define LOG_TAG "RearCamera"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <cutils/log.h>
+#include <utils/Timers.h>
+
+#include "pacedframesource.h"
+
+PacedFrameSource::PacedFrameSource(int width, int height, int fps)
+    : mWidth(width), mHeight(height), mFrameIntervalNs(1000000000 / (fps > 0 ? fps : PACED_SOURCE_DEFAULT_FPS)),
+      mFreeMask(0)
+{
+}
+
+PacedFrameSource::~PacedFrameSource()
+{
+    // Subclasses close() in their own destructor, while fillFrame() is still
+    // reachable, this is only a safety net
+    close();
+}
+
+bool PacedFrameSource::open(const char *name)
+{
+    if (!openSource(name))
+    {
+        ALOGD("failed to open frame source %s", name);
+        return false;
+    }
+
+    const int ySize = mWidth * mHeight;
+    const int frameSize = ySize * 3 / 2;
+    mPool.assign(frameSize * PACED_SOURCE_BUFFERS, 0);
+    for (int i = 0; i < PACED_SOURCE_BUFFERS; i++)
+    {
+        mFrames[i].index = i;
+        mFrames[i].y = &mPool[i * frameSize];
+        mFrames[i].uv = &mPool[i * frameSize + ySize];
+        mFrames[i].yStride = mWidth;
+        mFrames[i].uvStride = mWidth;
+    }
+    mFreeMask = (1u << PACED_SOURCE_BUFFERS) - 1;
+
+    mStreaming = false;
+    mExitRequested = false;
+    mWorker = std::thread([this]() { produceFrames(); });
+    return true;
+}
+
+void PacedFrameSource::close()
+{
+    if (mWorker.joinable())
+    {
+        {
+            const std::lock_guard<std::mutex> lock(mControlMutex);
+            mExitRequested = true;
+        }
+        mControlCondition.notify_all();
+        mWorker.join();
+        mMailbox.reset();
+        closeSource();
+    }
+}
+
+bool PacedFrameSource::startStream()
+{
+    if (!isOpen())
+        return false;
+
+    {
+        const std::lock_guard<std::mutex> lock(mControlMutex);
+        mStreaming = true;
+    }
+    mControlCondition.notify_all();
+    return true;
+}
+
+void PacedFrameSource::stopStream()
+{
+    const std::lock_guard<std::mutex> lock(mControlMutex);
+    mStreaming = false;
+}
+
+void PacedFrameSource::releaseFrame(int index)
+{
+    mFreeMask.fetch_or(1u << index);
+}
+
+void PacedFrameSource::produceFrames()
+{
+    uint32_t sequence = 0;
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mControlMutex);
+            if (!mStreaming && !mExitRequested)
+            {
+                flushFrames();
+                mControlCondition.wait(lock, [this]() { return mStreaming || mExitRequested; });
+                clock_gettime(CLOCK_MONOTONIC, &deadline);
+            }
+            if (mExitRequested)
+                break;
+        }
+
+        deadline.tv_nsec += mFrameIntervalNs;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        nsecs_t waitStart = systemTime(SYSTEM_TIME_MONOTONIC);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR)
+        {
+        }
+        mCaptureStats.dequeueWait.record(systemTime(SYSTEM_TIME_MONOTONIC) - waitStart);
+
+        // Like a sensor, the sequence keeps counting when a frame is dropped.
+        // Only this thread clears bits, so a plain fetch_and is enough.
+        uint32_t current = sequence++;
+        uint32_t free = mFreeMask.load();
+        if (free == 0)
+        {
+            mCaptureStats.sequenceGaps.add();
+            continue;
+        }
+        int index = __builtin_ctz(free);
+        mFreeMask.fetch_and(~(1u << index));
+
+        CameraFrame *frame = &mFrames[index];
+        if (!fillFrame(const_cast<unsigned char *>(frame->y), const_cast<unsigned char *>(frame->uv), current))
+        {
+            releaseFrame(index);
+            mCaptureStats.errors.add();
+            continue;
+        }
+        frame->sequence = current;
+        frame->timestamp = deadline.tv_sec * 1000000000LL + deadline.tv_nsec;
+        mCaptureStats.frames.add();
+
+        publishFrame(frame, FrameLease(frame, [this](const CameraFrame *f) { releaseFrame(f->index); }));
+    }
+
+    flushFrames();
+}
+
+bool SyntheticFrameSource::fillFrame(unsigned char *y, unsigned char *uv, uint32_t sequence)
+{
+    // 100% colour bars, BT.601 limited range {Y, U, V}
+    static const unsigned char bars[8][3] = {
+        {235, 128, 128}, {210, 16, 146}, {170, 166, 16}, {145, 54, 34},
+        {106, 202, 222}, {81, 90, 240}, {41, 240, 110}, {16, 128, 128}};
+
+    const int barWidth = (mWidth + 7) / 8;
+    const int scroll = (sequence * 4) % mWidth;
+    const int marker = (sequence * 2) % mHeight;
+
+    for (int row = 0; row < mHeight; row++)
+    {
+        unsigned char *line = y + row * mWidth;
+        if (row == marker)
+        {
+            memset(line, 235, mWidth);
+            continue;
+        }
+        for (int col = 0; col < mWidth; col++)
+        {
+            line[col] = bars[((col + scroll) % mWidth) / barWidth][0];
+        }
+    }
+
+    // NV21: interleaved V then U, one pair per 2x2 block
+    for (int row = 0; row < mHeight / 2; row++)
+    {
+        unsigned char *line = uv + row * mWidth;
+        for (int col = 0; col < mWidth; col += 2)
+        {
+            const unsigned char *bar = bars[((col + scroll) % mWidth) / barWidth];
+            line[col] = bar[2];
+            line[col + 1] = bar[1];
+        }
+    }
+    return true;
+}
+
+bool FileReplaySource::openSource(const char *)
+{
+    mFile = fopen(mPath.c_str(), "rb");
+    if (mFile == nullptr)
+    {
+        ALOGD("failed to open replay file %s (%d = %s)", mPath.c_str(), errno, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void FileReplaySource::closeSource()
+{
+    if (mFile != nullptr)
+    {
+        fclose(mFile);
+        mFile = nullptr;
+    }
+}
+
+bool FileReplaySource::fillFrame(unsigned char *y, unsigned char *uv, uint32_t)
+{
+    const size_t ySize = mWidth * mHeight;
+    const size_t uvSize = ySize / 2;
+
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        if (fread(y, 1, ySize, mFile) == ySize && fread(uv, 1, uvSize, mFile) == uvSize)
+            return true;
+        rewind(mFile);
+    }
+
+    ALOGD("replay file %s holds no complete %dx%d frame", mPath.c_str(), mWidth, mHeight);
+    return false;
+}
@@ -0,0 +1,97 @@
+#ifndef PACED_FRAME_SOURCE_H_
+#define PACED_FRAME_SOURCE_H_
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <vector>
+#include <stdio.h>
+
+#include "framesource.h"
+
+static constexpr int PACED_SOURCE_DEFAULT_FPS = 30;
+// Three mailbox slots plus the one being filled
+static constexpr int PACED_SOURCE_BUFFERS = 4;
+
+// Software frame source producing NV21 frames on its own thread at a fixed
+// rate, with CLOCK_MONOTONIC timestamps taken at each frame deadline like a
+// sensor would. Subclasses only fill the planes.
+class PacedFrameSource : public FrameSource
+{
+public:
+    PacedFrameSource(int width, int height, int fps);
+    virtual ~PacedFrameSource();
+
+    bool open(const char *name) override;
+    void close() override;
+    bool isOpen() override { return mWorker.joinable(); };
+
+    bool startStream() override;
+    void stopStream() override;
+
+    int getWidth() override { return mWidth; };
+    int getHeight() override { return mHeight; };
+    // Frames are generated unpadded
+    int getYStride() override { return mWidth; };
+    int getUVStride() override { return mWidth; };
+
+protected:
+    virtual bool openSource(const char *name) = 0;
+    virtual void closeSource() {}
+    virtual bool fillFrame(unsigned char *y, unsigned char *uv, uint32_t sequence) = 0;
+
+    int mWidth;
+    int mHeight;
+
+private:
+    void produceFrames();
+    void releaseFrame(int index);
+
+    int mFrameIntervalNs;
+
+    std::vector<unsigned char> mPool;
+    CameraFrame mFrames[PACED_SOURCE_BUFFERS];
+    // One bit per buffer not leased out
+    std::atomic<uint32_t> mFreeMask;
+
+    std::thread mWorker;
+    std::mutex mControlMutex;
+    std::condition_variable mControlCondition;
+    bool mStreaming = false;
+    bool mExitRequested = false;
+};
+
+// Moving colour bars, handy to spot tearing, dropped or repeated frames.
+class SyntheticFrameSource : public PacedFrameSource
+{
+public:
+    SyntheticFrameSource(int width, int height, int fps) : PacedFrameSource(width, height, fps) {}
+    ~SyntheticFrameSource() { close(); }
+
+protected:
+    bool openSource(const char *) override { return true; };
+    bool fillFrame(unsigned char *y, unsigned char *uv, uint32_t sequence) override;
+};
+
+// Replays raw NV21 frames (width * height * 3 / 2 bytes each) from a file,
+// looping at the end.
+class FileReplaySource : public PacedFrameSource
+{
+public:
+    FileReplaySource(const std::string &path, int width, int height, int fps)
+        : PacedFrameSource(width, height, fps), mPath(path) {}
+    ~FileReplaySource() { close(); }
+
+protected:
+    bool openSource(const char *name) override;
+    void closeSource() override;
+    bool fillFrame(unsigned char *y, unsigned char *uv, uint32_t sequence) override;
+
+private:
+    std::string mPath;
+    FILE *mFile = nullptr;
+};
+
+#endif //PACED_FRAME_SOURCE_H_
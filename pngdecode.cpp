@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <png.h>
+
+#include "pngdecode.h"
+
+bool decodePng(const std::string &fileName, int &width, int &height, std::vector<uint8_t> &pixels)
+{
+    png_structp png_ptr;
+    png_infop info_ptr;
+    FILE *fp;
+
+    if ((fp = fopen(fileName.c_str(), "rb")) == NULL)
+        return false;
+
+    png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (png_ptr == NULL)
+    {
+        fclose(fp);
+        return false;
+    }
+
+    info_ptr = png_create_info_struct(png_ptr);
+    if (info_ptr == NULL)
+    {
+        fclose(fp);
+        png_destroy_read_struct(&png_ptr, NULL, NULL);
+        return false;
+    }
+
+    // Declared ahead of setjmp() so an error longjmp does not skip them
+    std::vector<png_bytep> row_pointers;
+
+    if (setjmp(png_jmpbuf(png_ptr)))
+    {
+        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        fclose(fp);
+        pixels.clear();
+        return false;
+    }
+
+    png_init_io(png_ptr, fp);
+    png_read_info(png_ptr, info_ptr);
+
+    png_uint_32 pngWidth, pngHeight;
+    int bit_depth, color_type, interlace_type;
+    png_get_IHDR(png_ptr, info_ptr, &pngWidth, &pngHeight, &bit_depth, &color_type, &interlace_type, NULL, NULL);
+
+    // Always 8 bit RGBA, what the overlay atlas holds
+    png_set_expand(png_ptr);
+    png_set_strip_16(png_ptr);
+    png_set_packing(png_ptr);
+    png_set_gray_to_rgb(png_ptr);
+    png_set_add_alpha(png_ptr, 0xff, PNG_FILLER_AFTER);
+    png_set_interlace_handling(png_ptr);
+    png_read_update_info(png_ptr, info_ptr);
+
+    // Decoded straight into place, no intermediate rows
+    pixels.resize(static_cast<size_t>(pngWidth) * pngHeight * 4);
+    row_pointers.resize(pngHeight);
+    for (unsigned int i = 0; i < pngHeight; i++)
+    {
+        row_pointers[i] = &pixels[static_cast<size_t>(pngWidth) * 4 * i];
+    }
+    png_read_image(png_ptr, row_pointers.data());
+    png_read_end(png_ptr, NULL);
+
+    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+    fclose(fp);
+
+    width = pngWidth;
+    height = pngHeight;
+    return true;
+}
@@ -0,0 +1,12 @@
+#ifndef PNG_DECODE_H_
+#define PNG_DECODE_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Decodes any PNG to 8 bit RGBA with packed rows, top first. Free of GL and
+// of shared state, so it runs on worker threads and in the host pack tool.
+bool decodePng(const std::string &fileName, int &width, int &height, std::vector<uint8_t> &pixels);
+
+#endif //PNG_DECODE_H_
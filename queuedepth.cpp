@@ -0,0 +1,76 @@
+#define LOG_TAG "RearCamera"
+
+#include <algorithm>
+#include <cutils/log.h>
+
+#include "queuedepth.h"
+
+void QueueDepthController::init(int maxDepth, int64_t latencyTargetNs)
+{
+    mMaxDepth = std::max(QUEUE_DEPTH_MIN, maxDepth);
+    mLatencyTargetNs = latencyTargetNs;
+    mDepth = mMaxDepth;
+    mFloor = QUEUE_DEPTH_MIN;
+    mFloorWindows = 0;
+    mCalmWindows = 0;
+    reset(0);
+}
+
+void QueueDepthController::reset(int64_t nowNs)
+{
+    mWindowStartNs = nowNs;
+    mWindowDropped = 0;
+    mWindowSamples = 0;
+    mWindowLatencyNs = 0;
+}
+
+bool QueueDepthController::onFrame(int64_t nowNs, int64_t latencyNs, uint32_t dropped)
+{
+    mWindowDropped += dropped;
+    if (latencyNs > 0)
+    {
+        mWindowSamples++;
+        mWindowLatencyNs += latencyNs;
+    }
+
+    if (nowNs - mWindowStartNs < QUEUE_DEPTH_WINDOW_NS)
+        return false;
+
+    bool changed = endWindow();
+    reset(nowNs);
+    return changed;
+}
+
+bool QueueDepthController::endWindow()
+{
+    if (mWindowDropped > 0)
+    {
+        mCalmWindows = 0;
+        mFloorWindows = QUEUE_DEPTH_FLOOR_WINDOWS;
+        if (mDepth >= mMaxDepth)
+            return false;
+        mDepth++;
+        mFloor = mDepth;
+        ALOGD("Driver skipped %u frames, queue depth up to %d", mWindowDropped, mDepth);
+        return true;
+    }
+
+    if (mFloorWindows > 0 && --mFloorWindows == 0)
+        mFloor = QUEUE_DEPTH_MIN;
+
+    // Unknown latency never lowers the depth, only drops count then
+    const int64_t latencyNs = mWindowSamples > 0 ? mWindowLatencyNs / mWindowSamples : 0;
+    if (latencyNs <= mLatencyTargetNs || mDepth <= mFloor)
+    {
+        mCalmWindows = 0;
+        return false;
+    }
+
+    if (++mCalmWindows < QUEUE_DEPTH_PROBE_WINDOWS)
+        return false;
+
+    mCalmWindows = 0;
+    mDepth--;
+    ALOGD("Frames wait %lld us on average, queue depth down to %d", static_cast<long long>(latencyNs / 1000), mDepth);
+    return true;
+}
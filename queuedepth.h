@@ -0,0 +1,58 @@
+#ifndef QUEUE_DEPTH_H_
+#define QUEUE_DEPTH_H_
+
+#include <stdint.h>
+
+// Fewer queued buffers leave the driver nowhere to write a frame
+static constexpr int QUEUE_DEPTH_MIN = 2;
+// Drops and latency are judged over windows this long
+static constexpr int64_t QUEUE_DEPTH_WINDOW_NS = 1000000000LL;
+// Drop free windows with latency over target before one buffer less is tried
+static constexpr int QUEUE_DEPTH_PROBE_WINDOWS = 5;
+// Drop free windows before a depth that dropped frames is tried again
+static constexpr int QUEUE_DEPTH_FLOOR_WINDOWS = 60;
+
+// Chooses how many buffers to keep queued in the driver. Every queued buffer
+// is somewhere the driver can write while the capture thread is held up, but
+// also a frame it will hand out late once the thread catches up. The depth
+// goes up one buffer as soon as the driver skips frames (sequence gaps), and
+// only comes down, one buffer at a time, after a run of drop free windows in
+// which frames waited longer than the target between capture and dequeue.
+// The depth that last dropped is not probed again for a while, so the
+// controller settles instead of oscillating.
+//
+// Pure logic on injected timestamps, not thread safe.
+class QueueDepthController
+{
+public:
+    // Starts at maxDepth, the safe end
+    void init(int maxDepth, int64_t latencyTargetNs);
+    // On stream start, sequence numbers and timings start over
+    void reset(int64_t nowNs);
+
+    // For every dequeued frame: capture to dequeue time, 0 when unknown, and
+    // frames the driver skipped before this one. Returns true if the depth
+    // changed.
+    bool onFrame(int64_t nowNs, int64_t latencyNs, uint32_t dropped);
+
+    int getDepth() const { return mDepth; };
+
+private:
+    bool endWindow();
+
+    int mMaxDepth = QUEUE_DEPTH_MIN;
+    int64_t mLatencyTargetNs = 0;
+
+    int mDepth = QUEUE_DEPTH_MIN;
+    // Lowest depth allowed until mFloorWindows runs out
+    int mFloor = QUEUE_DEPTH_MIN;
+    int mFloorWindows = 0;
+    int mCalmWindows = 0;
+
+    int64_t mWindowStartNs = 0;
+    uint32_t mWindowDropped = 0;
+    uint32_t mWindowSamples = 0;
+    int64_t mWindowLatencyNs = 0;
+};
+
+#endif //QUEUE_DEPTH_H_
@@ -2,16 +2,134 @@
 
 #include "rearcamera.h"
 
+// "x,y,w,h" as fractions of the full rectangle, anything invalid is ignored
+static ViewRect getViewRectProperty(const char *name)
+{
+    ViewRect rect;
+    char value[PROPERTY_VALUE_MAX];
+    if (property_get(name, value, "") <= 0)
+        return rect;
+
+    ViewRect parsed;
+    if (sscanf(value, "%f,%f,%f,%f", &parsed.x, &parsed.y, &parsed.w, &parsed.h) != 4 || parsed.x < 0.0f ||
+        parsed.y < 0.0f || parsed.w <= 0.0f || parsed.h <= 0.0f || parsed.x + parsed.w > 1.0f || parsed.y + parsed.h > 1.0f)
+    {
+        ALOGD("Ignoring invalid rectangle %s=\"%s\"", name, value);
+        return rect;
+    }
+    return parsed;
+}
+
+// Four comma separated numbers, false and out untouched if the property is
+// unset or malformed
+static bool getFloatsProperty(const char *name, float out[4])
+{
+    char value[PROPERTY_VALUE_MAX];
+    if (property_get(name, value, "") <= 0)
+        return false;
+
+    float parsed[4];
+    if (sscanf(value, "%f,%f,%f,%f", &parsed[0], &parsed[1], &parsed[2], &parsed[3]) != 4 ||
+        parsed[0] <= 0.0f || parsed[1] <= 0.0f || parsed[2] <= 0.0f || parsed[3] <= 0.0f)
+    {
+        ALOGD("Ignoring invalid %s=\"%s\"", name, value);
+        return false;
+    }
+    std::copy(parsed, parsed + 4, out);
+    return true;
+}
+
+// Blocks until SurfaceFlinger has registered with servicemanager
+static void waitForSurfaceFlinger()
+{
+    BootTrace::Scope trace("surfaceflinger_wait");
+    int64_t waitStartTime = android::elapsedRealtime();
+
+    // Woken by init as soon as the service runs, no polling
+    android::base::WaitForProperty("init.svc.surfaceflinger", "running");
+
+    // Registration with servicemanager trails the property by a few ms,
+    // waitForService sleeps on its registration notification
+    const android::String16 name("SurfaceFlinger");
+    if (android::defaultServiceManager()->waitForService(name) == nullptr)
+        ALOGW("servicemanager gave up waiting for SurfaceFlinger");
+    ALOGD("Waiting for SurfaceFlinger took %" PRId64 " ms", android::elapsedRealtime() - waitStartTime);
+}
+
 RearCamera::RearCamera()
 {
-    mSession = new android::SurfaceComposerClient();
     mGearListener = new DataVehicleListener();
     mProgram = 0;
     mColorShaderHandle = -1;
     mProjectionShaderHandle = -1;
+    mTexYShaderHandle = -1;
+    mTexUVShaderHandle = -1;
+    mFieldShaderHandle = -1;
+    mLinesShaderHandle = -1;
     VBO = 0;
     VAO = 0;
-    mVideoCapture.open("/dev/video14");
+    mDisplay = EGL_NO_DISPLAY;
+    mContext = EGL_NO_CONTEXT;
+    mSurface = EGL_NO_SURFACE;
+
+    char source[PROPERTY_VALUE_MAX];
+    property_get(CAMERA_SOURCE_PROPERTY, source, CAMERA_DEFAULT_SOURCE);
+    mSourceSpec = source;
+    // Opened in initEverything(), concurrently with the rest of the startup
+    mVideoCapture.reset(FrameSource::create(source));
+
+    mBenchmark.setReportInterval(property_get_int32(BENCHMARK_PROPERTY, 0));
+    mPrimedFps = std::max(0, property_get_int32(PRIMED_FPS_PROPERTY, 0));
+    // Nothing to predict when the camera streams all the time anyway
+    mPredictEnabled = mPrimedFps == 0 && property_get_bool(PREDICT_PROPERTY, true);
+    mCameraCrop = getViewRectProperty(CAMERA_CROP_PROPERTY);
+    mCameraView = getViewRectProperty(CAMERA_VIEW_PROPERTY);
+
+    mGuidelinesEnabled = property_get_bool(GUIDELINES_PROPERTY, false);
+    float values[4];
+    if (getFloatsProperty(VEHICLE_GEOMETRY_PROPERTY, values))
+    {
+        mVehicleGeometry.wheelbase = values[0];
+        mVehicleGeometry.track = values[1];
+        mVehicleGeometry.rearOverhang = values[2];
+        mVehicleGeometry.steeringRatio = values[3];
+    }
+    if (getFloatsProperty(CAMERA_POSE_PROPERTY, values))
+    {
+        mCameraPose.height = values[0];
+        mCameraPose.pitch = values[1];
+        mCameraPose.hfov = values[2];
+        mCameraPose.vfov = values[3];
+    }
+
+    char calibration[PROPERTY_VALUE_MAX];
+    property_get(CAMERA_CALIBRATION_PROPERTY, calibration, CAMERA_DEFAULT_CALIBRATION);
+    if (calibration[0] != '\0' && loadLensCalibration(calibration, mCalibration))
+    {
+        mDewarpEnabled = true;
+        // Guidelines are projected into the corrected view
+        mCameraPose.hfov = mCalibration.hfov;
+        mCameraPose.vfov = mCalibration.vfov;
+        mCameraPose.pitch += mCalibration.tilt;
+    }
+
+    char deinterlace[PROPERTY_VALUE_MAX];
+    property_get(CAMERA_DEINTERLACE_PROPERTY, deinterlace, CAMERA_DEFAULT_DEINTERLACE);
+    mDeinterlaceMode = parseDeinterlaceMode(deinterlace, DEINTERLACE_ADAPTIVE);
+
+    char shaderCache[PROPERTY_VALUE_MAX];
+    property_get(SHADER_CACHE_PROPERTY, shaderCache, SHADER_CACHE_DEFAULT_DIR);
+    setShaderCacheDir(shaderCache);
+
+    char statsSocket[PROPERTY_VALUE_MAX];
+    property_get(STATS_SOCKET_PROPERTY, statsSocket, STATS_DEFAULT_SOCKET);
+    if (statsSocket[0] != '\0')
+    {
+        mStatsServer.addSection([this](std::string &out) { mVideoCapture->getCaptureStats().dump(out); });
+        mStatsServer.addSection([this](std::string &out) { mRenderStats.dump(out); });
+        mStatsServer.addSection([](std::string &out) { BootTrace::get().dump(out); });
+        mStatsServer.start(statsSocket);
+    }
 }
 
 void RearCamera::checkGlError(const char *op)
@@ -24,35 +142,55 @@ void RearCamera::checkGlError(const char *op)
 
 bool RearCamera::initShadersProgram()
 {
-    mProgram = buildShaderProgram(gVertexShader, gFragmentNV12ToRGB, "RearCamera");
+    // Variant matching what the camera negotiated, no per-fragment branching
+    // beyond the deinterlacing of interlaced cameras
+    mProgram = getCameraProgram(mVideoCapture->getColorFormat(), mVideoCapture->isInterlaced(), mDeinterlaceMode);
     if (!mProgram)
     {
         ALOGD("Could not create program.");
         return false;
     }
+
+    // Looked up once per variant, not per frame
+    mTexYShaderHandle = glGetUniformLocation(mProgram, "textureY");
+    mTexUVShaderHandle = glGetUniformLocation(mProgram, "textureUV");
+    mFieldShaderHandle = glGetUniformLocation(mProgram, "currentField");
+    mLinesShaderHandle = glGetUniformLocation(mProgram, "lines");
     return true;
 }
 
-bool RearCamera::initSurface()
+bool RearCamera::queryDisplaySize()
 {
     android::sp<android::IBinder> dtoken(android::SurfaceComposerClient::getBuiltInDisplay(android::ISurfaceComposer::eDisplayIdMain));
     android::DisplayInfo dinfo;
     android::status_t status = android::SurfaceComposerClient::getDisplayInfo(dtoken, &dinfo);
     if (status)
     {
-        ALOGD("initSurface() getDisplayInfo status not OK");
+        ALOGD("queryDisplaySize() getDisplayInfo status not OK");
         return false;
     }
-    ALOGD("Global surface size is w=%d h=%d", dinfo.w, dinfo.h);
-    android::sp<android::SurfaceControl> control = mSession->createSurface(android::String8("RearCamera"), dinfo.w, dinfo.h, android::PIXEL_FORMAT_RGB_888);
+    mDisplayWidth = dinfo.w;
+    mDisplayHeight = dinfo.h;
+    ALOGD("Global surface size is w=%d h=%d", mDisplayWidth, mDisplayHeight);
+    return true;
+}
+
+bool RearCamera::createFlingerSurface()
+{
+    android::sp<android::SurfaceControl> control = mSession->createSurface(android::String8("RearCamera"), mDisplayWidth, mDisplayHeight, android::PIXEL_FORMAT_RGB_888);
     android::SurfaceComposerClient::Transaction{}
         .setLayer(control, INT_MAX)
-        .setSize(control, dinfo.w, dinfo.h)
+        .setSize(control, mDisplayWidth, mDisplayHeight)
         .hide(control)
         .apply();
 
-    android::sp<android::Surface> s = control->getSurface();
+    mFlingerSurfaceControl = control;
+    mFlingerSurface = control->getSurface();
+    return true;
+}
 
+bool RearCamera::initSurface()
+{
     // initialize opengl and egl
     const EGLint attribs[] = {
         EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
@@ -65,42 +203,114 @@ bool RearCamera::initSurface()
     EGLint w, h;
     EGLint numConfigs;
     EGLConfig config;
-    EGLSurface surface;
-    EGLContext context;
 
-    EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    // Stored as soon as created so releaseGl() can undo a partial setup
+    mDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
 
-    eglInitialize(display, NULL, NULL);
-    eglChooseConfig(display, attribs, &config, 1, &numConfigs);
-    if ((surface = eglCreateWindowSurface(display, config, s.get(), NULL)) == EGL_NO_SURFACE)
+    if (eglInitialize(mDisplay, NULL, NULL) == EGL_FALSE ||
+        eglChooseConfig(mDisplay, attribs, &config, 1, &numConfigs) == EGL_FALSE || numConfigs < 1)
+    {
+        ALOGD("initSurface() no usable EGL config");
+        return false;
+    }
+    if ((mSurface = eglCreateWindowSurface(mDisplay, config, mFlingerSurface.get(), NULL)) == EGL_NO_SURFACE)
     {
         ALOGD("initSurface() eglCreateWindowSurface failed");
         return false;
     }
     const EGLint context_attribs[] = {EGL_CONTEXT_CLIENT_VERSION, 3, EGL_NONE};
-    context = eglCreateContext(display, config, NULL, context_attribs);
-    eglQuerySurface(display, surface, EGL_WIDTH, &w);
-    eglQuerySurface(display, surface, EGL_HEIGHT, &h);
+    if ((mContext = eglCreateContext(mDisplay, config, NULL, context_attribs)) == EGL_NO_CONTEXT)
+    {
+        ALOGD("initSurface() eglCreateContext failed");
+        return false;
+    }
+    eglQuerySurface(mDisplay, mSurface, EGL_WIDTH, &w);
+    eglQuerySurface(mDisplay, mSurface, EGL_HEIGHT, &h);
     mSurfaceWidth = w;
     mSurfaceHeight = h;
     ALOGD("Surface size is w = %d h = %d", w, h);
 
-    if (eglMakeCurrent(display, surface, surface, context) == EGL_FALSE)
+    if (eglMakeCurrent(mDisplay, mSurface, mSurface, mContext) == EGL_FALSE)
     {
         ALOGD("initSurface() eglMakeCurrent failed");
         return false;
     }
 
-    mDisplay = display;
-    mContext = context;
-    mSurface = surface;
-    mFlingerSurfaceControl = control;
-    mFlingerSurface = s;
-
     ALOGD("initSurface() done successfully");
     return true;
 }
 
+void RearCamera::releaseGl()
+{
+    if (mDisplay == EGL_NO_DISPLAY)
+        return;
+
+    mOverlay.destroy();
+    mGuidelines.destroy();
+    mDewarp.destroy();
+    releaseCameraPrograms();
+    mProgram = 0;
+    eglMakeCurrent(mDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (mContext != EGL_NO_CONTEXT)
+        eglDestroyContext(mDisplay, mContext);
+    // Disconnects EGL from the window so the CPU can lock it afterwards
+    if (mSurface != EGL_NO_SURFACE)
+        eglDestroySurface(mDisplay, mSurface);
+    eglTerminate(mDisplay);
+    eglReleaseThread();
+
+    mDisplay = EGL_NO_DISPLAY;
+    mContext = EGL_NO_CONTEXT;
+    mSurface = EGL_NO_SURFACE;
+}
+
+// Remaining crop in frame pixels, on even coordinates to keep chroma aligned
+static ARect getCropRect(FrameSource &source)
+{
+    const ViewRect crop = source.getCrop();
+    ARect rect;
+    rect.left = static_cast<int32_t>(crop.x * source.getWidth()) & ~1;
+    rect.top = static_cast<int32_t>(crop.y * source.getFrameHeight()) & ~1;
+    rect.right = std::min(source.getWidth(), rect.left + std::max(2, static_cast<int32_t>(crop.w * source.getWidth())));
+    rect.bottom = std::min(source.getFrameHeight(), rect.top + std::max(2, static_cast<int32_t>(crop.h * source.getFrameHeight())));
+    return rect;
+}
+
+bool RearCamera::initSoftwareSurface()
+{
+    // Buffers at cropped camera resolution, SurfaceFlinger scales them to the
+    // whole display, the view rectangle only applies to GL rendering
+    const ARect crop = getCropRect(*mVideoCapture);
+    ANativeWindow *window = mFlingerSurface.get();
+    if (native_window_set_buffers_dimensions(window, crop.right - crop.left, crop.bottom - crop.top) != android::OK ||
+        native_window_set_buffers_format(window, HAL_PIXEL_FORMAT_RGBX_8888) != android::OK ||
+        native_window_set_scaling_mode(window, NATIVE_WINDOW_SCALING_MODE_SCALE_TO_WINDOW) != android::OK)
+    {
+        ALOGD("initSoftwareSurface() failed to configure the window");
+        return false;
+    }
+
+    // Deinterlaced before anything else looks at the lines
+    if (mVideoCapture->isInterlaced() &&
+        !mDeinterlacer.init(mVideoCapture->getWidth(), mVideoCapture->getFrameHeight(), mVideoCapture->getYStride(),
+                            mVideoCapture->getUVStride(), mDeinterlaceMode))
+    {
+        ALOGD("Frame layout can not be deinterlaced, showing the fields woven");
+    }
+
+    if (mDewarpEnabled &&
+        !mRemap.init(mDewarp, mVideoCapture->getWidth(), mVideoCapture->getFrameHeight(), mVideoCapture->getYStride(),
+                     mVideoCapture->getUVStride(), crop.right - crop.left, crop.bottom - crop.top,
+                     mVideoCapture->getColorFormat().range))
+    {
+        ALOGD("No remap table, showing the image uncorrected");
+    }
+
+    mSoftwareRender = true;
+    ALOGD("Rendering in software, %s color conversion", getConvertKernelName(getBestConvertKernel()));
+    return true;
+}
+
 bool RearCamera::initSurfaceConfigs()
 {
     if (initShadersProgram())
@@ -133,8 +343,8 @@ bool RearCamera::initSurfaceConfigs()
         glEnableVertexAttribArray(GL_ZERO);
         glVertexAttribPointer(GL_ZERO, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), GL_ZERO);
 
-        glm::mat4 projection = glm::ortho(0.0f, static_cast<GLfloat>(mSurfaceWidth), 0.0f, static_cast<GLfloat>(mSurfaceHeight));
-        glUniformMatrix4fv(mProjectionShaderHandle, 1, GL_FALSE, glm::value_ptr(projection));
+        mProjection = glm::ortho(0.0f, static_cast<GLfloat>(mSurfaceWidth), 0.0f, static_cast<GLfloat>(mSurfaceHeight));
+        glUniformMatrix4fv(mProjectionShaderHandle, 1, GL_FALSE, glm::value_ptr(mProjection));
 
         ALOGD("OpenGL paramaters set correctly");
         return true;
@@ -143,16 +353,127 @@ bool RearCamera::initSurfaceConfigs()
     return false;
 }
 
-void RearCamera::initAllTexturesFromPng()
+void RearCamera::initOverlays()
 {
-    std::vector<std::string> images = Helper::listDirectory("", ".png");
-    if (images.size() > 0)
+    BootTrace::Scope trace("overlays");
+    char dir[PROPERTY_VALUE_MAX];
+    property_get(OVERLAY_DIR_PROPERTY, dir, OVERLAY_DEFAULT_DIR);
+    std::string path(dir);
+    if (path.empty())
+        return;
+    if (path.back() != '/')
+        path += '/';
+
+    // Startup cost independent of the asset count: one mapping, one upload
+    {
+        OverlayPack pack;
+        if (pack.open(path + OVERLAY_PACK_FILE))
+            mOverlay.addPack(pack);
+    }
+
+    struct LooseImage
     {
-        for (unsigned int i = 0; i < images.size(); i++)
+        std::string path;
+        int width = 0;
+        int height = 0;
+        std::vector<uint8_t> pixels;
+        bool decoded = false;
+    };
+    std::vector<LooseImage> loose;
+    for (const std::string &image : Helper::listDirectory(path, ".png"))
+    {
+        if (mOverlay.hasImage(Helper::basename(image)))
+            continue;
+        LooseImage entry;
+        entry.path = image;
+        loose.push_back(std::move(entry));
+    }
+
+    if (!loose.empty())
+    {
+        ALOGD("Decoding %zu overlay images missing from the pack", loose.size());
+        std::atomic<size_t> next(0);
+        auto decode = [&loose, &next]() {
+            for (size_t i = next++; i < loose.size(); i = next++)
+            {
+                LooseImage &image = loose[i];
+                image.decoded = decodePng(image.path, image.width, image.height, image.pixels);
+            }
+        };
+
+        // The render thread takes a share too, the futures join on destruction
+        const size_t helpers = std::min<size_t>(loose.size(), OVERLAY_DECODE_THREADS) - 1;
+        std::vector<std::future<void>> workers;
+        for (size_t i = 0; i < helpers; i++)
+            workers.push_back(std::async(std::launch::async, decode));
+        decode();
+        for (std::future<void> &worker : workers)
+            worker.wait();
+
+        // In directory order whatever the thread finishing first
+        for (LooseImage &image : loose)
         {
-            loadPngFromPath(Helper::basename(images.at(i)), images.at(i));
+            if (image.decoded)
+                mOverlay.addImage(Helper::basename(image.path), image.width, image.height, std::move(image.pixels));
+            else
+                ALOGD("Failed to decode overlay %s", image.path.c_str());
         }
     }
+
+    if (mOverlay.buildAtlas())
+        loadOverlayLayout(path + OVERLAY_LAYOUT_FILE);
+}
+
+void RearCamera::loadOverlayLayout(const std::string &fileName)
+{
+    FILE *fp = fopen(fileName.c_str(), "r");
+    if (fp == NULL)
+    {
+        ALOGD("No overlay layout at %s", fileName.c_str());
+        return;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        char name[128];
+        OverlayItem item;
+        if (line[0] == '#' || sscanf(line, "%127s %f %f %f %f", name, &item.rect.x, &item.rect.y, &item.rect.w, &item.rect.h) != 5)
+            continue;
+        if (!mOverlay.hasImage(name))
+        {
+            ALOGD("Overlay layout refers to unknown image %s", name);
+            continue;
+        }
+        item.name = name;
+        mOverlayLayout.push_back(item);
+    }
+    fclose(fp);
+    ALOGD("%zu overlays in the layout", mOverlayLayout.size());
+}
+
+// Every overlay on top of the camera, one draw call per atlas page: the
+// pack and the loose images packed at startup
+void RearCamera::drawOverlays()
+{
+    for (const OverlayItem &item : mOverlayLayout)
+    {
+        const ViewRect &rect = item.rect;
+        printTexture(item.name, rect.x * mSurfaceWidth, (1.0f - rect.y - rect.h) * mSurfaceHeight,
+                     glm::ivec2(rect.w * mSurfaceWidth, rect.h * mSurfaceHeight), glm::vec3(1.0f));
+    }
+    mOverlay.flush(glm::value_ptr(mProjection));
+}
+
+// Queues an overlay image for the current frame, x and y of its bottom left
+// corner in surface pixels
+void RearCamera::printTexture(const std::string &name, GLfloat x, GLfloat y, glm::ivec2 size, glm::vec3 color)
+{
+    const float tint[4] = {color.x, color.y, color.z, 1.0f};
+    if (!mOverlay.draw(name, x, y, size.x, size.y, tint))
+    {
+        ALOGD("Overlay %s not drawn", name.c_str());
+    }
 }
 
 void RearCamera::createCameraTexture(const int width, const int height)
@@ -194,50 +515,104 @@ void RearCamera::createCameraTexture(const int width, const int height)
     }
 }
 
-void RearCamera::refreshCamera()
+void RearCamera::refreshCamera(const CameraFrame &frame)
 {
-    if (!mShouldRefresh)
-        mSem.wait();
-
-    GLfloat xpos = 0;
-    GLfloat ypos = 0;
-
-    GLfloat w = mSurfaceWidth;
-    GLfloat h = mSurfaceHeight;
+    // View rectangles count from the top, GL from the bottom
+    GLfloat w = mCameraView.w * mSurfaceWidth;
+    GLfloat h = mCameraView.h * mSurfaceHeight;
+    GLfloat xpos = mCameraView.x * mSurfaceWidth;
+    GLfloat ypos = mSurfaceHeight - mCameraView.y * mSurfaceHeight - h;
+
+    // Whatever the camera could not crop in hardware is cropped here
+    const ViewRect crop = mVideoCapture->getCrop();
+    GLfloat u0 = crop.x;
+    GLfloat u1 = crop.x + crop.w;
+    GLfloat v0 = crop.y;
+    GLfloat v1 = crop.y + crop.h;
 
     GLfloat vertices[6][4] = {
-        {xpos, ypos + h, 0.0, 0.0},
-        {xpos, ypos, 0.0, 1.0},
-        {xpos + w, ypos, 1.0, 1.0},
+        {xpos, ypos + h, u0, v0},
+        {xpos, ypos, u0, v1},
+        {xpos + w, ypos, u1, v1},
+
+        {xpos, ypos + h, u0, v0},
+        {xpos + w, ypos, u1, v1},
+        {xpos + w, ypos + h, u1, v0}};
+
+    // Overlays leave their own program and buffer bound
+    glUseProgram(mProgram);
+
+    nsecs_t uploadStart = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    glUniform1i(mTexYShaderHandle, GL_ZERO);
+    glUniform1i(mTexUVShaderHandle, GL_ONE);
+    // Only the interlaced variants have these, see buildCameraFragmentShader().
+    // A lone field is the newest one once uploaded.
+    int newestField = -1;
+    if (frame.field == FIELD_INTERLACED_TB || frame.field == FIELD_BOTTOM)
+        newestField = 1;
+    else if (frame.field == FIELD_INTERLACED_BT || frame.field == FIELD_TOP)
+        newestField = 0;
+    const GLfloat lines = mVideoCapture->getFrameHeight();
+    glUniform1i(mFieldShaderHandle, newestField);
+    glUniform2f(mLinesShaderHandle, lines, lines / 2);
+    mUploader.upload(frame, cameraTexY, cameraTexU, mRenderStats.copy);
+
+    // The lens correction is a static mesh in place of the quad
+    if (!mDewarpEnabled)
+    {
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferSubData(GL_ARRAY_BUFFER, GL_ZERO, sizeof(vertices), vertices);
+    }
 
-        {xpos, ypos + h, 0.0, 0.0},
-        {xpos + w, ypos, 1.0, 1.0},
-        {xpos + w, ypos + h, 1.0, 0.0}};
+    nsecs_t drawStart = systemTime(SYSTEM_TIME_MONOTONIC);
+    mRenderStats.upload.record(drawStart - uploadStart);
+    if (mDewarpEnabled)
+        mDewarp.draw();
+    else
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+    mRenderStats.draw.record(systemTime(SYSTEM_TIME_MONOTONIC) - drawStart);
+}
 
-    GLint locTexY = glGetUniformLocation(mProgram, "textureY");
-    GLint locTexU = glGetUniformLocation(mProgram, "textureUV");
+bool RearCamera::convertCamera(const CameraFrame &woven)
+{
+    ANativeWindow_Buffer buffer;
+    if (mFlingerSurface->lock(&buffer, nullptr) != android::OK)
+    {
+        ALOGD("failed to lock the surface");
+        return false;
+    }
 
-    glActiveTexture(GL_TEXTURE0);
-    glUniform1i(locTexY, GL_ZERO);
-    glBindTexture(GL_TEXTURE_2D, cameraTexY);
-    glBindVertexArray(VAO);
-    glTexSubImage2D(GL_TEXTURE_2D, GL_ZERO, GL_ZERO, GL_ZERO, mVideoCapture.getWidth(),
-                    mVideoCapture.getHeight(), GL_LUMINANCE, GL_UNSIGNED_BYTE, std::get<0>(mVideoCapture.getRawBufferCamera()));
-    glBufferSubData(GL_ARRAY_BUFFER, GL_ZERO, sizeof(vertices), vertices);
+    nsecs_t convertStart = systemTime(SYSTEM_TIME_MONOTONIC);
+    const CameraFrame &frame = mDeinterlacer.deinterlace(woven);
 
-    glActiveTexture(GL_TEXTURE1);
-    glUniform1i(locTexU, GL_ONE);
-    glBindTexture(GL_TEXTURE_2D, cameraTexU);
-    glBindVertexArray(VAO);
-    glTexSubImage2D(GL_TEXTURE_2D, GL_ZERO, GL_ZERO, GL_ZERO, mVideoCapture.getWidth() / 2,
-                    mVideoCapture.getHeight() / 2, GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, std::get<1>(mVideoCapture.getRawBufferCamera()));
-    glBufferSubData(GL_ARRAY_BUFFER, GL_ZERO, sizeof(vertices), vertices);
+    const ARect crop = getCropRect(*mVideoCapture);
+    int width = std::min(crop.right - crop.left, static_cast<int>(buffer.width));
+    int height = std::min(crop.bottom - crop.top, static_cast<int>(buffer.height));
+    const unsigned char *y = frame.y + crop.top * frame.yStride + crop.left;
+    const unsigned char *uv = frame.uv + crop.top / 2 * frame.uvStride + crop.left;
+    int yStride = frame.yStride;
+    int uvStride = frame.uvStride;
 
-    glDrawArrays(GL_TRIANGLES, 0, 6);
+    if (mRemap.isValid())
+    {
+        // Corrected into packed planes first, then converted as usual
+        mRemap.remap(frame.y, frame.uv);
+        y = mRemap.getY();
+        uv = mRemap.getUV();
+        yStride = uvStride = mRemap.getWidth();
+        width = std::min(width, mRemap.getWidth());
+        height = std::min(height, mRemap.getHeight());
+    }
+    convertYuv420spToRgba(y, yStride, uv, uvStride,
+                          static_cast<uint8_t *>(buffer.bits), buffer.stride * 4, width, height, mVideoCapture->getColorFormat());
+    mRenderStats.convert.record(systemTime(SYSTEM_TIME_MONOTONIC) - convertStart);
+    return true;
 }
 
 // Helper to subscribe to VHal notifications
-bool RearCamera::subscribeToVHal(android::sp<IVehicle> pVnet, android::sp<IVehicleCallback> listener, VehicleProperty propertyId)
+bool RearCamera::subscribeToVHal(android::sp<IVehicle> pVnet, android::sp<IVehicleCallback> listener, VehicleProperty propertyId, float sampleRate)
 {
     if (pVnet == nullptr || listener == nullptr)
     {
@@ -248,6 +623,7 @@ bool RearCamera::subscribeToVHal(android::sp<IVehicle> pVnet, android::sp<IVehic
     // Changes in these values are what will trigger a reconfiguration of the EVS pipeline
     SubscribeOptions optionsData[] = {
         {.propId = static_cast<int32_t>(propertyId),
+         .sampleRate = sampleRate,
          .flags = SubscribeFlags::EVENTS_FROM_CAR},
     };
     hidl_vec<SubscribeOptions> options;
@@ -255,7 +631,7 @@ bool RearCamera::subscribeToVHal(android::sp<IVehicle> pVnet, android::sp<IVehic
     StatusCode status = pVnet->subscribe(listener, options);
     if (status != StatusCode::OK)
     {
-        ALOGW("VHAL subscription for property 0x%08X failed with code %d.", propertyId, status);
+        ALOGW("VHAL subscription for property 0x%08X failed with code %d.", static_cast<unsigned>(propertyId), static_cast<int>(status));
         return false;
     }
 
@@ -298,8 +674,11 @@ bool RearCamera::getGearFromHal(sp<IVehicle> &vehicleHal)
 void RearCamera::startCapture()
 {
     mShouldRefresh = true;
-    mVideoCapture.startStream();
-    mSem.notify();
+    mStreamStopDeadline = 0;
+    // Primed: the hidden surface already holds a recent frame, show it right
+    // away and let the render thread catch up to full rate
+    if (mPrimedFps == 0)
+        mVideoCapture->startStream();
     android::SurfaceComposerClient::Transaction{}
         .show(mFlingerSurfaceControl)
         .apply();
@@ -308,156 +687,388 @@ void RearCamera::startCapture()
 void RearCamera::stopCapture()
 {
     mShouldRefresh = false;
-    mVideoCapture.stopStream();
     android::SurfaceComposerClient::Transaction{}
         .hide(mFlingerSurfaceControl)
         .apply();
+    if (mPrimedFps == 0)
+        mStreamStopDeadline = systemTime(SYSTEM_TIME_MONOTONIC) + ms2ns(STREAM_STOP_DEBOUNCE_MS);
 }
 
-bool RearCamera::initEverything()
+// Runs concurrently with the GL setup. The callback is installed before
+// subscribing so no gear event is lost, and the initial read is queued after
+// anything received meanwhile.
+bool RearCamera::connectVehicleHal()
 {
-    //this order is important
-    if (initSurface())
+    BootTrace::Scope trace("vehicle_connect");
+    ALOGD("Connecting to Vehicle HAL");
+    sp<IVehicle> pVnet = IVehicle::getService();
+    if (pVnet.get() == nullptr)
+    {
+        return false;
+    }
+
+    mGearListener->setCallback(std::bind(&RearCamera::notifyGear, this, std::placeholders::_1));
+    if (!subscribeToVHal(pVnet, mGearListener, VehicleProperty::GEAR_SELECTION))
+    {
+        return false;
+    }
+
+    // Optional, the camera works without them, just without warm-up
+    if (mPredictEnabled)
+    {
+        mGearListener->setSpeedCallback(std::bind(&RearCamera::notifySpeed, this, std::placeholders::_1));
+        mGearListener->setParkingBrakeCallback(std::bind(&RearCamera::notifyParkingBrake, this, std::placeholders::_1));
+        mGearListener->setTurnSignalCallback(std::bind(&RearCamera::notifyTurnSignal, this, std::placeholders::_1));
+        subscribeToVHal(pVnet, mGearListener, VehicleProperty::PERF_VEHICLE_SPEED, PREDICTOR_SPEED_RATE_HZ);
+        subscribeToVHal(pVnet, mGearListener, VehicleProperty::PARKING_BRAKE_ON);
+        subscribeToVHal(pVnet, mGearListener, VehicleProperty::TURN_SIGNAL_STATE);
+    }
+    if (mGuidelinesEnabled)
+    {
+        mGearListener->setSteeringCallback(std::bind(&RearCamera::notifySteering, this, std::placeholders::_1));
+        subscribeToVHal(pVnet, mGearListener, VehicleProperty::PERF_STEERING_ANGLE, GUIDELINE_STEERING_RATE_HZ);
+    }
+
+    notifyGear(getGearFromHal(pVnet));
+    return true;
+}
+
+// Needs the negotiated camera format, so runs once the device is open
+bool RearCamera::initRendering()
+{
+    BootTrace::Scope trace("gl_setup");
+    if (mDewarpEnabled)
+    {
+        char cache[PROPERTY_VALUE_MAX];
+        property_get(DEWARP_CACHE_PROPERTY, cache, DEWARP_DEFAULT_CACHE);
+        mDewarp.build(mCalibration, mCameraCrop, cache);
+    }
+
+    if (mDisplay != EGL_NO_DISPLAY)
     {
         if (initSurfaceConfigs())
         {
-            //initAllTexturesFromPng();
-            createCameraTexture(mVideoCapture.getWidth(), mVideoCapture.getHeight());
-            sp<IVehicle> pVnet;
-            ALOGD("Connecting to Vehicle HAL");
-            pVnet = IVehicle::getService();
-            if (pVnet.get() == nullptr)
+            initOverlays();
+            if (mGuidelinesEnabled)
             {
-                return false;
+                mGuidelines.init(mVehicleGeometry, mCameraPose, mCameraCrop, mCameraView, mSurfaceWidth, mSurfaceHeight);
             }
-
-            if (!subscribeToVHal(pVnet, mGearListener, VehicleProperty::GEAR_SELECTION))
-            {
-                return false;
-            }
-            mGearListener->setCallback(std::bind(&RearCamera::notifyGear, this, std::placeholders::_1));
-            mShouldRefresh = getGearFromHal(pVnet);
-            if (mShouldRefresh)
+            createCameraTexture(mVideoCapture->getWidth(), mVideoCapture->getFrameHeight());
+            if (mDewarpEnabled && !mDewarp.upload(mCameraView, mSurfaceWidth, mSurfaceHeight))
             {
-                startCapture();
-            }
-            else
-            {
-                stopCapture();
+                ALOGD("Dewarp mesh upload failed, showing the image uncorrected");
+                mDewarp.destroy();
+                mDewarpEnabled = false;
             }
+            // The shader deinterlaces, lone fields go straight into their half
+            mUploader.init(mVideoCapture->getWidth(), mVideoCapture->getFrameHeight(), mVideoCapture->getYStride(),
+                           mVideoCapture->getUVStride(), mVideoCapture->isInterlaced());
             return true;
         }
+        ALOGD("GL setup failed, falling back to software rendering");
+        releaseGl();
     }
-    return false;
+    return initSoftwareSurface();
+}
+
+bool RearCamera::initEverything()
+{
+    BootTrace::Scope trace("init");
+
+    // The camera is asked for just the pixels shown. Until SurfaceFlinger
+    // runs only a configured display size is known, without one the camera
+    // only crops. A lens correction needs the whole image, it applies the
+    // crop itself.
+    int viewWidth = 0;
+    int viewHeight = 0;
+    char displaySize[PROPERTY_VALUE_MAX];
+    int configuredWidth = 0;
+    int configuredHeight = 0;
+    if (property_get(DISPLAY_SIZE_PROPERTY, displaySize, "") > 0 &&
+        sscanf(displaySize, "%dx%d", &configuredWidth, &configuredHeight) == 2 && configuredWidth > 0 && configuredHeight > 0)
+    {
+        viewWidth = lroundf(mCameraView.w * configuredWidth);
+        viewHeight = lroundf(mCameraView.h * configuredHeight);
+    }
+    mVideoCapture->setViewport(mDewarpEnabled ? ViewRect() : mCameraCrop, viewWidth, viewHeight);
+
+    // Neither needs SurfaceFlinger and both are independent until the camera
+    // format is needed for the shaders. Futures from std::async join on
+    // destruction, so early returns are safe.
+    std::future<bool> camera = std::async(std::launch::async, [this]() {
+        BootTrace::Scope trace("camera_open");
+        return mVideoCapture->open(mSourceSpec.c_str());
+    });
+    std::future<bool> vehicle = std::async(std::launch::async, [this]() { return connectVehicleHal(); });
+
+    waitForSurfaceFlinger();
+    // Connects to SurfaceFlinger on creation
+    mSession = new android::SurfaceComposerClient();
+    if (!queryDisplaySize())
+        return false;
+    if (configuredWidth != 0 && (configuredWidth != mDisplayWidth || configuredHeight != mDisplayHeight))
+    {
+        ALOGW("%s=%s but the display is %dx%d, the camera is scaled for the wrong size", DISPLAY_SIZE_PROPERTY,
+              displaySize, mDisplayWidth, mDisplayHeight);
+    }
+
+    //this order is important
+    if (!createFlingerSurface())
+        return false;
+
+    if (!property_get_bool(SOFTWARE_RENDER_PROPERTY, false))
+    {
+        BootTrace::Scope trace("egl");
+        if (!initSurface())
+        {
+            ALOGD("EGL unavailable, falling back to software rendering");
+            releaseGl();
+        }
+    }
+
+    if (!camera.get())
+    {
+        ALOGD("Failed to open camera source %s", mSourceSpec.c_str());
+    }
+
+    if (!initRendering())
+        return false;
+
+    if (!vehicle.get())
+        return false;
+
+    if (mPrimedFps > 0)
+    {
+        ALOGD("Primed mode, refreshing the hidden surface at %d fps", mPrimedFps);
+        mVideoCapture->startStream();
+    }
+
+    // Applies the initial gear and whatever arrived during startup
+    processEvents();
+    return true;
 }
 
 void RearCamera::notifyGear(bool isEngaged)
 {
-    if (isEngaged)
-        startCapture();
-    else
-        stopCapture();
+    postEvent(VehicleEvent::GEAR, isEngaged ? 1.0f : 0.0f);
 }
 
-void RearCamera::printAll()
+void RearCamera::notifySpeed(float metersPerSecond)
 {
-    glClearColor(GL_ZERO, GL_ZERO, GL_ZERO, GL_ZERO);
-    glClear(GL_COLOR_BUFFER_BIT);
-    refreshCamera();
+    postEvent(VehicleEvent::SPEED, metersPerSecond);
+}
 
-    eglSwapBuffers(mDisplay, mSurface);
+void RearCamera::notifyParkingBrake(bool engaged)
+{
+    postEvent(VehicleEvent::PARKING_BRAKE, engaged ? 1.0f : 0.0f);
 }
 
-bool RearCamera::loadPngFromPath(const std::string &textureName, const std::string &fileName)
+void RearCamera::notifyTurnSignal(bool active)
 {
-    png_structp png_ptr;
-    png_infop info_ptr;
-    unsigned int sig_read = 0;
-    int color_type, interlace_type;
-    FILE *fp;
+    postEvent(VehicleEvent::TURN_SIGNAL, active ? 1.0f : 0.0f);
+}
 
-    if ((fp = fopen(fileName.c_str(), "rb")) == NULL)
-        return false;
+void RearCamera::notifySteering(float degrees)
+{
+    postEvent(VehicleEvent::STEERING, degrees);
+}
 
-    png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+// Any thread
+void RearCamera::postEvent(VehicleEvent::Type type, float value)
+{
+    if (!mEvents.push({type, value}))
+    {
+        ALOGW("Vehicle event queue full, dropping event %d", type);
+        return;
+    }
+    // Gets the render thread out of whichever wait it is in
+    mSem.notify();
+    mVideoCapture->wakeUp();
+}
 
-    if (png_ptr == NULL)
+// Control loop, render thread only
+void RearCamera::processEvents()
+{
+    // Before popping, so a notification for an event pushed meanwhile survives
+    while (mSem.try_wait())
     {
-        fclose(fp);
-        return false;
     }
 
-    info_ptr = png_create_info_struct(png_ptr);
-    if (info_ptr == NULL)
+    // Coalesced: only the newest value of each signal matters, so R-N-R
+    // arriving in one batch never touches the stream
+    bool received[VehicleEvent::TYPE_COUNT] = {};
+    float latest[VehicleEvent::TYPE_COUNT] = {};
+    VehicleEvent event;
+    while (mEvents.pop(event))
     {
-        fclose(fp);
-        png_destroy_read_struct(&png_ptr, NULL, NULL);
-        return false;
+        received[event.type] = true;
+        latest[event.type] = event.value;
     }
 
-    if (setjmp(png_jmpbuf(png_ptr)))
+    const nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    // A warm-up cancelled within the same batch, or the other way round,
+    // leaves the stream as it was
+    ReversePredictor::Action action = ReversePredictor::NONE;
+    auto apply = [&action](ReversePredictor::Action next) {
+        if (next != ReversePredictor::NONE)
+            action = action == ReversePredictor::NONE ? next : ReversePredictor::NONE;
+    };
+
+    if (received[VehicleEvent::SPEED])
+        apply(mPredictor.onSpeed(latest[VehicleEvent::SPEED], now));
+    if (received[VehicleEvent::PARKING_BRAKE])
+        apply(mPredictor.onParkingBrake(latest[VehicleEvent::PARKING_BRAKE] != 0.0f, now));
+    if (received[VehicleEvent::TURN_SIGNAL])
+        apply(mPredictor.onTurnSignal(latest[VehicleEvent::TURN_SIGNAL] != 0.0f, now));
+    // Only picks the table entry, the upload waits for the next frame drawn
+    if (received[VehicleEvent::STEERING])
+        mGuidelines.setSteeringAngle(latest[VehicleEvent::STEERING]);
+
+    const bool reverse = latest[VehicleEvent::GEAR] != 0.0f;
+    if (received[VehicleEvent::GEAR] && reverse != mShouldRefresh)
     {
-        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-        fclose(fp);
-        return false;
+        apply(mPredictor.onReverse(reverse, now));
+        if (reverse)
+            startCapture();
+        else
+            stopCapture();
     }
+    apply(mPredictor.onTick(now));
 
-    png_init_io(png_ptr, fp);
-    png_set_sig_bytes(png_ptr, sig_read);
+    // In reverse or primed mode the stream is not the predictor's to manage
+    if (!mShouldRefresh && mPrimedFps == 0)
+    {
+        if (action == ReversePredictor::WARM)
+        {
+            ALOGD("Reverse likely, warming up the camera");
+            mStreamStopDeadline = 0;
+            mVideoCapture->startStream();
+        }
+        else if (action == ReversePredictor::COOL && mStreamStopDeadline == 0)
+        {
+            mStreamStopDeadline = now;
+        }
+    }
 
-    png_read_png(png_ptr, info_ptr, PNG_TRANSFORM_STRIP_16 | PNG_TRANSFORM_PACKING | PNG_TRANSFORM_EXPAND, NULL);
+    if (mStreamStopDeadline != 0 && now >= mStreamStopDeadline)
+    {
+        mStreamStopDeadline = 0;
+        mVideoCapture->stopStream();
+    }
+}
 
-    png_uint_32 width, height;
-    int bit_depth;
-    png_get_IHDR(png_ptr, info_ptr, &width, &height, &bit_depth, &color_type, &interlace_type, NULL, NULL);
+// How long the idle render thread may sleep before a deadline, -1 for none
+int RearCamera::getControlTimeoutMs()
+{
+    nsecs_t deadline = mStreamStopDeadline;
+    if (mPredictor.getDeadline() != 0 && (deadline == 0 || mPredictor.getDeadline() < deadline))
+        deadline = mPredictor.getDeadline();
+    if (deadline == 0)
+        return -1;
 
-    unsigned int row_bytes = png_get_rowbytes(png_ptr, info_ptr);
-    GLubyte *outData = (unsigned char *)malloc(row_bytes * height);
+    return std::max<nsecs_t>(0, ns2ms(deadline - systemTime(SYSTEM_TIME_MONOTONIC)) + 1);
+}
 
-    png_bytepp row_pointers = png_get_rows(png_ptr, info_ptr);
+void RearCamera::printAll()
+{
+    processEvents();
 
-    for (unsigned int i = 0; i < height; i++)
+    if (!mShouldRefresh)
     {
-        memcpy(outData + (row_bytes * i), row_pointers[i], row_bytes);
+        if (mPrimedFps > 0)
+        {
+            // Throttled refresh of the hidden surface, an event wakes us early
+            if (mSem.wait_for(std::chrono::milliseconds(1000 / mPrimedFps)))
+                return;
+        }
+        else
+        {
+            // Nothing to show, a warm stream included: sleep until an event
+            // or the next deadline
+            int timeoutMs = getControlTimeoutMs();
+            if (timeoutMs < 0)
+                mSem.wait();
+            else
+                mSem.wait_for(std::chrono::milliseconds(timeoutMs));
+            return;
+        }
     }
 
-    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-    fclose(fp);
+    // Paced by the camera: nothing to upload, draw or swap until a new frame lands
+    if (!mVideoCapture->waitForFrame(mLastFrameGeneration, FRAME_WATCHDOG_MS))
+    {
+        if (mShouldRefresh)
+        {
+            mRenderStats.stalls.add();
+            ALOGD("No camera frame for %d ms", FRAME_WATCHDOG_MS);
+        }
+        return;
+    }
 
-    GLuint idTex;
-    glGenTextures(1, &idTex);
-    glBindTexture(GL_TEXTURE_2D, idTex);
+    // Upload straight from the driver buffer, it is requeued once released
+    const uint32_t generation = mVideoCapture->getFrameGeneration();
+    FrameLease frame = mVideoCapture->acquireFrame();
+    if (!frame || frame->generation == mLastFrameGeneration)
+    {
+        // A flush publishes no frame but still moves the generation on,
+        // waiting on the old one again would return at once
+        mLastFrameGeneration = generation;
+        return;
+    }
+    if (frame->generation > mLastFrameGeneration + 1)
+        mRenderStats.dropped.add(frame->generation - mLastFrameGeneration - 1);
+    mLastFrameGeneration = frame->generation;
+    nsecs_t acquireTime = systemTime(SYSTEM_TIME_MONOTONIC);
 
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glTexImage2D(GL_TEXTURE_2D, GL_ZERO, GL_RGBA, width, height, GL_ZERO, GL_RGBA, GL_UNSIGNED_BYTE, outData);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    if (mSoftwareRender)
+    {
+        // Single fields come back as a whole frame, the lease stays held anyway
+        if (!convertCamera(mDeinterlacer.weave(*frame)))
+            return;
+    }
+    else
+    {
+        glClearColor(GL_ZERO, GL_ZERO, GL_ZERO, GL_ZERO);
+        glClear(GL_COLOR_BUFFER_BIT);
+        refreshCamera(*frame);
+        mGuidelines.draw(glm::value_ptr(mProjection));
+        drawOverlays();
+    }
+    nsecs_t drawTime = systemTime(SYSTEM_TIME_MONOTONIC);
 
-    free(outData);
+    if (mSoftwareRender)
+        mFlingerSurface->unlockAndPost();
+    else
+        eglSwapBuffers(mDisplay, mSurface);
+    nsecs_t swapTime = systemTime(SYSTEM_TIME_MONOTONIC);
+    mRenderStats.swap.record(swapTime - drawTime);
+    mRenderStats.frames.add();
 
-    Texture texture = {
-        textureName,
-        fileName,
-        idTex,
-        glm::ivec2(width, height)};
-    mTextures.insert(std::pair<std::string, Texture>(textureName, texture));
+    // Frames refreshing the hidden surface in primed mode are not on screen
+    if (mBenchmark.isEnabled() && mShouldRefresh)
+    {
+        mBenchmark.recordFrame(frame->timestamp, frame->dequeueTime, acquireTime, drawTime, swapTime);
+    }
 
-    return true;
+    // Same for the boot trace, the first frame is the first one seen
+    if (!mFirstFrameShown && mShouldRefresh)
+    {
+        mFirstFrameShown = true;
+        BootTrace::get().mark("first_frame");
+        BootTrace::get().report();
+    }
 }
 
 void RearCamera::clearAll()
 {
-    mVideoCapture.stopStream();
-    mVideoCapture.close();
-    eglMakeCurrent(mDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
-    eglDestroyContext(mDisplay, mContext);
-    eglDestroySurface(mDisplay, mSurface);
+    mStatsServer.stop();
+    if (!mSoftwareRender)
+        mUploader.destroy();
+    mVideoCapture->stopStream();
+    mVideoCapture->close();
+    releaseGl();
     mFlingerSurface.clear();
     mFlingerSurfaceControl.clear();
-    eglTerminate(mDisplay);
-    eglReleaseThread();
     mSession.clear();
     ALOGD("RearCamera cleaned");
 }
@@ -20,8 +20,10 @@
 
 #include <androidfw/AssetManager.h>
 #include <binder/IPCThreadState.h>
+#include <binder/IServiceManager.h>
 #include <utils/Errors.h>
 #include <utils/SystemClock.h>
+#include <utils/Timers.h>
 
 #include <android-base/properties.h>
 #include "android-base/macros.h"
@@ -34,7 +36,9 @@
 #include <gui/ISurfaceComposer.h>
 #include <gui/Surface.h>
 #include <gui/SurfaceComposerClient.h>
+#include <system/window.h>
 #include <algorithm>
+#include <future>
 
 #include <glm.hpp>
 #include <gtc/matrix_transform.hpp>
@@ -42,15 +46,131 @@
 
 #include <hidl/HidlTransportSupport.h>
 
-#include <png.h>
-
 #include "helper.h"
 #include "shader.h"
 #include "videocapture.h"
+#include "latencystats.h"
+#include "stats.h"
+#include "statsserver.h"
+#include "streaminguploader.h"
+#include "colorconvert.h"
+#include "boottrace.h"
+#include "reversepredictor.h"
+#include "eventqueue.h"
+#include "overlay.h"
+#include "guidelines.h"
+#include "dewarp.h"
+#include "remap.h"
+#include "deinterlace.h"
+#include "pngdecode.h"
 
 #include "sem.h"
 #include "dataVehicleListener.h"
 
+// Frame source spec, see FrameSource::create(). e.g. "synthetic:1280x720@60"
+static constexpr const char *CAMERA_SOURCE_PROPERTY = "persist.rearcamera.source";
+static constexpr const char *CAMERA_DEFAULT_SOURCE = "/dev/video14";
+
+// Rectangles as "x,y,w,h" fractions, e.g. "0.25,0.25,0.5,0.5". The crop is
+// the part of the camera image shown (digital zoom), the view where it goes
+// on the surface (split view, picture in picture). The camera crops and
+// scales in hardware to what is shown when it can.
+static constexpr const char *CAMERA_CROP_PROPERTY = "persist.rearcamera.crop";
+static constexpr const char *CAMERA_VIEW_PROPERTY = "persist.rearcamera.view";
+// Display size as "WxH". Lets the camera open with its hardware scaling
+// while SurfaceFlinger is still coming up, unset it only crops in hardware
+// and the GPU scales.
+static constexpr const char *DISPLAY_SIZE_PROPERTY = "persist.rearcamera.display_size";
+
+// Overlay images. The pack built offline by the overlaypack tool is mapped
+// and uploaded as is, PNGs it does not hold are decoded at startup and
+// packed into a second atlas. The optional layout file in the same
+// directory places them, one "<image> x y w h" line each, in fractions of
+// the surface from the top left corner.
+static constexpr const char *OVERLAY_DIR_PROPERTY = "persist.rearcamera.overlay_dir";
+static constexpr const char *OVERLAY_DEFAULT_DIR = "/system/etc/rearcamera/overlays/";
+static constexpr const char *OVERLAY_PACK_FILE = "overlays.pack";
+static constexpr const char *OVERLAY_LAYOUT_FILE = "layout.txt";
+// Threads decoding loose overlay PNGs, the render thread included
+static constexpr unsigned OVERLAY_DECODE_THREADS = 4;
+
+// Lens calibration, see dewarp.h. When present the camera image is shown
+// corrected and the crop applies to the corrected image. The warp mesh is
+// cached in the given file, empty to disable.
+static constexpr const char *CAMERA_CALIBRATION_PROPERTY = "persist.rearcamera.calibration";
+static constexpr const char *CAMERA_DEFAULT_CALIBRATION = "/system/etc/rearcamera/calibration.txt";
+static constexpr const char *DEWARP_CACHE_PROPERTY = "persist.rearcamera.dewarp_cache";
+static constexpr const char *DEWARP_DEFAULT_CACHE = "/data/vendor/rearcamera/dewarp.bin";
+
+// How interlaced cameras are deinterlaced: weave, bob or adaptive, see
+// deinterlace.h. Applies in the camera shader or on the CPU, progressive
+// cameras ignore it.
+static constexpr const char *CAMERA_DEINTERLACE_PROPERTY = "persist.rearcamera.deinterlace";
+static constexpr const char *CAMERA_DEFAULT_DEINTERLACE = "adaptive";
+
+// Draw predicted trajectories from the steering angle. Vehicle geometry is
+// "wheelbase,track,rear_overhang,steering_ratio" in metres, the camera pose
+// "height,pitch,hfov,vfov" in metres and degrees, see guidelines.h. With a
+// lens calibration the fields of view and the tilt come from there.
+static constexpr const char *GUIDELINES_PROPERTY = "persist.rearcamera.guidelines";
+static constexpr const char *VEHICLE_GEOMETRY_PROPERTY = "persist.rearcamera.vehicle";
+static constexpr const char *CAMERA_POSE_PROPERTY = "persist.rearcamera.camera_pose";
+// Sample rate asked for the continuous steering angle property
+static constexpr float GUIDELINE_STEERING_RATE_HZ = 10.0f;
+
+// Report glass-to-glass latency every N frames, 0 disables the benchmark
+static constexpr const char *BENCHMARK_PROPERTY = "persist.rearcamera.benchmark";
+
+// UNIX socket serving the pipeline counters, empty to disable
+static constexpr const char *STATS_SOCKET_PROPERTY = "persist.rearcamera.stats_socket";
+static constexpr const char *STATS_DEFAULT_SOCKET = "/data/local/tmp/rearcamera_stats";
+
+// Where compiled shader program binaries are kept, empty to disable. Both
+// caches default to the service's own directory, created by rearcamera.rc
+static constexpr const char *SHADER_CACHE_PROPERTY = "persist.rearcamera.shader_cache";
+static constexpr const char *SHADER_CACHE_DEFAULT_DIR = "/data/vendor/rearcamera/shaders";
+
+// Skip GL and convert frames on the CPU straight into the surface buffer.
+// Used automatically when GL can not be brought up.
+static constexpr const char *SOFTWARE_RENDER_PROPERTY = "persist.rearcamera.software_render";
+
+// Keep the camera streaming while not in reverse and refresh the hidden
+// surface at this rate, so engaging reverse shows a frame at once. Trades
+// idle power for engagement latency, 0 disables.
+static constexpr const char *PRIMED_FPS_PROPERTY = "persist.rearcamera.primed_fps";
+
+// Warm the camera up when vehicle signals make reverse likely
+static constexpr const char *PREDICT_PROPERTY = "persist.rearcamera.predict";
+// Sample rate asked for the continuous speed property
+static constexpr float PREDICTOR_SPEED_RATE_HZ = 5.0f;
+
+// Leaving reverse hides the surface at once but keeps the sensor streaming
+// this long, so R-N-R while parking does not restart it
+static constexpr int STREAM_STOP_DEBOUNCE_MS = 1500;
+// Pending vehicle events, a burst beyond this is dropped
+static constexpr size_t VEHICLE_EVENT_QUEUE_SIZE = 64;
+
+// Log a stall when no camera frame arrived for this long while in reverse
+static constexpr int FRAME_WATCHDOG_MS = 500;
+
+// Posted by the VHAL binder threads, consumed by the render thread
+struct VehicleEvent
+{
+	enum Type
+	{
+		GEAR = 0,
+		SPEED,
+		PARKING_BRAKE,
+		TURN_SIGNAL,
+		STEERING,
+		TYPE_COUNT,
+	};
+
+	Type type;
+	// Speed in m/s, steering angle in degrees, 1 or 0 for the others
+	float value;
+};
+
 namespace android
 {
 	class Surface;
@@ -70,30 +190,43 @@ public:
 private:
 	//full setup
 	bool initShadersProgram();
+	bool queryDisplaySize();
+	bool createFlingerSurface();
 	bool initSurface();
+	bool initSoftwareSurface();
+	void releaseGl();
 	bool initSurfaceConfigs();
-	void initAllTexturesFromPng();
+	void initOverlays();
+	void loadOverlayLayout(const std::string &);
+	void drawOverlays();
 	void checkGlError(const char *);
-	bool loadPngFromPath(const std::string &, const std::string &);
 	void forwardFrame(v4l2_buffer *, unsigned char *);
 	void createCameraTexture(const int, const int);
 
 	void printTexture(const std::string &, GLfloat, GLfloat, glm::ivec2, glm::vec3);
-	void refreshCamera();
-	bool subscribeToVHal(sp<IVehicle>, sp<IVehicleCallback>, VehicleProperty);
+	void refreshCamera(const CameraFrame &);
+	bool convertCamera(const CameraFrame &);
+	bool subscribeToVHal(sp<IVehicle>, sp<IVehicleCallback>, VehicleProperty, float = 0.0f);
 	bool getGearFromHal(sp<IVehicle> &);
+	bool connectVehicleHal();
+	bool initRendering();
 	void clearAll();
 
 	void startCapture();
 	void stopCapture();
 	void notifyGear(bool);
+	void notifySpeed(float);
+	void notifyParkingBrake(bool);
+	void notifyTurnSignal(bool);
+	void notifySteering(float);
+	void postEvent(VehicleEvent::Type, float);
+	void processEvents();
+	int getControlTimeoutMs();
 
-	struct Texture
+	struct OverlayItem
 	{
 		std::string name;
-		std::string path;
-		GLuint TextureID;
-		glm::ivec2 Size;
+		ViewRect rect;
 	};
 
 private:
@@ -108,14 +241,36 @@ private:
 
 	int mSurfaceWidth;
 	int mSurfaceHeight;
-	std::map<std::string, Texture> mTextures;
+	int mDisplayWidth = 0;
+	int mDisplayHeight = 0;
+	ViewRect mCameraCrop;
+	ViewRect mCameraView;
+	glm::mat4 mProjection;
+	OverlayRenderer mOverlay;
+	std::vector<OverlayItem> mOverlayLayout;
+	bool mGuidelinesEnabled = false;
+	VehicleGeometry mVehicleGeometry;
+	CameraPose mCameraPose;
+	GuidelineRenderer mGuidelines;
+	bool mDewarpEnabled = false;
+	LensCalibration mCalibration;
+	DewarpMesh mDewarp;
+	RemapTable mRemap;
+	DeinterlaceMode mDeinterlaceMode = DEINTERLACE_ADAPTIVE;
+	Deinterlacer mDeinterlacer;
 
-	VideoCapture mVideoCapture;
+	std::unique_ptr<FrameSource> mVideoCapture;
+	std::string mSourceSpec;
 
 	GLuint mProgram;
 	GLint mColorShaderHandle;
 	GLint mProjectionShaderHandle;
 	GLint mTextShaderHandle;
+	// Camera program uniforms, -1 where the variant has none
+	GLint mTexYShaderHandle;
+	GLint mTexUVShaderHandle;
+	GLint mFieldShaderHandle;
+	GLint mLinesShaderHandle;
 
 	GLuint cameraTexY;
 	GLuint cameraTexU;
@@ -126,8 +281,25 @@ private:
 
 	Sem mSem;
 	android::sp<DataVehicleListener> mGearListener;
+	// Binder threads only post here, every state transition happens in
+	// processEvents() on the render thread. Events posted during startup
+	// simply wait for the first call.
+	EventQueue<VehicleEvent, VEHICLE_EVENT_QUEUE_SIZE> mEvents;
+	ReversePredictor mPredictor;
+	bool mPredictEnabled = false;
+	// When the debounced STREAMOFF is due, 0 if none is pending
+	nsecs_t mStreamStopDeadline = 0;
+	bool mFirstFrameShown = false;
 
 	bool mShouldRefresh = false;
+	int mPrimedFps = 0;
+	bool mSoftwareRender = false;
+	uint32_t mLastFrameGeneration = 0;
+
+	LatencyBenchmark mBenchmark;
+	RenderStats mRenderStats;
+	StreamingUploader mUploader;
+	StatsServer mStatsServer;
 };
 
 #endif // REARCAMERA_H_
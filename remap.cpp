@@ -0,0 +1,250 @@
+#define LOG_TAG "RearCameraColor"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <cutils/log.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define REMAP_X86 1
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define REMAP_NEON 1
+#endif
+
+#include "remap.h"
+
+// Weights are 7 bit so p * w sums stay below 32768. Both directions round
+// back to 8 bits, the SIMD kernels round at the same points.
+static constexpr int WEIGHT_SHIFT = 7;
+static constexpr int WEIGHT_ONE = 1 << WEIGHT_SHIFT;
+static constexpr int WEIGHT_ROUND = WEIGHT_ONE / 2;
+
+typedef void (*BlendKernel)(const uint8_t *topLeft, const uint8_t *topRight, const uint8_t *bottomLeft,
+                            const uint8_t *bottomRight, const uint8_t *wx, const uint8_t *wy, uint8_t *out, int count);
+
+static void blendScalar(const uint8_t *topLeft, const uint8_t *topRight, const uint8_t *bottomLeft,
+                        const uint8_t *bottomRight, const uint8_t *wx, const uint8_t *wy, uint8_t *out, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        const int top = (topLeft[i] * (WEIGHT_ONE - wx[i]) + topRight[i] * wx[i] + WEIGHT_ROUND) >> WEIGHT_SHIFT;
+        const int bottom = (bottomLeft[i] * (WEIGHT_ONE - wx[i]) + bottomRight[i] * wx[i] + WEIGHT_ROUND) >> WEIGHT_SHIFT;
+        out[i] = (top * (WEIGHT_ONE - wy[i]) + bottom * wy[i] + WEIGHT_ROUND) >> WEIGHT_SHIFT;
+    }
+}
+
+#ifdef REMAP_X86
+static inline __m128i lerpSSE2(__m128i a, __m128i b, __m128i w)
+{
+    const __m128i one = _mm_set1_epi16(WEIGHT_ONE);
+    const __m128i round = _mm_set1_epi16(WEIGHT_ROUND);
+    __m128i sum = _mm_add_epi16(_mm_mullo_epi16(a, _mm_sub_epi16(one, w)), _mm_mullo_epi16(b, w));
+    return _mm_srli_epi16(_mm_add_epi16(sum, round), WEIGHT_SHIFT);
+}
+
+static void blendSSE2(const uint8_t *topLeft, const uint8_t *topRight, const uint8_t *bottomLeft,
+                      const uint8_t *bottomRight, const uint8_t *wx, const uint8_t *wy, uint8_t *out, int count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m128i tl = _mm_loadu_si128(reinterpret_cast<const __m128i *>(topLeft + i));
+        const __m128i tr = _mm_loadu_si128(reinterpret_cast<const __m128i *>(topRight + i));
+        const __m128i bl = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bottomLeft + i));
+        const __m128i br = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bottomRight + i));
+        const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(wx + i));
+        const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(wy + i));
+
+        __m128i result[2];
+        for (int half = 0; half < 2; half++)
+        {
+            auto widen = [&](__m128i v) { return half == 0 ? _mm_unpacklo_epi8(v, zero) : _mm_unpackhi_epi8(v, zero); };
+            const __m128i top = lerpSSE2(widen(tl), widen(tr), widen(x));
+            const __m128i bottom = lerpSSE2(widen(bl), widen(br), widen(x));
+            result[half] = lerpSSE2(top, bottom, widen(y));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_packus_epi16(result[0], result[1]));
+    }
+
+    blendScalar(topLeft + i, topRight + i, bottomLeft + i, bottomRight + i, wx + i, wy + i, out + i, count - i);
+}
+#endif
+
+#ifdef REMAP_NEON
+static inline uint8x8_t lerpNEON(uint8x8_t a, uint8x8_t b, uint8x8_t w)
+{
+    // vrshrn adds the rounding half before the shift, like the scalar kernel
+    const uint8x8_t inverse = vsub_u8(vdup_n_u8(WEIGHT_ONE), w);
+    return vrshrn_n_u16(vmlal_u8(vmull_u8(a, inverse), b, w), WEIGHT_SHIFT);
+}
+
+static void blendNEON(const uint8_t *topLeft, const uint8_t *topRight, const uint8_t *bottomLeft,
+                      const uint8_t *bottomRight, const uint8_t *wx, const uint8_t *wy, uint8_t *out, int count)
+{
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        const uint8x8_t x = vld1_u8(wx + i);
+        const uint8x8_t top = lerpNEON(vld1_u8(topLeft + i), vld1_u8(topRight + i), x);
+        const uint8x8_t bottom = lerpNEON(vld1_u8(bottomLeft + i), vld1_u8(bottomRight + i), x);
+        vst1_u8(out + i, lerpNEON(top, bottom, vld1_u8(wy + i)));
+    }
+
+    blendScalar(topLeft + i, topRight + i, bottomLeft + i, bottomRight + i, wx + i, wy + i, out + i, count - i);
+}
+#endif
+
+static BlendKernel getBlendKernel(ConvertKernel kernel)
+{
+    if (!isConvertKernelSupported(kernel))
+        return blendScalar;
+
+    switch (kernel)
+    {
+#ifdef REMAP_X86
+    // Gathers dominate, AVX2 would not blend any faster
+    case KERNEL_SSE2:
+    case KERNEL_AVX2:
+        return blendSSE2;
+#endif
+#ifdef REMAP_NEON
+    case KERNEL_NEON:
+        return blendNEON;
+#endif
+    default:
+        return blendScalar;
+    }
+}
+
+bool RemapTable::init(const DewarpMesh &mesh, int srcWidth, int srcHeight, int yStride, int uvStride,
+                      int dstWidth, int dstHeight, ColorRange range)
+{
+    if (!mesh.isBuilt() || srcWidth < 2 || srcHeight < 2 || dstWidth < 2 || dstHeight < 2)
+        return false;
+
+    mWidth = dstWidth & ~1;
+    mHeight = dstHeight & ~1;
+
+    mLuma.width = mWidth;
+    mLuma.height = mHeight;
+    mLuma.bytesPerPixel = 1;
+    mLuma.stride = yStride;
+    mLuma.black[0] = range == RANGE_LIMITED ? 16 : 0;
+    initPlane(mLuma, mesh, srcWidth, srcHeight);
+
+    // Interleaved pairs at half resolution
+    mChroma.width = mWidth / 2;
+    mChroma.height = mHeight / 2;
+    mChroma.bytesPerPixel = 2;
+    mChroma.stride = uvStride;
+    mChroma.black[0] = mChroma.black[1] = 128;
+    initPlane(mChroma, mesh, srcWidth / 2, srcHeight / 2);
+
+    mY.resize(static_cast<size_t>(mWidth) * mHeight);
+    mUV.resize(static_cast<size_t>(mWidth) * mHeight / 2);
+    mGather.resize(static_cast<size_t>(mWidth) * 4);
+    ALOGD("Remap table for %dx%d from %dx%d", mWidth, mHeight, srcWidth, srcHeight);
+    return true;
+}
+
+// Pixel centres of the output, interpolated across the mesh cells
+void RemapTable::initPlane(Plane &plane, const DewarpMesh &mesh, int srcWidth, int srcHeight)
+{
+    const size_t pixels = static_cast<size_t>(plane.width) * plane.height;
+    plane.offsets.resize(pixels);
+    plane.weightsX.resize(pixels * plane.bytesPerPixel);
+    plane.weightsY.resize(pixels * plane.bytesPerPixel);
+
+    for (int row = 0; row < plane.height; row++)
+    {
+        const float gridY = (row + 0.5f) / plane.height * DEWARP_GRID_ROWS;
+        const int cellY = std::min(static_cast<int>(gridY), DEWARP_GRID_ROWS - 1);
+        const float fy = gridY - cellY;
+        for (int column = 0; column < plane.width; column++)
+        {
+            const float gridX = (column + 0.5f) / plane.width * DEWARP_GRID_COLUMNS;
+            const int cellX = std::min(static_cast<int>(gridX), DEWARP_GRID_COLUMNS - 1);
+            const float fx = gridX - cellX;
+
+            float source[2];
+            for (int c = 0; c < 2; c++)
+            {
+                const float top = mesh.getPoint(cellX, cellY)[c] * (1.0f - fx) + mesh.getPoint(cellX + 1, cellY)[c] * fx;
+                const float bottom = mesh.getPoint(cellX, cellY + 1)[c] * (1.0f - fx) + mesh.getPoint(cellX + 1, cellY + 1)[c] * fx;
+                source[c] = top * (1.0f - fy) + bottom * fy;
+            }
+
+            const size_t index = static_cast<size_t>(row) * plane.width + column;
+            const float sx = source[0] * srcWidth - 0.5f;
+            const float sy = source[1] * srcHeight - 0.5f;
+            if (!(sx >= -0.5f && sx <= srcWidth - 0.5f && sy >= -0.5f && sy <= srcHeight - 0.5f))
+            {
+                plane.offsets[index] = OUTSIDE;
+                continue;
+            }
+
+            // Clamped so all four neighbours are inside, the weight takes the rest
+            const int x0 = std::min(std::max(static_cast<int>(floorf(sx)), 0), srcWidth - 2);
+            const int y0 = std::min(std::max(static_cast<int>(floorf(sy)), 0), srcHeight - 2);
+            const uint8_t wx = std::min(std::max(lroundf((sx - x0) * WEIGHT_ONE), 0L), static_cast<long>(WEIGHT_ONE));
+            const uint8_t wy = std::min(std::max(lroundf((sy - y0) * WEIGHT_ONE), 0L), static_cast<long>(WEIGHT_ONE));
+            plane.offsets[index] = y0 * plane.stride + x0 * plane.bytesPerPixel;
+            for (int b = 0; b < plane.bytesPerPixel; b++)
+            {
+                plane.weightsX[index * plane.bytesPerPixel + b] = wx;
+                plane.weightsY[index * plane.bytesPerPixel + b] = wy;
+            }
+        }
+    }
+}
+
+void RemapTable::remapPlane(const Plane &plane, const uint8_t *src, uint8_t *dst, ConvertKernel kernel)
+{
+    const BlendKernel blend = getBlendKernel(kernel);
+    const int bpp = plane.bytesPerPixel;
+    const int rowBytes = plane.width * bpp;
+    uint8_t *topLeft = mGather.data();
+    uint8_t *topRight = topLeft + rowBytes;
+    uint8_t *bottomLeft = topRight + rowBytes;
+    uint8_t *bottomRight = bottomLeft + rowBytes;
+
+    for (int row = 0; row < plane.height; row++)
+    {
+        const size_t first = static_cast<size_t>(row) * plane.width;
+        for (int column = 0; column < plane.width; column++)
+        {
+            const uint32_t offset = plane.offsets[first + column];
+            for (int b = 0; b < bpp; b++)
+            {
+                const int i = column * bpp + b;
+                if (offset == OUTSIDE)
+                {
+                    topLeft[i] = topRight[i] = bottomLeft[i] = bottomRight[i] = plane.black[b];
+                    continue;
+                }
+                const uint8_t *p = src + offset + b;
+                topLeft[i] = p[0];
+                topRight[i] = p[bpp];
+                bottomLeft[i] = p[plane.stride];
+                bottomRight[i] = p[plane.stride + bpp];
+            }
+        }
+        blend(topLeft, topRight, bottomLeft, bottomRight, &plane.weightsX[first * bpp], &plane.weightsY[first * bpp],
+              dst + first * bpp, rowBytes);
+    }
+}
+
+void RemapTable::remap(const uint8_t *y, const uint8_t *uv, ConvertKernel kernel)
+{
+    remapPlane(mLuma, y, mY.data(), kernel);
+    remapPlane(mChroma, uv, mUV.data(), kernel);
+}
+
+void RemapTable::remap(const uint8_t *y, const uint8_t *uv)
+{
+    remap(y, uv, getBestConvertKernel());
+}
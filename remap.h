@@ -0,0 +1,64 @@
+#ifndef REMAP_H_
+#define REMAP_H_
+
+#include <stdint.h>
+#include <vector>
+
+#include "colorconvert.h"
+#include "dewarp.h"
+
+// Per pixel lookup for the software path, interpolated once from a
+// DewarpMesh: where each corrected output pixel sits in the camera image
+// and its bilinear weights. Remapping a frame then gathers four neighbours
+// per pixel and blends them, 16 bytes at a time with SSE2 or NEON. Works on
+// semi-planar YUV 4:2:0 so the result goes through the usual conversion.
+class RemapTable
+{
+public:
+    // Strides are the camera frame strides, fixed while the stream runs
+    bool init(const DewarpMesh &mesh, int srcWidth, int srcHeight, int yStride, int uvStride,
+              int dstWidth, int dstHeight, ColorRange range);
+    bool isValid() const { return !mLuma.offsets.empty(); };
+
+    // Output planes are packed, dstWidth bytes per row both. All kernels
+    // produce bit-identical output, the scalar one is the reference.
+    void remap(const uint8_t *y, const uint8_t *uv);
+    void remap(const uint8_t *y, const uint8_t *uv, ConvertKernel kernel);
+
+    const uint8_t *getY() const { return mY.data(); };
+    const uint8_t *getUV() const { return mUV.data(); };
+    int getWidth() const { return mWidth; };
+    int getHeight() const { return mHeight; };
+
+private:
+    struct Plane
+    {
+        // Top left neighbour, OUTSIDE for pixels the camera does not see
+        std::vector<uint32_t> offsets;
+        // 0..128 towards the right and the lower neighbours, per byte
+        std::vector<uint8_t> weightsX;
+        std::vector<uint8_t> weightsY;
+        int width = 0;
+        int height = 0;
+        int bytesPerPixel = 1;
+        int stride = 0;
+        // Filled in where the camera does not see, per byte of a pixel
+        uint8_t black[2] = {};
+    };
+
+    static constexpr uint32_t OUTSIDE = UINT32_MAX;
+
+    void initPlane(Plane &plane, const DewarpMesh &mesh, int srcWidth, int srcHeight);
+    void remapPlane(const Plane &plane, const uint8_t *src, uint8_t *dst, ConvertKernel kernel);
+
+    Plane mLuma;
+    Plane mChroma;
+    int mWidth = 0;
+    int mHeight = 0;
+    std::vector<uint8_t> mY;
+    std::vector<uint8_t> mUV;
+    // Gathered neighbours of one row: top left, top right, bottom left, bottom right
+    std::vector<uint8_t> mGather;
+};
+
+#endif //REMAP_H_
@@ -0,0 +1,68 @@
+#define LOG_TAG "RearCameraPredictor"
+
+#include <cutils/log.h>
+
+#include "reversepredictor.h"
+
+ReversePredictor::Action ReversePredictor::onSpeed(float metersPerSecond, int64_t nowNs)
+{
+    mStopped = metersPerSecond < PREDICTOR_STOPPED_SPEED && metersPerSecond > -PREDICTOR_STOPPED_SPEED;
+    return update(nowNs);
+}
+
+ReversePredictor::Action ReversePredictor::onParkingBrake(bool engaged, int64_t nowNs)
+{
+    mParkingBrake = engaged;
+    return update(nowNs);
+}
+
+ReversePredictor::Action ReversePredictor::onTurnSignal(bool active, int64_t nowNs)
+{
+    mTurnSignal = active;
+    return update(nowNs);
+}
+
+ReversePredictor::Action ReversePredictor::onReverse(bool engaged, int64_t nowNs)
+{
+    mReverse = engaged;
+    return update(nowNs);
+}
+
+ReversePredictor::Action ReversePredictor::onTick(int64_t nowNs)
+{
+    return update(nowNs);
+}
+
+ReversePredictor::Action ReversePredictor::update(int64_t nowNs)
+{
+    const bool likely = !mReverse && mStopped && !mParkingBrake && !mTurnSignal;
+
+    if (!likely)
+    {
+        mArmed = true;
+        if (mWarm)
+        {
+            // Reverse itself takes over the stream, anything else cancels
+            mWarm = false;
+            return COOL;
+        }
+        return NONE;
+    }
+
+    if (mWarm && nowNs >= mWarmUntilNs)
+    {
+        ALOGD("Reverse did not follow, cooling down");
+        mWarm = false;
+        return COOL;
+    }
+
+    if (!mWarm && mArmed)
+    {
+        mWarm = true;
+        mArmed = false;
+        mWarmUntilNs = nowNs + PREDICTOR_WARM_TIMEOUT_NS;
+        return WARM;
+    }
+
+    return NONE;
+}
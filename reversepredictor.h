@@ -0,0 +1,53 @@
+#ifndef REVERSE_PREDICTOR_H_
+#define REVERSE_PREDICTOR_H_
+
+#include <stdint.h>
+
+// Below this the vehicle counts as stopped, in m/s
+static constexpr float PREDICTOR_STOPPED_SPEED = 0.3f;
+// How long a warm-up is kept when reverse does not follow
+static constexpr int64_t PREDICTOR_WARM_TIMEOUT_NS = 5000000000LL;
+
+// Guesses from vehicle signals when reverse is about to be engaged, so the
+// capture pipeline can be warmed up ahead of the gear change: stopped, parking
+// brake released and no turn signal. A warm-up that does not come true is
+// cancelled after PREDICTOR_WARM_TIMEOUT_NS and only re-armed once the
+// conditions drop, so waiting at a red light does not keep the camera on.
+//
+// Pure logic on injected timestamps, not thread safe.
+class ReversePredictor
+{
+public:
+    enum Action
+    {
+        NONE = 0,
+        WARM, // start streaming without showing anything
+        COOL, // prediction over, stop streaming unless in reverse
+    };
+
+    Action onSpeed(float metersPerSecond, int64_t nowNs);
+    Action onParkingBrake(bool engaged, int64_t nowNs);
+    Action onTurnSignal(bool active, int64_t nowNs);
+    Action onReverse(bool engaged, int64_t nowNs);
+    // Expires the warm-up, to be called regularly
+    Action onTick(int64_t nowNs);
+
+    bool isWarm() const { return mWarm; };
+    // When the current warm-up expires, 0 if not warm
+    int64_t getDeadline() const { return mWarm ? mWarmUntilNs : 0; };
+
+private:
+    Action update(int64_t nowNs);
+
+    // Unknown signals start on the side that does not predict anything
+    bool mStopped = false;
+    bool mParkingBrake = true;
+    bool mTurnSignal = false;
+    bool mReverse = false;
+
+    bool mWarm = false;
+    bool mArmed = true;
+    int64_t mWarmUntilNs = 0;
+};
+
+#endif //REVERSE_PREDICTOR_H_
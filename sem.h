@@ -1,6 +1,7 @@
 #ifndef SEM_
 #define SEM_
 
+#include <chrono>
 #include <mutex>
 #include <condition_variable>
 
@@ -22,6 +23,16 @@ public:
         --mCount;
     }
 
+    // Returns false if nobody notified within timeout
+    bool wait_for(std::chrono::milliseconds timeout)
+    {
+        std::unique_lock<decltype(mMutex)> lock(mMutex);
+        if (!mCondition.wait_for(lock, timeout, [this]() { return mCount != 0; }))
+            return false;
+        --mCount;
+        return true;
+    }
+
     bool try_wait()
     {
         std::unique_lock<decltype(mMutex)> lock(mMutex);
@@ -2,8 +2,207 @@
 
 #include "shader.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <map>
 #include <memory>
+#include <vector>
+#include <utils/Timers.h>
+
+#include "helper.h"
+
+// Written in front of every cached program binary
+struct ProgramBinaryHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    // Hash of the sources and the driver identity, guards against renamed files
+    uint64_t key;
+    uint32_t format;
+    uint32_t length;
+    // Hash of the binary, catches truncated or corrupted files
+    uint32_t checksum;
+    uint32_t reserved;
+};
+
+static constexpr uint32_t PROGRAM_BINARY_MAGIC = 0x42505243; // "CRPB"
+static constexpr uint32_t PROGRAM_BINARY_VERSION = 1;
+
+static std::string gShaderCacheDir;
+
+void setShaderCacheDir(const char *dir)
+{
+    gShaderCacheDir.clear();
+    if (dir == nullptr || dir[0] == '\0')
+        return;
+
+    // Binaries found there are handed to the driver as they are
+    mkdir(dir, 0700);
+    if (!Helper::isPrivateDirectory(dir))
+    {
+        ALOGD("Shader cache %s is not private to this service, not using it", dir);
+        return;
+    }
+    gShaderCacheDir = dir;
+}
+
+static uint64_t fnv1a64(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint64_t hashString(uint64_t hash, const char *str)
+{
+    // Include the terminator so "ab"+"c" and "a"+"bc" differ
+    return fnv1a64(hash, str != nullptr ? str : "", str != nullptr ? strlen(str) + 1 : 1);
+}
+
+// A driver update changes vendor, renderer or version, which invalidates
+// every binary built by the previous one
+static uint64_t getProgramKey(const char *vtxSrc, const char *pxlSrc)
+{
+    uint64_t key = 0xcbf29ce484222325ULL;
+    key = hashString(key, vtxSrc);
+    key = hashString(key, pxlSrc);
+    key = hashString(key, reinterpret_cast<const char *>(glGetString(GL_VENDOR)));
+    key = hashString(key, reinterpret_cast<const char *>(glGetString(GL_RENDERER)));
+    key = hashString(key, reinterpret_cast<const char *>(glGetString(GL_VERSION)));
+    return key;
+}
+
+static std::string getProgramCachePath(uint64_t key)
+{
+    char file[32];
+    snprintf(file, sizeof(file), "/%016llx.bin", static_cast<unsigned long long>(key));
+    return gShaderCacheDir + file;
+}
+
+static bool readFully(int fd, void *data, size_t size)
+{
+    unsigned char *dst = static_cast<unsigned char *>(data);
+    while (size > 0)
+    {
+        ssize_t n = read(fd, dst, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        dst += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool writeFully(int fd, const void *data, size_t size)
+{
+    const unsigned char *src = static_cast<const unsigned char *>(data);
+    while (size > 0)
+    {
+        ssize_t n = write(fd, src, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        src += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Returns 0 on any miss, a stale or broken file is removed so it is rebuilt
+static GLuint loadCachedProgram(const std::string &path, uint64_t key, const char *name)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+
+    ProgramBinaryHeader header;
+    std::vector<unsigned char> binary;
+    bool valid = readFully(fd, &header, sizeof(header)) &&
+                 header.magic == PROGRAM_BINARY_MAGIC && header.version == PROGRAM_BINARY_VERSION &&
+                 header.key == key && header.length > 0;
+    if (valid)
+    {
+        binary.resize(header.length);
+        valid = readFully(fd, binary.data(), binary.size()) &&
+                static_cast<uint32_t>(fnv1a64(0xcbf29ce484222325ULL, binary.data(), binary.size())) == header.checksum;
+    }
+    close(fd);
+
+    GLuint program = 0;
+    if (valid)
+    {
+        program = glCreateProgram();
+        glProgramBinary(program, header.format, binary.data(), binary.size());
+        GLint linked = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        if (!linked)
+        {
+            // e.g. the driver rejects binaries of another build despite the same version string
+            glDeleteProgram(program);
+            program = 0;
+        }
+    }
+
+    if (program == 0)
+    {
+        ALOGD("Discarding cached program binary for %s", name);
+        unlink(path.c_str());
+    }
+    return program;
+}
+
+static void storeCachedProgram(GLuint program, const std::string &path, uint64_t key, const char *name)
+{
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    ProgramBinaryHeader header;
+    memset(&header, 0, sizeof(header));
+    std::vector<unsigned char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &length, &format, binary.data());
+    if (glGetError() != GL_NO_ERROR || length <= 0)
+        return;
+
+    header.magic = PROGRAM_BINARY_MAGIC;
+    header.version = PROGRAM_BINARY_VERSION;
+    header.key = key;
+    header.format = format;
+    header.length = length;
+    header.checksum = static_cast<uint32_t>(fnv1a64(0xcbf29ce484222325ULL, binary.data(), length));
+
+    // Written aside and renamed, a power cut never leaves a half written binary
+    const std::string tmpPath = path + ".tmp";
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        ALOGD("Can not write program cache %s (%d = %s)", tmpPath.c_str(), errno, strerror(errno));
+        return;
+    }
+    bool written = writeFully(fd, &header, sizeof(header)) && writeFully(fd, binary.data(), length) && fsync(fd) == 0;
+    close(fd);
+
+    if (!written || rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        ALOGD("Failed to store program binary for %s", name);
+        unlink(tmpPath.c_str());
+        return;
+    }
+    ALOGD("Stored %d bytes program binary for %s", length, name);
+}
 
 // Given shader source, load and compile it
 static GLuint loadShader(GLenum type, const char *shaderSrc, const char *name)
@@ -46,6 +245,28 @@ static GLuint loadShader(GLenum type, const char *shaderSrc, const char *name)
 // Create a program object given vertex and pixels shader source
 GLuint buildShaderProgram(const char *vtxSrc, const char *pxlSrc, const char *name)
 {
+    nsecs_t buildStart = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    // Binaries are only usable if the driver supports at least one format
+    GLint binaryFormats = 0;
+    if (!gShaderCacheDir.empty())
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binaryFormats);
+
+    uint64_t key = 0;
+    std::string cachePath;
+    if (binaryFormats > 0)
+    {
+        key = getProgramKey(vtxSrc, pxlSrc);
+        cachePath = getProgramCachePath(key);
+        GLuint cached = loadCachedProgram(cachePath, key, name);
+        if (cached != 0)
+        {
+            ALOGD("Loaded %s from the program cache in %lld us", name,
+                  static_cast<long long>((systemTime(SYSTEM_TIME_MONOTONIC) - buildStart) / 1000));
+            return cached;
+        }
+    }
+
     GLuint program = glCreateProgram();
     if (program == 0)
     {
@@ -71,6 +292,8 @@ GLuint buildShaderProgram(const char *vtxSrc, const char *pxlSrc, const char *na
     }
     glAttachShader(program, vertexShader);
     glAttachShader(program, pixelShader);
+    if (!cachePath.empty())
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 
     // Link the program
     glLinkProgram(program);
@@ -122,5 +345,128 @@ GLuint buildShaderProgram(const char *vtxSrc, const char *pxlSrc, const char *na
     }
 #endif
 
+    ALOGD("Compiled %s in %lld us", name, static_cast<long long>((systemTime(SYSTEM_TIME_MONOTONIC) - buildStart) / 1000));
+    if (!cachePath.empty())
+        storeCachedProgram(program, cachePath, key, name);
+
     return program;
 }
+
+// Swizzle of the GL_LUMINANCE_ALPHA chroma texture giving (u, v): the first
+// byte of each pair lands in .r, the second in .a
+static constexpr const char *gChromaSwizzle[] = {
+    "ra", // CHROMA_NV12
+    "ar", // CHROMA_NV21
+};
+
+// Rows are snapped to their centre so the fields never blend vertically.
+// The textures hold the fields stacked, the top field in the upper half, so
+// a frame row is found in the half of its parity. Lines of the older field
+// are rebuilt from the newest field around them: always for bob, only where
+// they comb for adaptive, never for weave.
+static constexpr const char *gFieldSampleFunction =
+    "uniform int currentField;\n"
+    "uniform vec2 lines;\n"
+    "const float combThreshold = %.6f;\n"
+    "vec4 fieldRow(sampler2D tex, float row, float rows) {\n"
+    "   float parity = mod(row, 2.0);\n"
+    "   return textureLod(tex, vec2(TexCoords.x, ((parity * rows + row - parity) * 0.5 + 0.5) / rows), 0.0);\n"
+    "}\n"
+    "vec4 fieldSample(sampler2D tex, float rows) {\n"
+    "   float row = min(floor(TexCoords.y * rows), rows - 1.0);\n"
+    "   vec4 woven = fieldRow(tex, row, rows);\n"
+    "   if (currentField < 0 || int(mod(row, 2.0)) == currentField)\n"
+    "      return woven;\n"
+    "   float above = row > 0.0 ? row - 1.0 : row + 1.0;\n"
+    "   float below = row < rows - 1.0 ? row + 1.0 : row - 1.0;\n"
+    "   vec4 a = fieldRow(tex, above, rows);\n"
+    "   vec4 b = fieldRow(tex, below, rows);\n"
+    "   vec4 spatial = (a + b) * 0.5;\n"
+    "%s"
+    "}\n";
+
+static constexpr const char *gWeaveReturn =
+    "   return woven;\n";
+
+static constexpr const char *gBobReturn =
+    "   return spatial;\n";
+
+static constexpr const char *gAdaptiveReturn =
+    "   vec4 keep = step(min(a, b) - combThreshold, woven) * step(woven, max(a, b) + combThreshold);\n"
+    "   return mix(spatial, woven, keep);\n";
+
+std::string buildCameraFragmentShader(const ColorFormat &format, bool interlaced, DeinterlaceMode mode)
+{
+    const YuvCoefficients &c = getYuvCoefficients(format.matrix, format.range);
+
+    char fieldSample[1280] = "";
+    if (interlaced)
+    {
+        const char *fieldReturn = mode == DEINTERLACE_BOB ? gBobReturn : mode == DEINTERLACE_ADAPTIVE ? gAdaptiveReturn : gWeaveReturn;
+        snprintf(fieldSample, sizeof(fieldSample), gFieldSampleFunction, DEINTERLACE_COMB_THRESHOLD / 255.0f, fieldReturn);
+    }
+    const char *lumaSample = interlaced ? "fieldSample(textureY, lines.x)" : "texture(textureY, TexCoords)";
+    const char *chromaSample = interlaced ? "fieldSample(textureUV, lines.y)" : "texture(textureUV, TexCoords)";
+
+    // Coefficients are on the 0..255 scale, texture values are normalized,
+    // so only the offsets need rescaling. Columns are the Y, U and V weights.
+    char source[2048];
+    snprintf(source, sizeof(source),
+             "#version 320 es\n"
+             "precision highp float;\n"
+             "in vec2 TexCoords;\n"
+             "out vec4 color;\n"
+             "layout(binding = 0) uniform sampler2D textureY;\n"
+             "layout(binding = 1) uniform sampler2D textureUV;\n"
+             "const vec3 yuvOffset = vec3(%.6f, %.6f, %.6f);\n"
+             "const mat3 yuvToRgb = mat3(%.6f, %.6f, %.6f,\n"
+             "                           0.0, %.6f, %.6f,\n"
+             "                           %.6f, %.6f, 0.0);\n"
+             "%s"
+             "void main() {\n"
+             "   vec3 yuv = vec3(%s.r, %s.%s) - yuvOffset;\n"
+             "   color = vec4(yuvToRgb * yuv, 1.0);\n"
+             "}\n",
+             c.yOffset / 255.0f, 128.0f / 255.0f, 128.0f / 255.0f,
+             c.yScale, c.yScale, c.yScale,
+             -c.ug, c.ub,
+             c.vr, -c.vg,
+             fieldSample,
+             lumaSample, chromaSample, gChromaSwizzle[format.order]);
+    return source;
+}
+
+static std::map<int, GLuint> gCameraPrograms;
+
+GLuint getCameraProgram(const ColorFormat &format, bool interlaced, DeinterlaceMode mode)
+{
+    if (!interlaced)
+        mode = DEINTERLACE_WEAVE;
+    const int key = format.order | (format.matrix << 1) | (format.range << 2) | (interlaced << 3) | (mode << 4);
+    auto it = gCameraPrograms.find(key);
+    if (it != gCameraPrograms.end())
+    {
+        return it->second;
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "RearCamera %s %s %s%s%s", format.order == CHROMA_NV21 ? "NV21" : "NV12",
+             format.matrix == MATRIX_BT709 ? "BT.709" : "BT.601", format.range == RANGE_FULL ? "full" : "limited",
+             interlaced ? " " : "", interlaced ? getDeinterlaceModeName(mode) : "");
+    GLuint program = buildShaderProgram(gVertexShader, buildCameraFragmentShader(format, interlaced, mode).c_str(), name);
+    if (program != 0)
+    {
+        ALOGD("Built camera program for %s", name);
+        gCameraPrograms[key] = program;
+    }
+    return program;
+}
+
+void releaseCameraPrograms()
+{
+    for (const auto &entry : gCameraPrograms)
+    {
+        glDeleteProgram(entry.second);
+    }
+    gCameraPrograms.clear();
+}
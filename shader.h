@@ -25,6 +25,10 @@
 #include <GLES3/gl3ext.h>
 
 #include <utils/Log.h>
+#include <string>
+
+#include "colorconvert.h"
+#include "deinterlace.h"
 
 const char gVertexShader[] =
     "#version 320 es\n"
@@ -36,35 +40,94 @@ const char gVertexShader[] =
     "  TexCoords = vertex.zw;\n"
     "}\n";
 
-const char gFragmentNV12ToRGB[] =
+const char gFragmentShader[] =
     "#version 320 es\n"
-    "precision highp float;\n"
+    "precision mediump float;\n"
     "in vec2 TexCoords;\n"
     "out vec4 color;\n"
     "uniform sampler2D text;\n"
-    "layout(binding = 0) uniform sampler2D textureY;\n"
-    "layout(binding = 1) uniform sampler2D textureUV;\n"
     "void main() {\n"
-    "   float r, g, b, y, u, v;\n"
-    "   y = texture(textureY, TexCoords).r;\n"
-    "   u = texture(textureUV, TexCoords).r - 0.5;\n"
-    "   v = texture(textureUV, TexCoords).a - 0.5;\n"
-    "   r = y + 1.13983 * v;\n"
-    "   g = y - 0.39465 * u - 0.58060 * v;\n"
-    "   b = y + 2.03211 * u;\n"
-    "   color = vec4(r, g, b, 1.0);\n"
+    "  color = texture(text, TexCoords);\n"
     "}\n";
 
-const char gFragmentShader[] =
+// Overlay sprites, one instance each. The 4 vertex strip has no vertex data
+// of its own, corners come from gl_VertexID. rect is x, y, width, height in
+// surface pixels, uvRect the atlas region, top row first.
+const char gOverlayVertexShader[] =
+    "#version 320 es\n"
+    "layout (location = 0) in vec4 rect;\n"
+    "layout (location = 1) in vec4 uvRect;\n"
+    "layout (location = 2) in vec4 tint;\n"
+    "out vec2 TexCoords;\n"
+    "out vec4 Tint;\n"
+    "uniform mat4 projection;\n"
+    "void main() {\n"
+    "  vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1));\n"
+    "  gl_Position = projection * vec4(rect.xy + corner * rect.zw, 1.0, 1.0);\n"
+    "  TexCoords = mix(uvRect.xy, uvRect.zw, vec2(corner.x, 1.0 - corner.y));\n"
+    "  Tint = tint;\n"
+    "}\n";
+
+const char gOverlayFragmentShader[] =
     "#version 320 es\n"
     "precision mediump float;\n"
     "in vec2 TexCoords;\n"
+    "in vec4 Tint;\n"
     "out vec4 color;\n"
-    "uniform sampler2D text;\n"
+    "uniform sampler2D atlas;\n"
     "void main() {\n"
-    "  color = texture(text, TexCoords);\n"
+    "  color = texture(atlas, TexCoords) * Tint;\n"
     "}\n";
 
+// Trajectory guidelines. vertex is x, y in surface pixels and the distance
+// travelled along the path in metres, which picks the colour band.
+const char gGuidelineVertexShader[] =
+    "#version 320 es\n"
+    "layout (location = 0) in vec3 vertex;\n"
+    "out float Distance;\n"
+    "uniform mat4 projection;\n"
+    "void main() {\n"
+    "  gl_Position = projection * vec4(vertex.xy, 1.0, 1.0);\n"
+    "  Distance = vertex.z;\n"
+    "}\n";
+
+const char gGuidelineFragmentShader[] =
+    "#version 320 es\n"
+    "precision mediump float;\n"
+    "in float Distance;\n"
+    "out vec4 color;\n"
+    "uniform vec2 bands;\n"
+    "void main() {\n"
+    "  if (Distance < bands.x)\n"
+    "    color = vec4(0.9, 0.1, 0.1, 0.8);\n"
+    "  else if (Distance < bands.y)\n"
+    "    color = vec4(1.0, 0.8, 0.0, 0.8);\n"
+    "  else\n"
+    "    color = vec4(0.1, 0.8, 0.2, 0.8);\n"
+    "}\n";
+
+// Directory of the program binary cache, created if missing. Nothing is
+// cached until this is called, or when the directory is empty or not
+// private to this service (see Helper::isPrivateDirectory()).
+// buildShaderProgram() then loads programs from there when the sources and
+// the driver match, and stores freshly compiled ones.
+void setShaderCacheDir(const char *dir);
+
 GLuint buildShaderProgram(const char *, const char *, const char *);
 
+// Fragment shader converting the Y and UV camera textures to RGB, with the
+// chroma order, matrix and range of one format baked in as constants.
+// Interlaced variants read textures holding the fields stacked, as
+// StreamingUploader fills them, and in bob and adaptive mode rebuild the
+// lines of the older field like Deinterlacer does. They add the uniforms
+// currentField, the parity of the newest field, and lines, the rows of the
+// Y and UV textures.
+std::string buildCameraFragmentShader(const ColorFormat &format, bool interlaced, DeinterlaceMode mode);
+// Program for that format and mode, built on first use and cached per
+// variant. The mode only applies to interlaced variants. Needs a current GL
+// context.
+GLuint getCameraProgram(const ColorFormat &format, bool interlaced = false, DeinterlaceMode mode = DEINTERLACE_WEAVE);
+// Deletes the cached programs, call before the context goes away
+void releaseCameraPrograms();
+
 #endif // SHADER_H
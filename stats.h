@@ -0,0 +1,132 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+// Hot-path counter with a single writer thread: a relaxed load/store pair,
+// no locked read-modify-write, readers just see a slightly stale value.
+class StatCounter
+{
+public:
+    void add(uint64_t value = 1) { mValue.store(mValue.load(std::memory_order_relaxed) + value, std::memory_order_relaxed); }
+    uint64_t get() const { return mValue.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> mValue{0};
+};
+
+// Same as StatCounter for values bumped from several threads
+class SharedStatCounter
+{
+public:
+    void add(uint64_t value = 1) { mValue.fetch_add(value, std::memory_order_relaxed); }
+    uint64_t get() const { return mValue.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> mValue{0};
+};
+
+// Duration of one pipeline stage: how often, how long in total, worst case
+template <typename Counter>
+class StageStatT
+{
+public:
+    void record(int64_t ns)
+    {
+        mCount.add();
+        mTotalNs.add(ns);
+        // A plain store could overwrite a larger maximum from another writer
+        uint64_t max = mMaxNs.load(std::memory_order_relaxed);
+        while (static_cast<uint64_t>(ns) > max &&
+               !mMaxNs.compare_exchange_weak(max, ns, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    void dump(std::string &out, const char *name) const
+    {
+        char line[128];
+        uint64_t count = mCount.get();
+        snprintf(line, sizeof(line), "%s n=%llu avg=%lluus max=%lluus\n", name,
+                 static_cast<unsigned long long>(count),
+                 static_cast<unsigned long long>(count ? mTotalNs.get() / count / 1000 : 0),
+                 static_cast<unsigned long long>(mMaxNs.load(std::memory_order_relaxed) / 1000));
+        out += line;
+    }
+
+private:
+    Counter mCount;
+    Counter mTotalNs;
+    std::atomic<uint64_t> mMaxNs{0};
+};
+
+typedef StageStatT<StatCounter> StageStat;
+typedef StageStatT<SharedStatCounter> SharedStageStat;
+
+static inline void dumpCounter(std::string &out, const char *name, uint64_t value)
+{
+    char line[96];
+    snprintf(line, sizeof(line), "%s %llu\n", name, static_cast<unsigned long long>(value));
+    out += line;
+}
+
+// Written by the capture thread, except requeue which runs wherever the last
+// lease on a frame is dropped
+struct CaptureStats
+{
+    StatCounter frames;
+    StatCounter sequenceGaps;
+    StatCounter timeouts;
+    StatCounter errors;
+    // Polls that found every buffer leased out, so the driver had none
+    StatCounter starved;
+    StageStat dequeueWait;
+    SharedStageStat requeue;
+    // Buffers kept queued in the driver, see QueueDepthController
+    std::atomic<int> queueDepth{0};
+
+    void dump(std::string &out) const
+    {
+        dumpCounter(out, "capture.frames", frames.get());
+        dumpCounter(out, "capture.sequence_gaps", sequenceGaps.get());
+        dumpCounter(out, "capture.timeouts", timeouts.get());
+        dumpCounter(out, "capture.errors", errors.get());
+        dumpCounter(out, "capture.starved", starved.get());
+        dequeueWait.dump(out, "capture.dequeue_wait");
+        requeue.dump(out, "capture.requeue");
+        dumpCounter(out, "capture.queue_depth", queueDepth.load(std::memory_order_relaxed));
+    }
+};
+
+// Written by the render thread only
+struct RenderStats
+{
+    StatCounter frames;
+    // Published by the capture thread but overwritten before being drawn
+    StatCounter dropped;
+    StatCounter stalls;
+    // CPU write into the pixel unpack buffer, part of upload
+    StageStat copy;
+    // CPU YUV to RGB conversion when rendering in software
+    StageStat convert;
+    StageStat upload;
+    StageStat draw;
+    StageStat swap;
+
+    void dump(std::string &out) const
+    {
+        dumpCounter(out, "render.frames", frames.get());
+        dumpCounter(out, "render.dropped", dropped.get());
+        dumpCounter(out, "render.stalls", stalls.get());
+        copy.dump(out, "render.copy");
+        convert.dump(out, "render.convert");
+        upload.dump(out, "render.upload");
+        draw.dump(out, "render.draw");
+        swap.dump(out, "render.swap");
+    }
+};
+
+#endif //STATS_H_
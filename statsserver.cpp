@@ -0,0 +1,145 @@
+#define LOG_TAG "RearCameraStats"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <cutils/log.h>
+
+#include "statsserver.h"
+
+StatsServer::~StatsServer()
+{
+    stop();
+}
+
+void StatsServer::addSection(const Section &section)
+{
+    const std::lock_guard<std::mutex> lock(mMutex);
+    mSections.push_back(section);
+}
+
+bool StatsServer::start(const char *socketPath)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(addr.sun_path))
+    {
+        ALOGD("stats socket path too long: %s", socketPath);
+        return false;
+    }
+    strcpy(addr.sun_path, socketPath);
+
+    mListenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (mListenFd < 0)
+    {
+        ALOGD("failed to create stats socket (%d = %s)", errno, strerror(errno));
+        return false;
+    }
+
+    unlink(socketPath);
+    if (bind(mListenFd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0 || listen(mListenFd, 2) < 0)
+    {
+        ALOGD("failed to listen on %s (%d = %s)", socketPath, errno, strerror(errno));
+        ::close(mListenFd);
+        mListenFd = -1;
+        return false;
+    }
+
+    mStopEventFd = eventfd(0, EFD_CLOEXEC);
+    if (mStopEventFd < 0)
+    {
+        ALOGD("failed to create stats eventfd (%d = %s)", errno, strerror(errno));
+        ::close(mListenFd);
+        mListenFd = -1;
+        unlink(socketPath);
+        return false;
+    }
+
+    mSocketPath = socketPath;
+    mThread = std::thread([this]() { serve(); });
+    ALOGD("Stats available on %s", socketPath);
+    return true;
+}
+
+void StatsServer::stop()
+{
+    if (mThread.joinable())
+    {
+        uint64_t one = 1;
+        if (write(mStopEventFd, &one, sizeof(one)) != sizeof(one))
+        {
+            ALOGD("failed to signal stats thread (%d = %s)", errno, strerror(errno));
+        }
+        mThread.join();
+    }
+
+    if (mListenFd >= 0)
+    {
+        ::close(mListenFd);
+        mListenFd = -1;
+        unlink(mSocketPath.c_str());
+    }
+
+    if (mStopEventFd >= 0)
+    {
+        ::close(mStopEventFd);
+        mStopEventFd = -1;
+    }
+}
+
+std::string StatsServer::dump()
+{
+    std::string out;
+    const std::lock_guard<std::mutex> lock(mMutex);
+    for (const Section &section : mSections)
+    {
+        section(out);
+    }
+    return out;
+}
+
+void StatsServer::serve()
+{
+    struct pollfd fds[2];
+    fds[0].fd = mStopEventFd;
+    fds[0].events = POLLIN;
+    fds[1].fd = mListenFd;
+    fds[1].events = POLLIN;
+
+    while (true)
+    {
+        fds[0].revents = fds[1].revents = 0;
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            ALOGD("stats poll failed (%d = %s)", errno, strerror(errno));
+            break;
+        }
+
+        if (fds[0].revents & POLLIN)
+            break;
+
+        int client = accept4(mListenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0)
+            continue;
+
+        std::string out = dump();
+        const char *data = out.data();
+        size_t left = out.size();
+        while (left > 0)
+        {
+            ssize_t written = send(client, data, left, MSG_NOSIGNAL);
+            if (written <= 0)
+                break;
+            data += written;
+            left -= written;
+        }
+        ::close(client);
+    }
+}
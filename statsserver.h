@@ -0,0 +1,40 @@
+#ifndef STATS_SERVER_H_
+#define STATS_SERVER_H_
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Serves a text dump of the pipeline counters on a UNIX socket, e.g.
+//   toybox nc -U /data/local/tmp/rearcamera_stats
+// The thread sleeps in accept() so nothing runs unless somebody reads.
+class StatsServer
+{
+public:
+    ~StatsServer();
+
+    typedef std::function<void(std::string &)> Section;
+
+    // Sections are appended in registration order on every dump
+    void addSection(const Section &section);
+
+    bool start(const char *socketPath);
+    void stop();
+
+    std::string dump();
+
+private:
+    void serve();
+
+    std::mutex mMutex;
+    std::vector<Section> mSections;
+    std::string mSocketPath;
+    std::thread mThread;
+    int mListenFd = -1;
+    // Written by stop() to get the thread out of accept()
+    int mStopEventFd = -1;
+};
+
+#endif //STATS_SERVER_H_
@@ -0,0 +1,200 @@
+#define LOG_TAG "RearCameraGL"
+
+#include <string.h>
+#include <utils/Timers.h>
+
+#include "streaminguploader.h"
+
+StreamingUploader::~StreamingUploader()
+{
+    destroy();
+}
+
+bool StreamingUploader::init(int width, int height, int yStride, int uvStride, bool stackFields)
+{
+    mWidth = width;
+    mHeight = height;
+    mYStride = yStride;
+    mUVStride = uvStride;
+    mStackFields = stackFields;
+    mHasField[0] = mHasField[1] = false;
+    mYSize = yStride * height;
+    mUVSize = uvStride * (height / 2);
+    const GLsizeiptr size = mYSize + mUVSize;
+
+    const char *extensions = reinterpret_cast<const char *>(glGetString(GL_EXTENSIONS));
+    mPersistent = extensions != nullptr && strstr(extensions, "GL_EXT_buffer_storage") != nullptr;
+
+    for (Slot &slot : mSlots)
+    {
+        glGenBuffers(1, &slot.buffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+        if (mPersistent)
+        {
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT_EXT | GL_MAP_COHERENT_BIT_EXT;
+            glBufferStorageEXT(GL_PIXEL_UNPACK_BUFFER, size, nullptr, flags);
+            slot.mapped = static_cast<unsigned char *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags));
+        }
+        else
+        {
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        }
+
+        if (glGetError() != GL_NO_ERROR || (mPersistent && slot.mapped == nullptr))
+        {
+            ALOGD("Pixel unpack buffer ring unavailable, uploading from client memory");
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            destroy();
+            return false;
+        }
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    ALOGD("Streaming uploads through %d %s pixel buffers of %d bytes", UPLOAD_RING_SIZE,
+          mPersistent ? "persistently mapped" : "mapped per frame", static_cast<int>(size));
+    return true;
+}
+
+void StreamingUploader::destroy()
+{
+    for (Slot &slot : mSlots)
+    {
+        if (slot.fence != nullptr)
+        {
+            glDeleteSync(slot.fence);
+            slot.fence = nullptr;
+        }
+        if (slot.buffer != 0)
+        {
+            if (slot.mapped != nullptr)
+            {
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                slot.mapped = nullptr;
+            }
+            glDeleteBuffers(1, &slot.buffer);
+            slot.buffer = 0;
+        }
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    mNext = 0;
+}
+
+// rowLength in texels, rows written from texture row top on
+static void uploadRows(GLenum format, int width, int top, int rows, int rowLength, const unsigned char *data)
+{
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, rowLength);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, top, width, rows, format, GL_UNSIGNED_BYTE, data);
+}
+
+void StreamingUploader::uploadPlanes(GLuint texY, GLuint texUV, const unsigned char *y, int yStride,
+                                     const unsigned char *uv, int uvStride, FrameField field)
+{
+    // Row lengths are in pixels: one byte per luma texel, two per chroma pair
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, texUV);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texY);
+
+    if (!mStackFields || field == FIELD_PROGRESSIVE)
+    {
+        uploadRows(GL_LUMINANCE, mWidth, 0, mHeight, yStride, y);
+        glActiveTexture(GL_TEXTURE1);
+        uploadRows(GL_LUMINANCE_ALPHA, mWidth / 2, 0, mHeight / 2, uvStride / 2, uv);
+    }
+    else if (field == FIELD_TOP || field == FIELD_BOTTOM)
+    {
+        // Line doubled into the other half too until that field shows up
+        const int parity = field == FIELD_BOTTOM ? 1 : 0;
+        mHasField[parity] = true;
+        const int halves = mHasField[parity ^ 1] ? 1 : 2;
+        for (int half = 0; half < halves; half++)
+        {
+            const int target = half == 0 ? parity : parity ^ 1;
+            glActiveTexture(GL_TEXTURE0);
+            uploadRows(GL_LUMINANCE, mWidth, target * mHeight / 2, mHeight / 2, yStride, y);
+            glActiveTexture(GL_TEXTURE1);
+            uploadRows(GL_LUMINANCE_ALPHA, mWidth / 2, target * mHeight / 4, mHeight / 4, uvStride / 2, uv);
+        }
+    }
+    else
+    {
+        // Every other line of the woven frame into each half
+        for (int parity = 0; parity < 2; parity++)
+        {
+            glActiveTexture(GL_TEXTURE0);
+            uploadRows(GL_LUMINANCE, mWidth, parity * mHeight / 2, mHeight / 2, yStride * 2, y + parity * yStride);
+            glActiveTexture(GL_TEXTURE1);
+            uploadRows(GL_LUMINANCE_ALPHA, mWidth / 2, parity * mHeight / 4, mHeight / 4, uvStride, uv + parity * uvStride);
+            mHasField[parity] = true;
+        }
+    }
+
+    // Other texture uploads expect tightly packed rows
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+void StreamingUploader::upload(const CameraFrame &frame, GLuint texY, GLuint texUV, StageStat &copyStat)
+{
+    // A ring slot holds exactly one frame of the layout given to init()
+    if (!isStreaming() || frame.yStride != mYStride || frame.uvStride != mUVStride)
+    {
+        uploadPlanes(texY, texUV, frame.y, frame.yStride, frame.uv, frame.uvStride, frame.field);
+        return;
+    }
+    // A lone field only fills half of it
+    const bool lone = frame.field == FIELD_TOP || frame.field == FIELD_BOTTOM;
+    const size_t ySize = lone ? mYSize / 2 : mYSize;
+    const size_t uvSize = lone ? mUVSize / 2 : mUVSize;
+
+    Slot &slot = mSlots[mNext];
+
+    // Normally long signaled: the slot was last used UPLOAD_RING_SIZE frames ago
+    if (slot.fence != nullptr)
+    {
+        if (glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, UPLOAD_FENCE_TIMEOUT_NS) == GL_TIMEOUT_EXPIRED)
+        {
+            // The GPU may still read the slot, writing it would tear that
+            // frame. The fence stays and the slot is tried again next frame,
+            // this one goes through client memory, which GL copies at once.
+            ALOGD("Pixel buffer still busy after %llu ns", static_cast<unsigned long long>(UPLOAD_FENCE_TIMEOUT_NS));
+            uploadPlanes(texY, texUV, frame.y, frame.yStride, frame.uv, frame.uvStride, frame.field);
+            return;
+        }
+        glDeleteSync(slot.fence);
+        slot.fence = nullptr;
+    }
+    mNext = (mNext + 1) % UPLOAD_RING_SIZE;
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+
+    // The fence, when there was one, has signaled: the GPU is done with this slot
+    unsigned char *dst = slot.mapped;
+    if (dst == nullptr)
+    {
+        dst = static_cast<unsigned char *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, ySize + uvSize,
+                                                            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+    }
+    if (dst == nullptr)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        uploadPlanes(texY, texUV, frame.y, frame.yStride, frame.uv, frame.uvStride, frame.field);
+        return;
+    }
+
+    nsecs_t copyStart = systemTime(SYSTEM_TIME_MONOTONIC);
+    memcpy(dst, frame.y, ySize);
+    memcpy(dst + ySize, frame.uv, uvSize);
+    copyStat.record(systemTime(SYSTEM_TIME_MONOTONIC) - copyStart);
+
+    if (slot.mapped == nullptr)
+    {
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+
+    // Offsets into the bound unpack buffer, the DMA runs asynchronously
+    uploadPlanes(texY, texUV, nullptr, mYStride, reinterpret_cast<const unsigned char *>(ySize), mUVStride, frame.field);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
@@ -0,0 +1,69 @@
+#ifndef STREAMING_UPLOADER_H_
+#define STREAMING_UPLOADER_H_
+
+#include "shader.h"
+#include "framesource.h"
+#include "stats.h"
+
+// One slot per frame in flight: while the GPU still reads frame N-1 from
+// one buffer, the CPU already writes frame N into the next one
+static constexpr int UPLOAD_RING_SIZE = 3;
+// Upper bound on waiting for the GPU to drain a ring slot
+static constexpr GLuint64 UPLOAD_FENCE_TIMEOUT_NS = 20000000;
+
+// Streams camera frames into the Y and UV textures through a ring of
+// GL_PIXEL_UNPACK_BUFFERs guarded by fences, so glTexSubImage2D does not
+// copy synchronously from client memory on the render thread. Buffers are
+// persistently mapped when GL_EXT_buffer_storage is there, otherwise mapped
+// per frame. Falls back to plain client-memory uploads if the ring can not
+// be created. Padded lines are uploaded as they are, GL_UNPACK_ROW_LENGTH
+// skips the padding so frames are never repacked on the CPU.
+//
+// Interlaced sources keep their fields stacked in the textures, the top
+// field in the upper half and the bottom one in the lower half (see
+// getCameraProgram()). Woven frames are split with a doubled row length,
+// a lone field only replaces its own half, so field-rate capture is never
+// woven on the CPU.
+class StreamingUploader
+{
+public:
+    ~StreamingUploader();
+
+    // Needs a current GL context, strides in bytes as the frames carry them.
+    // height counts the lines of both fields.
+    bool init(int width, int height, int yStride, int uvStride, bool stackFields);
+    void destroy();
+
+    // Leaves texY bound on GL_TEXTURE0 and texUV on GL_TEXTURE1
+    void upload(const CameraFrame &frame, GLuint texY, GLuint texUV, StageStat &copyStat);
+
+    bool isStreaming() { return mSlots[0].buffer != 0; };
+
+private:
+    struct Slot
+    {
+        GLuint buffer = 0;
+        GLsync fence = nullptr;
+        unsigned char *mapped = nullptr;
+    };
+
+    void uploadPlanes(GLuint texY, GLuint texUV, const unsigned char *y, int yStride, const unsigned char *uv, int uvStride,
+                      FrameField field);
+
+    Slot mSlots[UPLOAD_RING_SIZE];
+    int mNext = 0;
+    bool mPersistent = false;
+
+    int mWidth = 0;
+    int mHeight = 0;
+    int mYStride = 0;
+    int mUVStride = 0;
+    size_t mYSize = 0;
+    size_t mUVSize = 0;
+
+    bool mStackFields = false;
+    // Until a field arrives its half of the textures shows the other one
+    bool mHasField[2] = {};
+};
+
+#endif //STREAMING_UPLOADER_H_
@@ -0,0 +1,28 @@
+LOCAL_PATH:= $(call my-dir)
+
+# Unit tests, run with atest rearcam_tests or from /data/nativetest
+include $(CLEAR_VARS)
+
+LOCAL_CFLAGS += -Wall -Werror -Wunused -Wunreachable-code
+
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/..
+
+LOCAL_SRC_FILES := \
+    reversepredictor_test.cpp \
+    colorconvert_test.cpp \
+    ../reversepredictor.cpp \
+    ../colorconvert.cpp \
+
+LOCAL_SHARED_LIBRARIES := \
+    libhidlbase \
+    libhidltransport \
+    libcutils \
+    liblog \
+    libutils \
+    android.hardware.automotive.vehicle@2.0
+
+LOCAL_STATIC_LIBRARIES := cpufeatures
+
+LOCAL_MODULE := rearcam_tests
+
+include $(BUILD_NATIVE_TEST)
@@ -0,0 +1,120 @@
+#include <gtest/gtest.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+
+#include "colorconvert.h"
+
+static const ColorFormat gFormats[] = {
+    {CHROMA_NV12, MATRIX_BT601, RANGE_LIMITED}, {CHROMA_NV12, MATRIX_BT601, RANGE_FULL},
+    {CHROMA_NV12, MATRIX_BT709, RANGE_LIMITED}, {CHROMA_NV12, MATRIX_BT709, RANGE_FULL},
+    {CHROMA_NV21, MATRIX_BT601, RANGE_LIMITED}, {CHROMA_NV21, MATRIX_BT601, RANGE_FULL},
+    {CHROMA_NV21, MATRIX_BT709, RANGE_LIMITED}, {CHROMA_NV21, MATRIX_BT709, RANGE_FULL},
+};
+
+static const ConvertKernel gKernels[] = {KERNEL_SSE2, KERNEL_AVX2, KERNEL_NEON};
+
+// Padded strides and an odd width so every kernel also runs its tail
+struct TestImage
+{
+    TestImage(int width, int height) : width(width), height(height), yStride(width + 13), uvStride(width + 9),
+                                       y(yStride * height), uv(uvStride * height / 2)
+    {
+        srand(width * 31 + height);
+        for (uint8_t &value : y)
+            value = rand();
+        for (uint8_t &value : uv)
+            value = rand();
+    }
+
+    std::vector<uint8_t> convert(const ColorFormat &format, ConvertKernel kernel) const
+    {
+        std::vector<uint8_t> rgba(static_cast<size_t>(width) * 4 * height);
+        convertYuv420spToRgba(y.data(), yStride, uv.data(), uvStride, rgba.data(), width * 4, width, height, format, kernel);
+        return rgba;
+    }
+
+    int width;
+    int height;
+    int yStride;
+    int uvStride;
+    std::vector<uint8_t> y;
+    std::vector<uint8_t> uv;
+};
+
+TEST(ColorConvertTest, AllKernelsMatchScalar)
+{
+    const TestImage image(67, 10);
+    for (const ColorFormat &format : gFormats)
+    {
+        const std::vector<uint8_t> reference = image.convert(format, KERNEL_SCALAR);
+        for (ConvertKernel kernel : gKernels)
+        {
+            if (!isConvertKernelSupported(kernel))
+                continue;
+            EXPECT_EQ(reference, image.convert(format, kernel))
+                << getConvertKernelName(kernel) << " order " << format.order << " matrix " << format.matrix
+                << " range " << format.range;
+        }
+    }
+}
+
+// Same math as the camera shader: float coefficients, the output rounded
+// to the nearest code value and clamped like a RGBA8 render target
+TEST(ColorConvertTest, ScalarStaysWithinShaderTolerance)
+{
+    const TestImage image(64, 64);
+    for (const ColorFormat &format : gFormats)
+    {
+        const YuvCoefficients &c = getYuvCoefficients(format.matrix, format.range);
+        const std::vector<uint8_t> rgba = image.convert(format, KERNEL_SCALAR);
+        const int uIndex = format.order == CHROMA_NV21 ? 1 : 0;
+        int worst = 0;
+        for (int row = 0; row < image.height; row++)
+        {
+            for (int column = 0; column < image.width; column++)
+            {
+                const uint8_t *pair = &image.uv[row / 2 * image.uvStride + (column & ~1)];
+                const float luma = c.yScale * (image.y[row * image.yStride + column] - c.yOffset);
+                const float u = pair[uIndex] - 128.0f;
+                const float v = pair[1 - uIndex] - 128.0f;
+                const float expected[3] = {luma + c.vr * v, luma - c.ug * u - c.vg * v, luma + c.ub * u};
+                for (int channel = 0; channel < 3; channel++)
+                {
+                    const int reference = lrintf(fminf(fmaxf(expected[channel], 0.0f), 255.0f));
+                    const int actual = rgba[(row * image.width + column) * 4 + channel];
+                    worst = std::max(worst, abs(actual - reference));
+                }
+                EXPECT_EQ(255, rgba[(row * image.width + column) * 4 + 3]);
+            }
+        }
+        EXPECT_LE(worst, COLOR_CONVERT_SHADER_TOLERANCE) << "matrix " << format.matrix << " range " << format.range;
+    }
+}
+
+// Not a pass/fail check, reports the time per frame of each kernel
+TEST(ColorConvertTest, Benchmark)
+{
+    static constexpr int ITERATIONS = 20;
+    const TestImage image(1280, 720);
+    const ColorFormat format = {CHROMA_NV21, MATRIX_BT601, RANGE_LIMITED};
+    std::vector<uint8_t> rgba(static_cast<size_t>(image.width) * 4 * image.height);
+
+    const ConvertKernel kernels[] = {KERNEL_SCALAR, KERNEL_SSE2, KERNEL_AVX2, KERNEL_NEON};
+    for (ConvertKernel kernel : kernels)
+    {
+        if (!isConvertKernelSupported(kernel))
+            continue;
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < ITERATIONS; i++)
+        {
+            convertYuv420spToRgba(image.y.data(), image.yStride, image.uv.data(), image.uvStride, rgba.data(),
+                                  image.width * 4, image.width, image.height, format, kernel);
+        }
+        const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        printf("%-6s 1280x720 %6lld us/frame\n", getConvertKernelName(kernel),
+               static_cast<long long>(elapsed.count() / ITERATIONS));
+    }
+}
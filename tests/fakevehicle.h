@@ -0,0 +1,107 @@
+#ifndef FAKE_VEHICLE_H_
+#define FAKE_VEHICLE_H_
+
+#include <map>
+
+#include <android/hardware/automotive/vehicle/2.0/IVehicle.h>
+#include <android/hardware/automotive/vehicle/2.0/types.h>
+
+using namespace android;
+using namespace android::hardware;
+using namespace android::hardware::automotive::vehicle::V2_0;
+
+// In-process stand-in for the vehicle HAL: holds one value per property and
+// delivers changes synchronously to whoever subscribed to them, the way the
+// real HAL calls a registered IVehicleCallback.
+class FakeVehicle : public IVehicle
+{
+public:
+    void setInt(VehicleProperty property, int32_t value)
+    {
+        VehiclePropValue propValue = {};
+        propValue.prop = static_cast<int32_t>(property);
+        propValue.value.int32Values.resize(1);
+        propValue.value.int32Values[0] = value;
+        setValue(propValue);
+    }
+
+    void setFloat(VehicleProperty property, float value)
+    {
+        VehiclePropValue propValue = {};
+        propValue.prop = static_cast<int32_t>(property);
+        propValue.value.floatValues.resize(1);
+        propValue.value.floatValues[0] = value;
+        setValue(propValue);
+    }
+
+    bool isSubscribed(VehicleProperty property) const
+    {
+        return mSubscribers.count(static_cast<int32_t>(property)) != 0;
+    }
+
+    Return<void> getAllPropConfigs(getAllPropConfigs_cb callback) override
+    {
+        callback(hidl_vec<VehiclePropConfig>());
+        return Return<void>();
+    }
+
+    Return<void> getPropConfigs(const hidl_vec<int32_t> & /*props*/, getPropConfigs_cb callback) override
+    {
+        callback(StatusCode::INVALID_ARG, hidl_vec<VehiclePropConfig>());
+        return Return<void>();
+    }
+
+    Return<void> get(const VehiclePropValue &requested, get_cb callback) override
+    {
+        auto it = mValues.find(requested.prop);
+        if (it == mValues.end())
+            callback(StatusCode::TRY_AGAIN, requested);
+        else
+            callback(StatusCode::OK, it->second);
+        return Return<void>();
+    }
+
+    Return<StatusCode> set(const VehiclePropValue &value) override
+    {
+        setValue(value);
+        return StatusCode::OK;
+    }
+
+    Return<StatusCode> subscribe(const sp<IVehicleCallback> &callback, const hidl_vec<SubscribeOptions> &options) override
+    {
+        for (const SubscribeOptions &option : options)
+            mSubscribers[option.propId] = callback;
+        return StatusCode::OK;
+    }
+
+    Return<StatusCode> unsubscribe(const sp<IVehicleCallback> & /*callback*/, int32_t propId) override
+    {
+        mSubscribers.erase(propId);
+        return StatusCode::OK;
+    }
+
+    Return<void> debugDump(debugDump_cb callback) override
+    {
+        callback(hidl_string());
+        return Return<void>();
+    }
+
+private:
+    void setValue(const VehiclePropValue &value)
+    {
+        mValues[value.prop] = value;
+        auto it = mSubscribers.find(value.prop);
+        if (it == mSubscribers.end())
+            return;
+
+        hidl_vec<VehiclePropValue> values;
+        values.resize(1);
+        values[0] = value;
+        it->second->onPropertyEvent(values);
+    }
+
+    std::map<int32_t, VehiclePropValue> mValues;
+    std::map<int32_t, sp<IVehicleCallback>> mSubscribers;
+};
+
+#endif //FAKE_VEHICLE_H_
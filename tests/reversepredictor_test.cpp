@@ -0,0 +1,158 @@
+#include <gtest/gtest.h>
+
+#include "dataVehicleListener.h"
+#include "reversepredictor.h"
+#include "fakevehicle.h"
+
+static constexpr int64_t MS = 1000000LL;
+
+// Vehicle signals from a FakeVehicle through DataVehicleListener into the
+// predictor, applying its actions to a stream the way RearCamera does: the
+// predictor only manages the stream outside reverse.
+class ReversePredictorTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        mVehicle = new FakeVehicle();
+        mListener = new DataVehicleListener();
+        mListener->setCallback([this](bool reverse) {
+            mReverse = reverse;
+            apply(mPredictor.onReverse(reverse, mNow));
+        });
+        mListener->setSpeedCallback([this](float speed) { apply(mPredictor.onSpeed(speed, mNow)); });
+        mListener->setParkingBrakeCallback([this](bool engaged) { apply(mPredictor.onParkingBrake(engaged, mNow)); });
+        mListener->setTurnSignalCallback([this](bool active) { apply(mPredictor.onTurnSignal(active, mNow)); });
+
+        subscribe(VehicleProperty::GEAR_SELECTION);
+        subscribe(VehicleProperty::PERF_VEHICLE_SPEED);
+        subscribe(VehicleProperty::PARKING_BRAKE_ON);
+        subscribe(VehicleProperty::TURN_SIGNAL_STATE);
+
+        // Driving, brake off: nothing predicted yet
+        mVehicle->setInt(VehicleProperty::GEAR_SELECTION, static_cast<int32_t>(VehicleGear::GEAR_DRIVE));
+        mVehicle->setFloat(VehicleProperty::PERF_VEHICLE_SPEED, 8.0f);
+        mVehicle->setInt(VehicleProperty::PARKING_BRAKE_ON, 0);
+        mVehicle->setInt(VehicleProperty::TURN_SIGNAL_STATE, static_cast<int32_t>(VehicleTurnSignal::NONE));
+    }
+
+    void subscribe(VehicleProperty property)
+    {
+        SubscribeOptions options[] = {{static_cast<int32_t>(property), 0.0f, SubscribeFlags::EVENTS_FROM_CAR}};
+        hidl_vec<SubscribeOptions> list;
+        list.setToExternal(options, arraysize(options));
+        ASSERT_EQ(StatusCode::OK, static_cast<StatusCode>(mVehicle->subscribe(mListener, list)));
+    }
+
+    void apply(ReversePredictor::Action action)
+    {
+        if (mReverse)
+            return;
+        if (action == ReversePredictor::WARM)
+        {
+            mWarming = true;
+            mWarmUps++;
+        }
+        else if (action == ReversePredictor::COOL)
+        {
+            mWarming = false;
+        }
+    }
+
+    void advance(int64_t ns)
+    {
+        mNow += ns;
+        apply(mPredictor.onTick(mNow));
+    }
+
+    sp<FakeVehicle> mVehicle;
+    sp<DataVehicleListener> mListener;
+    ReversePredictor mPredictor;
+    int64_t mNow = 1000 * MS;
+    bool mReverse = false;
+    bool mWarming = false;
+    int mWarmUps = 0;
+};
+
+TEST_F(ReversePredictorTest, MovingVehicleNeverWarms)
+{
+    advance(10000 * MS);
+    EXPECT_FALSE(mWarming);
+    EXPECT_EQ(0, mWarmUps);
+}
+
+TEST_F(ReversePredictorTest, StoppingWarmsAndReverseTakesOver)
+{
+    mVehicle->setFloat(VehicleProperty::PERF_VEHICLE_SPEED, 0.0f);
+    EXPECT_TRUE(mWarming);
+
+    advance(1000 * MS);
+    mVehicle->setInt(VehicleProperty::GEAR_SELECTION, static_cast<int32_t>(VehicleGear::GEAR_REVERSE));
+    EXPECT_TRUE(mReverse);
+    EXPECT_FALSE(mPredictor.isWarm());
+    EXPECT_EQ(1, mWarmUps);
+}
+
+TEST_F(ReversePredictorTest, WarmUpExpiresAndRearmsOnlyOnceConditionsDrop)
+{
+    mVehicle->setFloat(VehicleProperty::PERF_VEHICLE_SPEED, 0.0f);
+    ASSERT_TRUE(mWarming);
+    EXPECT_EQ(mNow + PREDICTOR_WARM_TIMEOUT_NS, mPredictor.getDeadline());
+
+    advance(PREDICTOR_WARM_TIMEOUT_NS - MS);
+    EXPECT_TRUE(mWarming);
+    advance(MS);
+    EXPECT_FALSE(mWarming);
+
+    // Still waiting at the light: no second warm-up
+    advance(PREDICTOR_WARM_TIMEOUT_NS * 2);
+    mVehicle->setFloat(VehicleProperty::PERF_VEHICLE_SPEED, 0.1f);
+    EXPECT_FALSE(mWarming);
+    EXPECT_EQ(1, mWarmUps);
+
+    // Drives off and stops again
+    mVehicle->setFloat(VehicleProperty::PERF_VEHICLE_SPEED, 5.0f);
+    mVehicle->setFloat(VehicleProperty::PERF_VEHICLE_SPEED, 0.0f);
+    EXPECT_TRUE(mWarming);
+    EXPECT_EQ(2, mWarmUps);
+}
+
+TEST_F(ReversePredictorTest, BrakeAndTurnSignalSuppressWarmUp)
+{
+    mVehicle->setInt(VehicleProperty::PARKING_BRAKE_ON, 1);
+    mVehicle->setFloat(VehicleProperty::PERF_VEHICLE_SPEED, 0.0f);
+    EXPECT_FALSE(mWarming);
+
+    mVehicle->setInt(VehicleProperty::TURN_SIGNAL_STATE, static_cast<int32_t>(VehicleTurnSignal::LEFT));
+    mVehicle->setInt(VehicleProperty::PARKING_BRAKE_ON, 0);
+    EXPECT_FALSE(mWarming);
+
+    mVehicle->setInt(VehicleProperty::TURN_SIGNAL_STATE, static_cast<int32_t>(VehicleTurnSignal::NONE));
+    EXPECT_TRUE(mWarming);
+
+    // Engaging the brake again cancels right away
+    mVehicle->setInt(VehicleProperty::PARKING_BRAKE_ON, 1);
+    EXPECT_FALSE(mWarming);
+}
+
+TEST_F(ReversePredictorTest, UnsubscribedSignalsAreIgnored)
+{
+    mVehicle->unsubscribe(mListener, static_cast<int32_t>(VehicleProperty::PERF_VEHICLE_SPEED));
+    EXPECT_FALSE(mVehicle->isSubscribed(VehicleProperty::PERF_VEHICLE_SPEED));
+    mVehicle->setFloat(VehicleProperty::PERF_VEHICLE_SPEED, 0.0f);
+    EXPECT_FALSE(mWarming);
+}
+
+TEST_F(ReversePredictorTest, GearIsReadBack)
+{
+    VehiclePropValue request = {};
+    request.prop = static_cast<int32_t>(VehicleProperty::GEAR_SELECTION);
+    StatusCode status = StatusCode::TRY_AGAIN;
+    int32_t gear = 0;
+    mVehicle->get(request, [&](StatusCode s, const VehiclePropValue &value) {
+        status = s;
+        gear = value.value.int32Values[0];
+    });
+    EXPECT_EQ(StatusCode::OK, status);
+    EXPECT_EQ(static_cast<int32_t>(VehicleGear::GEAR_DRIVE), gear);
+}
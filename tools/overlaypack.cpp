@@ -0,0 +1,326 @@
+// Host tool building the overlay asset pack read by OverlayPack, see
+// overlaypack.h for the format. The images are laid out with the same
+// shelf packer as the runtime atlas and given a box filtered mip chain.
+//
+//   overlaypack -o overlays.pack *.png
+//
+// For ETC2, dump the levels, encode each with any ETC2 RGBA8 encoder
+// writing .pkm files (etcpack, EtcTool) and run again with the same images
+// and the encoded levels in order:
+//
+//   overlaypack -o overlays.pack -d /tmp/atlas *.png
+//   overlaypack -o overlays.pack -e /tmp/atlas_0.pkm ... -e /tmp/atlas_3.pkm *.png
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <png.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "../atlaspacker.h"
+#include "../overlaypack.h"
+#include "../pngdecode.h"
+
+// Type of ETC2 RGBA8 (EAC alpha) in the .pkm header
+static constexpr int PKM_ETC2_RGBA8 = 3;
+static constexpr size_t PKM_HEADER_SIZE = 16;
+// Largest atlas the pack is built for, what GLES 3.0 guarantees
+static constexpr int PACK_MAX_SIZE = 2048;
+
+struct SourceImage
+{
+    std::string name;
+    int width;
+    int height;
+    std::vector<uint8_t> pixels;
+};
+
+struct Level
+{
+    uint32_t width;
+    uint32_t height;
+    std::vector<uint8_t> data;
+};
+
+static void usage(const char *self)
+{
+    fprintf(stderr, "usage: %s -o out.pack [-l levels] [-d dump_prefix] [-e level.pkm]... image.png...\n", self);
+    exit(1);
+}
+
+static std::string baseName(const std::string &path)
+{
+    const size_t slash = path.rfind('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+// 2x2 box filter weighted by alpha, so transparent texels do not darken
+// the edges of the images
+static Level downsample(const Level &source)
+{
+    Level level;
+    level.width = std::max(source.width / 2, 1u);
+    level.height = std::max(source.height / 2, 1u);
+    level.data.resize(static_cast<size_t>(level.width) * level.height * 4);
+    for (uint32_t y = 0; y < level.height; y++)
+    {
+        for (uint32_t x = 0; x < level.width; x++)
+        {
+            uint32_t sum[4] = {0, 0, 0, 0};
+            for (uint32_t i = 0; i < 4; i++)
+            {
+                const uint32_t sx = std::min(x * 2 + (i & 1), source.width - 1);
+                const uint32_t sy = std::min(y * 2 + (i >> 1), source.height - 1);
+                const uint8_t *texel = &source.data[(static_cast<size_t>(sy) * source.width + sx) * 4];
+                for (int c = 0; c < 3; c++)
+                    sum[c] += texel[c] * texel[3];
+                sum[3] += texel[3];
+            }
+
+            uint8_t *texel = &level.data[(static_cast<size_t>(y) * level.width + x) * 4];
+            for (int c = 0; c < 3; c++)
+                texel[c] = sum[3] != 0 ? (sum[c] + sum[3] / 2) / sum[3] : 0;
+            texel[3] = (sum[3] + 2) / 4;
+        }
+    }
+    return level;
+}
+
+static bool writePng(const std::string &fileName, const Level &level)
+{
+    FILE *fp = fopen(fileName.c_str(), "wb");
+    if (fp == NULL)
+        return false;
+
+    png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info_ptr = png_ptr != NULL ? png_create_info_struct(png_ptr) : NULL;
+    if (info_ptr == NULL || setjmp(png_jmpbuf(png_ptr)))
+    {
+        png_destroy_write_struct(&png_ptr, &info_ptr);
+        fclose(fp);
+        return false;
+    }
+
+    png_init_io(png_ptr, fp);
+    png_set_IHDR(png_ptr, info_ptr, level.width, level.height, 8, PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png_ptr, info_ptr);
+    for (uint32_t row = 0; row < level.height; row++)
+        png_write_row(png_ptr, &level.data[static_cast<size_t>(row) * level.width * 4]);
+    png_write_end(png_ptr, NULL);
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+    return fclose(fp) == 0;
+}
+
+// Replaces level.data with the ETC2 blocks of a .pkm encoded from it
+static bool readPkm(const std::string &fileName, Level &level)
+{
+    FILE *fp = fopen(fileName.c_str(), "rb");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "Can not open %s\n", fileName.c_str());
+        return false;
+    }
+
+    uint8_t header[PKM_HEADER_SIZE];
+    std::vector<uint8_t> blocks(overlayPackLevelSize(OVERLAY_PACK_ETC2_RGBA8, level.width, level.height));
+    bool ok = fread(header, sizeof(header), 1, fp) == 1 && memcmp(header, "PKM 20", 6) == 0;
+    // Big endian type, then the padded and the original size
+    const int type = header[6] << 8 | header[7];
+    const uint32_t width = header[12] << 8 | header[13];
+    const uint32_t height = header[14] << 8 | header[15];
+    if (!ok || type != PKM_ETC2_RGBA8 || width != level.width || height != level.height)
+    {
+        fprintf(stderr, "%s is not a %ux%u ETC2 RGBA8 .pkm\n", fileName.c_str(), level.width, level.height);
+        ok = false;
+    }
+    else if (fread(blocks.data(), blocks.size(), 1, fp) != 1)
+    {
+        fprintf(stderr, "%s is truncated\n", fileName.c_str());
+        ok = false;
+    }
+    fclose(fp);
+
+    if (ok)
+        level.data = std::move(blocks);
+    return ok;
+}
+
+static bool writePack(const std::string &fileName, uint32_t format, const std::vector<SourceImage> &images,
+                      const std::vector<AtlasRect> &rects, const std::vector<Level> &levels)
+{
+    OverlayPackHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, OVERLAY_PACK_MAGIC, sizeof(header.magic));
+    header.version = OVERLAY_PACK_VERSION;
+    header.format = format;
+    header.width = levels[0].width;
+    header.height = levels[0].height;
+    header.levelCount = levels.size();
+    header.imageCount = images.size();
+
+    std::vector<OverlayPackImage> index(images.size());
+    memset(index.data(), 0, sizeof(OverlayPackImage) * index.size());
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        strncpy(index[i].name, images[i].name.c_str(), sizeof(index[i].name) - 1);
+        index[i].x = rects[i].x;
+        index[i].y = rects[i].y;
+        index[i].width = images[i].width;
+        index[i].height = images[i].height;
+    }
+
+    size_t offset = sizeof(header) + sizeof(OverlayPackImage) * index.size();
+    for (size_t i = 0; i < levels.size(); i++)
+    {
+        offset = (offset + OVERLAY_PACK_ALIGNMENT - 1) & ~(OVERLAY_PACK_ALIGNMENT - 1);
+        header.levels[i].offset = offset;
+        header.levels[i].size = levels[i].data.size();
+        offset += levels[i].data.size();
+    }
+
+    FILE *fp = fopen(fileName.c_str(), "wb");
+    if (fp == NULL)
+        return false;
+
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              fwrite(index.data(), sizeof(OverlayPackImage), index.size(), fp) == index.size();
+    static const uint8_t zeros[OVERLAY_PACK_ALIGNMENT] = {};
+    for (size_t i = 0; ok && i < levels.size(); i++)
+    {
+        const size_t gap = header.levels[i].offset - ftell(fp);
+        ok = fwrite(zeros, 1, gap, fp) == gap && fwrite(levels[i].data.data(), levels[i].data.size(), 1, fp) == 1;
+    }
+    return fclose(fp) == 0 && ok;
+}
+
+int main(int argc, char **argv)
+{
+    std::string output;
+    std::string dumpPrefix;
+    std::vector<std::string> pkmFiles;
+    int levelCount = OVERLAY_PACK_MAX_LEVELS;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "o:l:d:e:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'o':
+            output = optarg;
+            break;
+        case 'l':
+            levelCount = atoi(optarg);
+            break;
+        case 'd':
+            dumpPrefix = optarg;
+            break;
+        case 'e':
+            pkmFiles.push_back(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (output.empty() || optind >= argc || levelCount < 1 || levelCount > OVERLAY_PACK_MAX_LEVELS)
+        usage(argv[0]);
+    if (!pkmFiles.empty() && static_cast<int>(pkmFiles.size()) != levelCount)
+    {
+        fprintf(stderr, "Need one .pkm per level, %d levels\n", levelCount);
+        return 1;
+    }
+
+    std::vector<SourceImage> images;
+    for (int i = optind; i < argc; i++)
+    {
+        SourceImage image;
+        image.name = baseName(argv[i]);
+        if (image.name.size() >= OVERLAY_PACK_NAME_SIZE)
+        {
+            fprintf(stderr, "Name too long: %s\n", image.name.c_str());
+            return 1;
+        }
+        if (!decodePng(argv[i], image.width, image.height, image.pixels))
+        {
+            fprintf(stderr, "Can not decode %s\n", argv[i]);
+            return 1;
+        }
+        images.push_back(std::move(image));
+    }
+
+    // Padding halves with every level, keep at least a texel on the last
+    const int padding = 1 << (levelCount - 1);
+    std::vector<AtlasRect> rects(images.size());
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        rects[i].width = images[i].width;
+        rects[i].height = images[i].height;
+    }
+    int width = 0;
+    int height = 0;
+    if (!packAtlas(rects, padding, PACK_MAX_SIZE, width, height))
+    {
+        fprintf(stderr, "Images do not fit in a %dx%d atlas\n", PACK_MAX_SIZE, PACK_MAX_SIZE);
+        return 1;
+    }
+    // Whole ETC2 blocks on every level
+    const int alignment = 4 << (levelCount - 1);
+    height = (height + alignment - 1) / alignment * alignment;
+    if (height > PACK_MAX_SIZE)
+    {
+        fprintf(stderr, "Images do not fit in a %dx%d atlas\n", PACK_MAX_SIZE, PACK_MAX_SIZE);
+        return 1;
+    }
+
+    std::vector<Level> levels(1);
+    levels[0].width = width;
+    levels[0].height = height;
+    levels[0].data.assign(static_cast<size_t>(width) * height * 4, 0);
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        const SourceImage &image = images[i];
+        for (int row = 0; row < image.height; row++)
+        {
+            memcpy(&levels[0].data[(static_cast<size_t>(rects[i].y + row) * width + rects[i].x) * 4],
+                   &image.pixels[static_cast<size_t>(row) * image.width * 4], image.width * 4);
+        }
+    }
+    for (int i = 1; i < levelCount; i++)
+        levels.push_back(downsample(levels.back()));
+
+    if (!dumpPrefix.empty())
+    {
+        for (size_t i = 0; i < levels.size(); i++)
+        {
+            const std::string fileName = dumpPrefix + "_" + std::to_string(i) + ".png";
+            if (!writePng(fileName, levels[i]))
+            {
+                fprintf(stderr, "Can not write %s\n", fileName.c_str());
+                return 1;
+            }
+        }
+    }
+
+    uint32_t format = OVERLAY_PACK_RGBA8;
+    if (!pkmFiles.empty())
+    {
+        format = OVERLAY_PACK_ETC2_RGBA8;
+        for (size_t i = 0; i < levels.size(); i++)
+        {
+            if (!readPkm(pkmFiles[i], levels[i]))
+                return 1;
+        }
+    }
+
+    if (!writePack(output, format, images, rects, levels))
+    {
+        fprintf(stderr, "Can not write %s\n", output.c_str());
+        return 1;
+    }
+    printf("%zu images in a %dx%d %s atlas, %d levels\n", images.size(), width, height,
+           format == OVERLAY_PACK_ETC2_RGBA8 ? "ETC2" : "RGBA8", levelCount);
+    return 0;
+}
@@ -0,0 +1,159 @@
+// Host driver running the capture side of the pipeline without the car or
+// a display: frames from any FrameSource go through the deinterlacer and
+// the colour conversion exactly as in the software render path, and the
+// capture and conversion statistics are printed at the end.
+//
+//   replaybench -n 600 synthetic:1280x720@30
+//   replaybench -c file:/tmp/drive.nv21:1280x720@30 > checksums.txt
+//
+// With -c every converted frame is printed as "sequence checksum", so two
+// runs over the same replay file can be diffed to catch output changes.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <utils/Timers.h>
+
+#include "../colorconvert.h"
+#include "../deinterlace.h"
+#include "../framesource.h"
+#include "../stats.h"
+
+static constexpr int REPLAY_DEFAULT_FRAMES = 300;
+static constexpr int REPLAY_FRAME_TIMEOUT_MS = 1000;
+
+static void usage(const char *self)
+{
+    fprintf(stderr, "usage: %s [-n frames] [-k scalar|sse2|avx2|neon] [-d weave|bob|adaptive] [-c] source_spec\n", self);
+    exit(1);
+}
+
+static uint32_t fnv1a32(const uint8_t *data, size_t size)
+{
+    uint32_t hash = 0x811c9dc5u;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= 0x01000193u;
+    }
+    return hash;
+}
+
+int main(int argc, char **argv)
+{
+    int frameCount = REPLAY_DEFAULT_FRAMES;
+    ConvertKernel kernel = getBestConvertKernel();
+    DeinterlaceMode mode = DEINTERLACE_ADAPTIVE;
+    bool checksums = false;
+
+    int option;
+    while ((option = getopt(argc, argv, "n:k:d:c")) != -1)
+    {
+        switch (option)
+        {
+        case 'n':
+            frameCount = atoi(optarg);
+            break;
+        case 'k':
+        {
+            bool found = false;
+            for (int k = KERNEL_SCALAR; k <= KERNEL_NEON && !found; k++)
+            {
+                if (strcmp(optarg, getConvertKernelName(static_cast<ConvertKernel>(k))) == 0)
+                {
+                    kernel = static_cast<ConvertKernel>(k);
+                    found = true;
+                }
+            }
+            if (!found || !isConvertKernelSupported(kernel))
+            {
+                fprintf(stderr, "kernel %s not supported here\n", optarg);
+                return 1;
+            }
+            break;
+        }
+        case 'd':
+            mode = parseDeinterlaceMode(optarg, DEINTERLACE_ADAPTIVE);
+            break;
+        case 'c':
+            checksums = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || frameCount <= 0)
+        usage(argv[0]);
+
+    const std::string spec = argv[optind];
+    std::unique_ptr<FrameSource> source(FrameSource::create(spec));
+    if (!source->open(spec.c_str()) || !source->startStream())
+    {
+        fprintf(stderr, "failed to start %s\n", spec.c_str());
+        return 1;
+    }
+
+    const int width = source->getWidth();
+    const int height = source->getFrameHeight();
+    Deinterlacer deinterlacer;
+    if (source->isInterlaced())
+        deinterlacer.init(width, height, source->getYStride(), source->getUVStride(), mode);
+    std::vector<uint8_t> rgba(static_cast<size_t>(width) * 4 * height);
+
+    StageStat latency;
+    StageStat convert;
+    StatCounter dropped;
+    uint32_t lastGeneration = 0;
+    int converted = 0;
+    const nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    while (converted < frameCount)
+    {
+        if (!source->waitForFrame(lastGeneration, REPLAY_FRAME_TIMEOUT_MS))
+        {
+            fprintf(stderr, "no frame for %d ms\n", REPLAY_FRAME_TIMEOUT_MS);
+            break;
+        }
+
+        // Same bookkeeping as the renderer, flushes included
+        const uint32_t generation = source->getFrameGeneration();
+        FrameLease lease = source->acquireFrame();
+        if (!lease || lease->generation == lastGeneration)
+        {
+            lastGeneration = generation;
+            continue;
+        }
+        if (lastGeneration != 0 && lease->generation > lastGeneration + 1)
+            dropped.add(lease->generation - lastGeneration - 1);
+        lastGeneration = lease->generation;
+
+        const nsecs_t convertStart = systemTime(SYSTEM_TIME_MONOTONIC);
+        if (lease->timestamp != 0)
+            latency.record(convertStart - lease->timestamp);
+        const CameraFrame &frame = deinterlacer.deinterlace(deinterlacer.weave(*lease), kernel);
+        convertYuv420spToRgba(frame.y, frame.yStride, frame.uv, frame.uvStride, rgba.data(), width * 4, width, height,
+                              source->getColorFormat(), kernel);
+        convert.record(systemTime(SYSTEM_TIME_MONOTONIC) - convertStart);
+
+        if (checksums)
+            printf("%u %08x\n", lease->sequence, fnv1a32(rgba.data(), rgba.size()));
+        converted++;
+    }
+    const nsecs_t elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+
+    source->stopStream();
+    source->close();
+
+    std::string report;
+    source->getCaptureStats().dump(report);
+    latency.dump(report, "replay.capture_to_convert");
+    convert.dump(report, "replay.convert");
+    dumpCounter(report, "replay.frames", converted);
+    dumpCounter(report, "replay.dropped", dropped.get());
+    fprintf(stderr, "%s %dx%d, %s, %.1f fps\n%s", spec.c_str(), width, height, getConvertKernelName(kernel),
+            elapsed > 0 ? converted * 1e9 / elapsed : 0.0, report.c_str());
+    return converted == frameCount ? 0 : 1;
+}
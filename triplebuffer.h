@@ -0,0 +1,63 @@
+#ifndef TRIPLE_BUFFER_H_
+#define TRIPLE_BUFFER_H_
+
+#include <atomic>
+#include <stdint.h>
+
+// Wait-free single-producer/single-consumer exchange, latest value wins.
+// The producer fills back() and publishes it, the consumer picks up the most
+// recently published slot with update() and reads it through front(). The
+// middle slot is swapped with a single atomic exchange on either side, so
+// neither thread ever blocks the other.
+template <typename T>
+class TripleBuffer
+{
+public:
+    // Producer side
+    T &back() { return mSlots[mBack]; }
+
+    void publish()
+    {
+        uint8_t previous = mMiddle.exchange(mBack | FRESH_BIT, std::memory_order_acq_rel);
+        mBack = previous & INDEX_MASK;
+        mGeneration.fetch_add(1, std::memory_order_release);
+    }
+
+    // Consumer side, returns true if front() changed
+    bool update()
+    {
+        if (!(mMiddle.load(std::memory_order_acquire) & FRESH_BIT))
+            return false;
+
+        uint8_t previous = mMiddle.exchange(mFront, std::memory_order_acq_rel);
+        mFront = previous & INDEX_MASK;
+        return true;
+    }
+
+    T &front() { return mSlots[mFront]; }
+
+    // Number of values published so far, readable from any thread
+    uint32_t generation() const { return mGeneration.load(std::memory_order_acquire); }
+
+    // Only valid while neither side is running
+    void reset()
+    {
+        for (T &slot : mSlots)
+            slot = T();
+        mMiddle.store(1, std::memory_order_relaxed);
+        mBack = 0;
+        mFront = 2;
+    }
+
+private:
+    static constexpr uint8_t INDEX_MASK = 0x3;
+    static constexpr uint8_t FRESH_BIT = 0x4;
+
+    T mSlots[3];
+    std::atomic<uint8_t> mMiddle{1};
+    std::atomic<uint32_t> mGeneration{0};
+    uint8_t mBack = 0;
+    uint8_t mFront = 2;
+};
+
+#endif //TRIPLE_BUFFER_H_
@@ -7,48 +7,68 @@
 #include <memory.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <cutils/log.h>
+#include <utils/Timers.h>
+#include <algorithm>
+#include <math.h>
 
 #include "assert.h"
 
 #include "videocapture.h"
 
-VideoCapture::VideoCapture() : mRunMode(STOPPED), mFrameReady(false),
-                               mCameraWidth(CAMERA_WIDTH), mCameraHeight(CAMERA_HEIGHT), mCameraFourCC(CAMERA_FOURCC), mNbrBuffers(6)
+VideoCapture::VideoCapture() : mFrameTimeoutMs(CAMERA_FRAME_TIMEOUT_MS),
+                               mState(IDLE),
+                               mCameraWidth(CAMERA_WIDTH), mCameraHeight(CAMERA_HEIGHT), mCameraFourCC(CAMERA_FOURCC)
 {
 }
 
 VideoCapture::~VideoCapture()
 {
-    if (mRawCamera != nullptr)
-    {
-        delete[] mRawCamera;
-        mRawCamera = nullptr;
-    }
-
-    if (mRawColorCamera != nullptr)
-    {
-        delete[] mRawColorCamera;
-        mRawColorCamera = nullptr;
-    }
+    close();
 }
 
 bool VideoCapture::open(const char *deviceName)
 {
-    mDeviceFd = ::open(deviceName, O_RDWR, 0);
+    mDeviceFd = ::open(deviceName, O_RDWR | O_NONBLOCK, 0);
     if (mDeviceFd < 0)
     {
         ALOGD("failed to open device %s (%d = %s)", deviceName, errno, strerror(errno));
         return false;
     }
 
-    allocateBuffers(deviceName);
+    mControlEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mControlEventFd < 0)
+    {
+        ALOGD("failed to create control eventfd (%d = %s)", errno, strerror(errno));
+        ::close(mDeviceFd);
+        mDeviceFd = -1;
+        return false;
+    }
+
+    // Already freed by allocateBuffers(), without a worker the device is of
+    // no use and isOpen() has to say so
+    if (!allocateBuffers(deviceName))
+    {
+        ::close(mControlEventFd);
+        mControlEventFd = -1;
+        ::close(mDeviceFd);
+        mDeviceFd = -1;
+        return false;
+    }
+
+    // The worker outlives gear changes, reverse only toggles STREAMON/STREAMOFF
+    mState = PRIMED;
+    mRequestedState = PRIMED;
+    mExitRequested = false;
+    mCaptureThread = std::thread([this]() { collectFrames(); });
     return true;
 }
 
-void VideoCapture::allocateBuffers(const char *deviceName)
+bool VideoCapture::allocateBuffers(const char *deviceName)
 {
     v4l2_capability caps;
     {
@@ -56,7 +76,7 @@ void VideoCapture::allocateBuffers(const char *deviceName)
         if (result < 0)
         {
             ALOGD("failed to get device caps for %s (%d = %s)", deviceName, errno, strerror(errno));
-            return;
+            return false;
         }
     }
 
@@ -67,28 +87,352 @@ void VideoCapture::allocateBuffers(const char *deviceName)
     ALOGD("  All Caps: %08X", caps.capabilities);
     ALOGD("  Dev Caps: %08X", caps.device_caps);
 
-    int ret = prepare();
-    if (ret)
+    bool ready = prepare() && queueAllBuffers(CAMERA_CAPTURE_MODE) >= 0;
+    if (!ready && mMemoryMode == MEMORY_USERPTR)
+    {
+        // Drivers on contiguous DMA without an IOMMU only take their own memory
+        ALOGD("User pointer buffers refused, falling back to MMAP");
+        freeBuffers();
+        mMemoryMode = MEMORY_MMAP;
+        ready = prepare() && queueAllBuffers(CAMERA_CAPTURE_MODE) >= 0;
+    }
+    if (!ready)
+    {
+        freeBuffers();
+    }
+    return ready;
+}
+
+// Layout of the frames for field order the driver settled on. Field
+// sequential layouts are not handled and shown as progressive.
+static FrameField getNegotiatedField(const struct v4l2_pix_format_mplane &pix)
+{
+    switch (pix.field)
+    {
+    case V4L2_FIELD_INTERLACED:
+        // The order follows the video standard, only 525 line NTSC is bottom first
+        return pix.height == CAMERA_NTSC_HEIGHT ? FIELD_INTERLACED_BT : FIELD_INTERLACED_TB;
+    case V4L2_FIELD_INTERLACED_TB:
+        return FIELD_INTERLACED_TB;
+    case V4L2_FIELD_INTERLACED_BT:
+        return FIELD_INTERLACED_BT;
+    case V4L2_FIELD_TOP:
+    case V4L2_FIELD_ALTERNATE:
+        return FIELD_TOP;
+    case V4L2_FIELD_BOTTOM:
+        return FIELD_BOTTOM;
+    case V4L2_FIELD_SEQ_TB:
+    case V4L2_FIELD_SEQ_BT:
+        ALOGD("Field sequential frames are not deinterlaced");
+        return FIELD_PROGRESSIVE;
+    default:
+        return FIELD_PROGRESSIVE;
+    }
+}
+
+// Colour encoding the driver settled on, resolving the DEFAULT values the
+// way the V4L2 spec does for the colorspace
+static ColorFormat getNegotiatedColorFormat(const struct v4l2_pix_format_mplane &pix)
+{
+    ColorFormat format;
+    format.order = (pix.pixelformat == V4L2_PIX_FMT_NV12 || pix.pixelformat == V4L2_PIX_FMT_NV12M) ? CHROMA_NV12 : CHROMA_NV21;
+
+    int encoding = pix.ycbcr_enc;
+    if (encoding == V4L2_YCBCR_ENC_DEFAULT)
+        encoding = V4L2_MAP_YCBCR_ENC_DEFAULT(pix.colorspace);
+    format.matrix = (encoding == V4L2_YCBCR_ENC_709 || encoding == V4L2_YCBCR_ENC_XV709) ? MATRIX_BT709 : MATRIX_BT601;
+
+    int quantization = pix.quantization;
+    if (quantization == V4L2_QUANTIZATION_DEFAULT)
+        quantization = V4L2_MAP_QUANTIZATION_DEFAULT(false, pix.colorspace, encoding);
+    format.range = quantization == V4L2_QUANTIZATION_FULL_RANGE ? RANGE_FULL : RANGE_LIMITED;
+
+    return format;
+}
+
+// Formats the render path takes as they come, through the GL shader as well
+// as the software converter. Anything else (YUYV, RGB, planar 4:2:0) would
+// need a repack on the CPU for every frame and is never asked for.
+static const struct
+{
+    uint32_t fourcc;
+    int planes;
+    // Relative, only breaks ties between otherwise equal modes
+    int cost;
+} gCaptureFormats[] = {
+    // Separate planes map straight onto the Y and UV textures
+    {V4L2_PIX_FMT_NV21M, 2, 0},
+    {V4L2_PIX_FMT_NV12M, 2, 0},
+    // One buffer, the UV plane follows the padded Y plane
+    {V4L2_PIX_FMT_NV21, 1, 1},
+    {V4L2_PIX_FMT_NV12, 1, 1},
+};
+
+static int getFormatIndex(uint32_t fourcc)
+{
+    for (size_t i = 0; i < sizeof(gCaptureFormats) / sizeof(gCaptureFormats[0]); i++)
+    {
+        if (gCaptureFormats[i].fourcc == fourcc)
+            return i;
+    }
+    return -1;
+}
+
+// Value within [min, max] closest to preferred, on the step grid from min
+static int clampToStep(int preferred, int min, int max, int step)
+{
+    int value = std::max(min, std::min(max, preferred));
+    if (step > 1)
+        value = min + (value - min + step / 2) / step * step;
+    return std::min(value, max);
+}
+
+void VideoCapture::addModeIntervals(uint32_t fourcc, int width, int height, std::vector<CaptureMode> &modes)
+{
+    CaptureMode mode;
+    mode.fourcc = fourcc;
+    mode.width = width;
+    mode.height = height;
+
+    v4l2_frmivalenum ival;
+    memset(&ival, 0, sizeof(ival));
+    ival.pixel_format = fourcc;
+    ival.width = width;
+    ival.height = height;
+    for (ival.index = 0; ioctl(mDeviceFd, VIDIOC_ENUM_FRAMEINTERVALS, &ival) == 0; ival.index++)
+    {
+        if (ival.type == V4L2_FRMIVAL_TYPE_DISCRETE)
+        {
+            mode.interval = ival.discrete;
+            modes.push_back(mode);
+            continue;
+        }
+
+        // Stepwise or continuous: the range is all there is, take the
+        // preferred rate or the bound nearest to it
+        const v4l2_fract &fastest = ival.stepwise.min;
+        const v4l2_fract &slowest = ival.stepwise.max;
+        if (static_cast<uint64_t>(fastest.numerator) * CAMERA_FPS > fastest.denominator)
+            mode.interval = fastest;
+        else if (static_cast<uint64_t>(slowest.numerator) * CAMERA_FPS < slowest.denominator)
+            mode.interval = slowest;
+        else
+            mode.interval = {1, CAMERA_FPS};
+        modes.push_back(mode);
+        return;
+    }
+
+    if (ival.index == 0)
     {
-        queueAllBuffers(CAMERA_CAPTURE_MODE);
+        mode.interval = {0, 0};
+        modes.push_back(mode);
     }
 }
 
+std::vector<VideoCapture::CaptureMode> VideoCapture::enumerateModes()
+{
+    std::vector<CaptureMode> modes;
+
+    v4l2_fmtdesc desc;
+    memset(&desc, 0, sizeof(desc));
+    desc.type = CAMERA_CAPTURE_MODE;
+    for (desc.index = 0; ioctl(mDeviceFd, VIDIOC_ENUM_FMT, &desc) == 0; desc.index++)
+    {
+        bool usable = getFormatIndex(desc.pixelformat) >= 0;
+        ALOGD("  Format %u: %.4s (%s)%s", desc.index, reinterpret_cast<const char *>(&desc.pixelformat),
+              desc.description, usable ? "" : " not usable by the renderer");
+        if (!usable)
+            continue;
+
+        v4l2_frmsizeenum size;
+        memset(&size, 0, sizeof(size));
+        size.pixel_format = desc.pixelformat;
+        for (size.index = 0; ioctl(mDeviceFd, VIDIOC_ENUM_FRAMESIZES, &size) == 0; size.index++)
+        {
+            if (size.type == V4L2_FRMSIZE_TYPE_DISCRETE)
+            {
+                addModeIntervals(desc.pixelformat, size.discrete.width, size.discrete.height, modes);
+                continue;
+            }
+
+            const v4l2_frmsize_stepwise &range = size.stepwise;
+            addModeIntervals(desc.pixelformat,
+                             clampToStep(CAMERA_WIDTH, range.min_width, range.max_width, range.step_width),
+                             clampToStep(CAMERA_HEIGHT, range.min_height, range.max_height, range.step_height),
+                             modes);
+            break;
+        }
+
+        // No size list, the driver scales to whatever S_FMT asks
+        if (size.index == 0)
+            addModeIntervals(desc.pixelformat, CAMERA_WIDTH, CAMERA_HEIGHT, modes);
+    }
+
+    return modes;
+}
+
+// Picks the mode costing the renderer the least for the preferred output,
+// compared in this order:
+//  - frame rate missing to reach CAMERA_FPS, the camera must never lag
+//  - pixels away from CAMERA_WIDTH x CAMERA_HEIGHT, where a smaller mode
+//    counts four times as much since upscaling loses detail while a larger
+//    one only costs upload bandwidth
+//  - format cost from gCaptureFormats
+//  - frame rate above CAMERA_FPS, every extra frame is wasted work
+bool VideoCapture::chooseMode(CaptureMode &mode)
+{
+    std::vector<CaptureMode> modes = enumerateModes();
+    if (modes.empty())
+        return false;
+
+    const int64_t preferredPixels = static_cast<int64_t>(CAMERA_WIDTH) * CAMERA_HEIGHT;
+    std::tuple<double, int64_t, int, double> best;
+    for (size_t i = 0; i < modes.size(); i++)
+    {
+        const CaptureMode &candidate = modes[i];
+        // Unknown intervals are assumed to match
+        double fps = candidate.interval.numerator != 0 ? static_cast<double>(candidate.interval.denominator) / candidate.interval.numerator : CAMERA_FPS;
+        int64_t pixels = static_cast<int64_t>(candidate.width) * candidate.height;
+        int64_t sizeCost = pixels >= preferredPixels ? pixels - preferredPixels : 4 * (preferredPixels - pixels);
+
+        auto cost = std::make_tuple(std::max(0.0, CAMERA_FPS - fps), sizeCost,
+                                    gCaptureFormats[getFormatIndex(candidate.fourcc)].cost, std::max(0.0, fps - CAMERA_FPS));
+        if (i == 0 || cost < best)
+        {
+            best = cost;
+            mode = candidate;
+        }
+    }
+
+    ALOGD("Chose %.4s %dx%d at %u/%u s out of %zu modes", reinterpret_cast<const char *>(&mode.fourcc), mode.width,
+          mode.height, mode.interval.numerator, mode.interval.denominator, modes.size());
+    return true;
+}
+
+void VideoCapture::setFrameInterval(const v4l2_fract &interval)
+{
+    v4l2_streamparm parm;
+    memset(&parm, 0, sizeof(parm));
+    parm.type = CAMERA_CAPTURE_MODE;
+    if (ioctl(mDeviceFd, VIDIOC_G_PARM, &parm) < 0 || !(parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME))
+        return;
+
+    parm.parm.capture.timeperframe = interval;
+    if (ioctl(mDeviceFd, VIDIOC_S_PARM, &parm) < 0)
+    {
+        ALOGD("Cant set frame interval (%d = %s)", errno, strerror(errno));
+        return;
+    }
+    ALOGD("Frame interval %u/%u s", parm.parm.capture.timeperframe.numerator, parm.parm.capture.timeperframe.denominator);
+}
+
+// Has the capture hardware crop mRequestedCrop out of the sensor image and
+// scale it down to the view, so only displayed pixels are ever transferred.
+// Whatever it can not do is left to the renderer in mCrop. Expects the
+// sensor mode set in fmt, which is updated when a smaller format is set.
+bool VideoCapture::applyViewport(struct v4l2_format &fmt)
+{
+    struct v4l2_pix_format_mplane &pix = fmt.fmt.pix_mp;
+    mCrop = mRequestedCrop;
+
+    bool scaleDown = (mViewWidth > 0 && mViewWidth < static_cast<int>(pix.width)) ||
+                     (mViewHeight > 0 && mViewHeight < static_cast<int>(pix.height));
+    if (mRequestedCrop.isFull() && !scaleDown)
+        return true;
+
+    // The selection API takes the single planar type for MPLANE devices too
+    struct v4l2_selection sel;
+    memset(&sel, 0, sizeof(sel));
+    sel.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    sel.target = V4L2_SEL_TGT_CROP_BOUNDS;
+    if (ioctl(mDeviceFd, VIDIOC_G_SELECTION, &sel) < 0)
+    {
+        ALOGD("No hardware crop (%d = %s), cropping and scaling on the GPU", errno, strerror(errno));
+        return true;
+    }
+
+    const v4l2_rect bounds = sel.r;
+    v4l2_rect wanted;
+    wanted.left = bounds.left + lroundf(mRequestedCrop.x * bounds.width);
+    wanted.top = bounds.top + lroundf(mRequestedCrop.y * bounds.height);
+    wanted.width = std::max(1L, lroundf(mRequestedCrop.w * bounds.width));
+    wanted.height = std::max(1L, lroundf(mRequestedCrop.h * bounds.height));
+
+    sel.target = V4L2_SEL_TGT_CROP;
+    sel.r = wanted;
+    if (ioctl(mDeviceFd, VIDIOC_S_SELECTION, &sel) < 0)
+    {
+        ALOGD("Cant set hardware crop (%d = %s), cropping and scaling on the GPU", errno, strerror(errno));
+        return true;
+    }
+    // Drivers round to their alignment, only the returned rectangle counts
+    const v4l2_rect cropped = sel.r;
+
+    // Never larger than the chosen mode, upscaling only costs bandwidth
+    int width = std::min<int>(pix.width, cropped.width);
+    int height = std::min<int>(pix.height, cropped.height);
+    if (mViewWidth > 0)
+        width = std::min(width, mViewWidth);
+    if (mViewHeight > 0)
+        height = std::min(height, mViewHeight);
+
+    if (width != static_cast<int>(pix.width) || height != static_cast<int>(pix.height))
+    {
+        struct v4l2_format scaled = fmt;
+        scaled.fmt.pix_mp.width = width;
+        scaled.fmt.pix_mp.height = height;
+        if (ioctl(mDeviceFd, VIDIOC_S_FMT, &scaled) < 0)
+        {
+            ALOGD("Cant set scaled format");
+            return false;
+        }
+        fmt = scaled;
+    }
+
+    // Where the cropped image landed in the buffer, the whole of it unless
+    // the driver composes
+    v4l2_rect composed = {0, 0, pix.width, pix.height};
+    sel.target = V4L2_SEL_TGT_COMPOSE;
+    sel.r = composed;
+    if (ioctl(mDeviceFd, VIDIOC_S_SELECTION, &sel) == 0 || ioctl(mDeviceFd, VIDIOC_G_SELECTION, &sel) == 0)
+    {
+        composed = sel.r;
+    }
+
+    // What the renderer still crops: the wanted rectangle mapped from sensor
+    // to buffer coordinates
+    const float scaleX = static_cast<float>(composed.width) / cropped.width;
+    const float scaleY = static_cast<float>(composed.height) / cropped.height;
+    mCrop.x = std::max(0.0f, (composed.left + (wanted.left - cropped.left) * scaleX) / pix.width);
+    mCrop.y = std::max(0.0f, (composed.top + (wanted.top - cropped.top) * scaleY) / pix.height);
+    mCrop.w = std::min(1.0f - mCrop.x, wanted.width * scaleX / pix.width);
+    mCrop.h = std::min(1.0f - mCrop.y, wanted.height * scaleY / pix.height);
+
+    ALOGD("Hardware crop %ux%u@%d,%d of %ux%u scaled to %ux%u, remaining crop %.3f,%.3f %.3fx%.3f", cropped.width,
+          cropped.height, cropped.left, cropped.top, bounds.width, bounds.height, composed.width, composed.height,
+          mCrop.x, mCrop.y, mCrop.w, mCrop.h);
+    return true;
+}
+
 int VideoCapture::prepare()
 {
     struct v4l2_format fmt;
-    struct v4l2_requestbuffers reqbuf;
-    struct v4l2_buffer buffer;
-    struct v4l2_plane buf_planes[2];
     int ret = -1;
 
+    // Drivers without enumeration get the historical fixed mode
+    CaptureMode mode = {static_cast<uint32_t>(mCameraFourCC), mCameraWidth, mCameraHeight, {0, 0}};
+    if (!chooseMode(mode))
+    {
+        ALOGD("No mode enumerated, asking for %.4s %dx%d", reinterpret_cast<const char *>(&mode.fourcc), mode.width, mode.height);
+    }
+
     memset(&fmt, 0, sizeof(fmt));
     fmt.type = CAMERA_CAPTURE_MODE;
-    fmt.fmt.pix_mp.width = mCameraWidth;
-    fmt.fmt.pix_mp.height = mCameraHeight;
-    fmt.fmt.pix_mp.pixelformat = mCameraFourCC;
+    fmt.fmt.pix_mp.width = mode.width;
+    fmt.fmt.pix_mp.height = mode.height;
+    fmt.fmt.pix_mp.pixelformat = mode.fourcc;
     fmt.fmt.pix_mp.colorspace = V4L2_COLORSPACE_SMPTE170M;
-    fmt.fmt.pix_mp.field = V4L2_FIELD_ANY;
+    fmt.fmt.pix_mp.field = mRequestFieldRate ? V4L2_FIELD_ALTERNATE : V4L2_FIELD_ANY;
 
     ret = ioctl(mDeviceFd, VIDIOC_S_FMT, &fmt);
     if (ret < 0)
@@ -97,100 +441,236 @@ int VideoCapture::prepare()
         return 0;
     }
 
-    mYBufferSize = fmt.fmt.pix_mp.plane_fmt[0].sizeimage;
-    mUVBufferSize = fmt.fmt.pix_mp.plane_fmt[1].sizeimage;
+    if (!applyViewport(fmt))
+    {
+        return 0;
+    }
 
-    ALOGD("Current output format: fmt=0x%X, %dx%d, pixels bytes per line=%d",
-          fmt.fmt.pix.pixelformat, fmt.fmt.pix.width, fmt.fmt.pix.height, fmt.fmt.pix.bytesperline);
+    // The driver is free to adjust everything, only what it returns counts
+    const struct v4l2_pix_format_mplane &pix = fmt.fmt.pix_mp;
+    int format = getFormatIndex(pix.pixelformat);
+    if (format < 0 || pix.num_planes != gCaptureFormats[format].planes)
+    {
+        ALOGD("Driver settled on unusable format %.4s with %d planes", reinterpret_cast<const char *>(&pix.pixelformat), pix.num_planes);
+        return 0;
+    }
 
-    memset(&reqbuf, 0, sizeof(reqbuf));
-    reqbuf.count = mNbrBuffers;
-    reqbuf.type = CAMERA_CAPTURE_MODE;
-    reqbuf.memory = V4L2_MEMORY_MMAP;
+    if (mode.interval.numerator != 0)
+    {
+        setFrameInterval(mode.interval);
+    }
 
-    ret = ioctl(mDeviceFd, VIDIOC_REQBUFS, &reqbuf);
-    if (ret < 0)
+    mCameraFourCC = pix.pixelformat;
+    mCameraWidth = pix.width;
+    mCameraHeight = pix.height;
+    mNbrPlanes = pix.num_planes;
+    mYStride = std::max<int>(pix.plane_fmt[0].bytesperline, pix.width);
+    mUVStride = mNbrPlanes > 1 ? std::max<int>(pix.plane_fmt[1].bytesperline, pix.width) : mYStride;
+    mYBufferSize = pix.plane_fmt[0].sizeimage;
+    mUVBufferSize = mNbrPlanes > 1 ? pix.plane_fmt[1].sizeimage : 0;
+    mColorFormat = getNegotiatedColorFormat(pix);
+    mField = getNegotiatedField(pix);
+    mInterlaced = mField != FIELD_PROGRESSIVE;
+    mFieldRate = pix.field == V4L2_FIELD_ALTERNATE || pix.field == V4L2_FIELD_TOP || pix.field == V4L2_FIELD_BOTTOM;
+    if (mRequestFieldRate && !mFieldRate)
+    {
+        ALOGD("Driver can not deliver single fields (field %u), showing whole frames", pix.field);
+    }
+    ALOGD("Negotiated colorspace=%d ycbcr_enc=%d quantization=%d", pix.colorspace, pix.ycbcr_enc, pix.quantization);
+
+    ALOGD("Current output format: fmt=%.4s, %dx%d, planes=%d, bytes per line Y=%d UV=%d",
+          reinterpret_cast<const char *>(&pix.pixelformat), pix.width, pix.height, mNbrPlanes, mYStride, mUVStride);
+
+    ALOGD("  %dx%d flags=%08x", pix.width, pix.height, pix.flags);
+
+    if (!setupBuffers())
     {
-        ALOGD("Cant request buffers");
         return 0;
     }
-    else
+
+    ALOGD("Output Buffers = %d each of size %d + %d, memory mode %d\n", mNbrBuffers, mYBufferSize, mUVBufferSize, mMemoryMode);
+
+    return 1;
+}
+
+// Requests the buffers and makes their planes reachable from user space:
+// mapped from the driver, or carved out of mPool for USERPTR. On failure
+// freeBuffers() undoes whatever was done.
+bool VideoCapture::setupBuffers()
+{
+    struct v4l2_requestbuffers reqbuf;
+    struct v4l2_buffer buffer;
+    struct v4l2_plane buf_planes[2];
+
+    memset(&reqbuf, 0, sizeof(reqbuf));
+    reqbuf.count = std::max(1, std::min(mNbrBuffers, static_cast<int>(VIDEO_MAX_FRAME)));
+    reqbuf.type = CAMERA_CAPTURE_MODE;
+    reqbuf.memory = getV4L2Memory();
+
+    if (ioctl(mDeviceFd, VIDIOC_REQBUFS, &reqbuf) < 0 || reqbuf.count == 0)
     {
-        mNbrBuffers = reqbuf.count;
+        ALOGD("Cant request buffers (%d = %s)", errno, strerror(errno));
+        return false;
     }
+    mNbrBuffers = reqbuf.count;
+    mBuffers.assign(mNbrBuffers, CaptureBuffer());
 
-    ALOGD("  %dx%d flags=%08x numbuffers:%d", fmt.fmt.pix.width, fmt.fmt.pix.height, fmt.fmt.pix.flags, mNbrBuffers);
+    // USERPTR planes are page aligned, UV right after Y in the same chunk
+    const size_t uvOffset = BufferPool::alignToPage(mYBufferSize);
+    if (mMemoryMode == MEMORY_USERPTR && !mPool.init(uvOffset + mUVBufferSize, mNbrBuffers, mHugePages))
+    {
+        return false;
+    }
 
     for (int i = 0; i < mNbrBuffers; i++)
     {
+        CaptureBuffer &captureBuffer = mBuffers[i];
 
-        memset(&buffer, 0, sizeof(buffer));
-        buffer.type = CAMERA_CAPTURE_MODE;
-        buffer.memory = V4L2_MEMORY_MMAP;
-        buffer.index = i;
-        buffer.m.planes = buf_planes;
-        buffer.length = 2;
-
-        ret = ioctl(mDeviceFd, VIDIOC_QUERYBUF, &buffer);
-        if (ret < 0)
+        if (mMemoryMode == MEMORY_USERPTR)
         {
-            ALOGD("Cant query buffers");
-            return 0;
+            unsigned char *chunk = static_cast<unsigned char *>(mPool.get(i));
+            captureBuffer.planes[0] = chunk;
+            captureBuffer.lengths[0] = mYBufferSize;
+            if (mNbrPlanes > 1)
+            {
+                captureBuffer.planes[1] = chunk + uvOffset;
+                captureBuffer.lengths[1] = mUVBufferSize;
+            }
         }
-        ALOGD("query buf, plane 0 = %d, offset 0 = %d", buffer.m.planes[0].length, buffer.m.planes[0].m.mem_offset);
-
-        mPointerBuffersY[i] = mmap(NULL, buffer.m.planes[0].length, PROT_READ | PROT_WRITE, MAP_SHARED,
-                                   mDeviceFd, buffer.m.planes[0].m.mem_offset);
-
-        if (MAP_FAILED == mPointerBuffersY[i])
+        else
         {
-            while (i >= 0)
+            memset(&buffer, 0, sizeof(buffer));
+            buffer.type = CAMERA_CAPTURE_MODE;
+            buffer.memory = V4L2_MEMORY_MMAP;
+            buffer.index = i;
+            buffer.m.planes = buf_planes;
+            buffer.length = mNbrPlanes;
+
+            if (ioctl(mDeviceFd, VIDIOC_QUERYBUF, &buffer) < 0)
             {
-                i--;
-                munmap(mPointerBuffersY[i], mYBufferSize);
-                mPointerBuffersY[i] = NULL;
+                ALOGD("Cant query buffers");
+                return false;
             }
-            ALOGD("Cant mmap buffers Y");
-            return 0;
-        }
 
-        ALOGD("query buf, plane 1 = %d, offset 1 = %d, sizeimage_uv %d", buffer.m.planes[1].length, buffer.m.planes[1].m.mem_offset, mYBufferSize);
-        mPointerBuffersUV[i] = mmap(NULL, buffer.m.planes[1].length, PROT_READ | PROT_WRITE,
-                                    MAP_SHARED, mDeviceFd, buffer.m.planes[1].m.mem_offset);
+            for (int plane = 0; plane < mNbrPlanes; plane++)
+            {
+                ALOGD("query buf %d, plane %d = %d, offset = %d", i, plane, buffer.m.planes[plane].length,
+                      buffer.m.planes[plane].m.mem_offset);
+                void *mapped = mmap(NULL, buffer.m.planes[plane].length, PROT_READ | PROT_WRITE, MAP_SHARED,
+                                    mDeviceFd, buffer.m.planes[plane].m.mem_offset);
+                if (MAP_FAILED == mapped)
+                {
+                    ALOGD("Cant mmap buffer %d plane %d (%d = %s)", i, plane, errno, strerror(errno));
+                    return false;
+                }
+                captureBuffer.planes[plane] = mapped;
+                captureBuffer.lengths[plane] = buffer.m.planes[plane].length;
+            }
 
-        if (MAP_FAILED == mPointerBuffersUV[i])
-        {
-            while (i >= 0)
+            if (mMemoryMode == MEMORY_DMABUF)
             {
-                i--;
-                munmap(mPointerBuffersUV[i], mUVBufferSize);
-                mPointerBuffersY[i] = NULL;
+                exportBuffer(i);
             }
-            ALOGD("Cant mmap buffers UV");
-            return 0;
+        }
+
+        CameraFrame &frame = captureBuffer.frame;
+        frame.index = i;
+        frame.y = static_cast<const unsigned char *>(captureBuffer.planes[0]);
+        frame.yStride = mYStride;
+        frame.uvStride = mUVStride;
+        frame.yFd = captureBuffer.fds[0];
+        if (mNbrPlanes == 1)
+        {
+            // Single buffer formats keep the UV plane right after the Y lines
+            frame.uvOffset = mYStride * mCameraHeight;
+            frame.uv = frame.y + frame.uvOffset;
+            frame.uvFd = captureBuffer.fds[0];
+        }
+        else
+        {
+            frame.uv = static_cast<const unsigned char *>(captureBuffer.planes[1]);
+            frame.uvFd = captureBuffer.fds[1];
         }
     }
 
-    if (mRawColorCamera != nullptr)
+    // Everything queued until the controller learns what the system needs
+    mQueueDepth = mNbrBuffers;
+    mDepthController.init(mNbrBuffers, mQueueLatencyTargetMs * 1000000LL);
+    mCaptureStats.queueDepth = mQueueDepth;
+    return true;
+}
+
+// Best effort, frames stay readable through the mappings without it
+void VideoCapture::exportBuffer(int index)
+{
+    for (int plane = 0; plane < mNbrPlanes; plane++)
     {
-        delete[] mRawColorCamera;
-        mRawColorCamera = nullptr;
+        struct v4l2_exportbuffer expbuf;
+        memset(&expbuf, 0, sizeof(expbuf));
+        expbuf.type = CAMERA_CAPTURE_MODE;
+        expbuf.index = index;
+        expbuf.plane = plane;
+        expbuf.flags = O_CLOEXEC | O_RDONLY;
+        if (ioctl(mDeviceFd, VIDIOC_EXPBUF, &expbuf) < 0)
+        {
+            ALOGD("Cant export buffer %d plane %d (%d = %s)", index, plane, errno, strerror(errno));
+            return;
+        }
+        mBuffers[index].fds[plane] = expbuf.fd;
     }
-    if (mRawCamera != nullptr)
+}
+
+void VideoCapture::freeBuffers()
+{
+    for (CaptureBuffer &captureBuffer : mBuffers)
     {
-        delete[] mRawCamera;
-        mRawCamera = nullptr;
+        for (int plane = 0; plane < 2; plane++)
+        {
+            if (captureBuffer.fds[plane] >= 0)
+            {
+                ::close(captureBuffer.fds[plane]);
+            }
+            // USERPTR planes belong to mPool
+            if (mMemoryMode != MEMORY_USERPTR && captureBuffer.planes[plane] != nullptr)
+            {
+                munmap(captureBuffer.planes[plane], captureBuffer.lengths[plane]);
+            }
+        }
     }
+    mBuffers.clear();
 
-    mRawCamera = new unsigned char[mCameraWidth * mCameraHeight];
-    mRawColorCamera = new unsigned char[mCameraWidth * mCameraHeight / 2];
+    // Mapped buffers keep the driver from freeing, so this comes after munmap
+    if (isOpen())
+    {
+        struct v4l2_requestbuffers reqbuf;
+        memset(&reqbuf, 0, sizeof(reqbuf));
+        reqbuf.type = CAMERA_CAPTURE_MODE;
+        reqbuf.memory = getV4L2Memory();
+        ioctl(mDeviceFd, VIDIOC_REQBUFS, &reqbuf);
+    }
+    mPool.release();
+}
 
-    memset(mRawCamera, 0, mCameraWidth * mCameraHeight);
-    memset(mRawColorCamera, 0, mCameraWidth * mCameraHeight / 2);
+void VideoCapture::fillV4L2Buffer(int index, struct v4l2_buffer *buffer, struct v4l2_plane *planes)
+{
+    const CaptureBuffer &captureBuffer = mBuffers[index];
 
-    ALOGD("Output Buffers = %d each of size %d\n", mNbrBuffers, mYBufferSize);
+    memset(planes, 0, sizeof(*planes) * 2);
+    for (int plane = 0; plane < mNbrPlanes; plane++)
+    {
+        planes[plane].length = captureBuffer.lengths[plane];
+        if (mMemoryMode == MEMORY_USERPTR)
+        {
+            planes[plane].m.userptr = reinterpret_cast<unsigned long>(captureBuffer.planes[plane]);
+        }
+    }
 
-    return 1;
+    memset(buffer, 0, sizeof(*buffer));
+    buffer->type = CAMERA_CAPTURE_MODE;
+    buffer->memory = getV4L2Memory();
+    buffer->index = index;
+    buffer->m.planes = planes;
+    buffer->length = mNbrPlanes;
 }
 
 int VideoCapture::queueAllBuffers(int type)
@@ -201,14 +681,17 @@ int VideoCapture::queueAllBuffers(int type)
     int ret = -1;
     int lastqueued = -1;
 
-    for (i = 0; i < mNbrBuffers; i++)
+    const std::lock_guard<std::mutex> lock(mQueueMutex);
+    int queued = getQueuedCount();
+    for (i = 0; i < mNbrBuffers && queued < mQueueDepth; i++)
     {
-        memset(&buffer, 0, sizeof(buffer));
+        if (mBuffers[i].queued || mBuffers[i].leased)
+        {
+            continue;
+        }
+
+        fillV4L2Buffer(i, &buffer, buf_planes);
         buffer.type = type;
-        buffer.memory = V4L2_MEMORY_MMAP;
-        buffer.index = i;
-        buffer.m.planes = buf_planes;
-        buffer.length = 2;
         gettimeofday(&buffer.timestamp, NULL);
 
         ret = ioctl(mDeviceFd, VIDIOC_QBUF, &buffer);
@@ -218,13 +701,40 @@ int VideoCapture::queueAllBuffers(int type)
         }
         else
         {
+            mBuffers[i].queued = true;
             lastqueued = i;
+            queued++;
         }
     }
     return lastqueued;
 }
 
-void VideoCapture::startV4Lstream(int type)
+int VideoCapture::getQueuedCount()
+{
+    int queued = 0;
+    for (const CaptureBuffer &captureBuffer : mBuffers)
+    {
+        if (captureBuffer.queued)
+            queued++;
+    }
+    return queued;
+}
+
+// Hands spares to the driver until mQueueDepth buffers are queued
+void VideoCapture::fillQueue()
+{
+    int queued = getQueuedCount();
+    for (int i = 0; i < mNbrBuffers && queued < mQueueDepth; i++)
+    {
+        if (mBuffers[i].queued || mBuffers[i].leased)
+            continue;
+        mBuffers[i].queued = queueFrame(CAMERA_CAPTURE_MODE, i, V4L2_FIELD_NONE) == 0;
+        if (mBuffers[i].queued)
+            queued++;
+    }
+}
+
+int VideoCapture::startV4Lstream(int type)
 {
     int ret = -1;
     ret = ioctl(mDeviceFd, VIDIOC_STREAMON, &type);
@@ -232,22 +742,53 @@ void VideoCapture::startV4Lstream(int type)
     {
         ALOGD("Cant Stream on\n");
     }
+    return ret;
 }
 
-void VideoCapture::stopV4Lstream(int type)
+int VideoCapture::stopV4Lstream(int type)
 {
     int ret = -1;
     ret = ioctl(mDeviceFd, VIDIOC_STREAMOFF, &type);
     if (-1 == ret)
     {
-        ALOGD("Cant Stream on\n");
+        ALOGD("Cant Stream off\n");
     }
+    return ret;
 }
 
 void VideoCapture::close()
 {
     ALOGD("VideoCapture::close");
-    assert(mRunMode == STOPPED);
+
+    if (mCaptureThread.joinable())
+    {
+        {
+            const std::lock_guard<std::mutex> lock(mControlMutex);
+            mExitRequested = true;
+            uint64_t one = 1;
+            if (write(mControlEventFd, &one, sizeof(one)) != sizeof(one))
+            {
+                ALOGD("failed to signal capture thread (%d = %s)", errno, strerror(errno));
+            }
+        }
+        mCaptureThread.join();
+        ALOGD("Capture thread stopped.");
+    }
+
+    mMailbox.reset();
+    {
+        // Leased frames point into the buffers and release into this object,
+        // neither may go away before the last lease is dropped
+        std::unique_lock<std::mutex> lock(mQueueMutex);
+        auto released = [this]() {
+            return std::none_of(mBuffers.begin(), mBuffers.end(), [](const CaptureBuffer &b) { return b.leased; });
+        };
+        while (!mLeaseCondition.wait_for(lock, std::chrono::milliseconds(CAMERA_LEASE_WAIT_MS), released))
+        {
+            ALOGD("Still waiting for leased frames before closing");
+        }
+    }
+    freeBuffers();
 
     if (isOpen())
     {
@@ -255,90 +796,260 @@ void VideoCapture::close()
         ::close(mDeviceFd);
         mDeviceFd = -1;
     }
+
+    if (mControlEventFd >= 0)
+    {
+        ::close(mControlEventFd);
+        mControlEventFd = -1;
+    }
 }
 
 bool VideoCapture::startStream()
 {
     ALOGD("Starting stream...");
 
-    int prevRunMode = mRunMode.fetch_or(RUN);
-    if (prevRunMode & RUN)
+    if (!requestState(STREAMING))
     {
-        ALOGD("Already in RUN state, so we can't start a new streaming thread");
+        ALOGD("Stream failed to start (state %d)", mState.load());
         return false;
     }
 
-    startV4Lstream(CAMERA_CAPTURE_MODE);
-
-    mCaptureThread = std::thread([this]() { collectFrames(); });
-
     ALOGD("Stream started.");
     return true;
 }
 
 void VideoCapture::stopStream()
 {
-    int prevRunMode = mRunMode.fetch_or(STOPPING);
-    if (prevRunMode == STOPPED)
+    if (requestState(PRIMED))
     {
-        mRunMode = STOPPED;
+        ALOGD("Stream paused.");
     }
-    else if (prevRunMode & STOPPING)
+}
+
+bool VideoCapture::requestState(int state)
+{
+    std::unique_lock<std::mutex> lock(mControlMutex);
+    if (!mCaptureThread.joinable())
+    {
+        ALOGD("No capture worker, device not prepared");
+        return false;
+    }
+
+    if (mState == state)
+        return true;
+
+    mRequestedState = state;
+    uint64_t one = 1;
+    if (write(mControlEventFd, &one, sizeof(one)) != sizeof(one))
+    {
+        ALOGD("failed to signal capture thread (%d = %s)", errno, strerror(errno));
+        return false;
+    }
+
+    // The worker either reaches the state or resets the request to where it is
+    mStateCondition.wait_for(lock, std::chrono::milliseconds(CAMERA_STATE_TIMEOUT_MS),
+                             [this]() { return mState == mRequestedState; });
+    return mState == state;
+}
+
+// Runs on the capture thread only, so DQBUF never races with STREAMOFF
+void VideoCapture::applyState(int state)
+{
+    int current = mState;
+
+    if (state == STREAMING)
     {
-        ALOGD("stopStream called while stream is already stopping. Reentrancy is not supported!");
+        if (current == IDLE)
+            queueAllBuffers(CAMERA_CAPTURE_MODE);
+        if (startV4Lstream(CAMERA_CAPTURE_MODE) == 0)
+            mState = STREAMING;
+        else
+            mState = PRIMED;
         return;
     }
-    else
+
     {
-        if (mCaptureThread.joinable())
+        const std::lock_guard<std::mutex> lock(mQueueMutex);
+
+        // STREAMOFF hands every queued buffer back to user space, leased
+        // ones are requeued by releaseFrame() whenever they are dropped
+        stopV4Lstream(CAMERA_CAPTURE_MODE);
+
+        for (int i = 0; i < mNbrBuffers; i++)
         {
-            mCaptureThread.join();
+            if (mBuffers[i].queued)
+            {
+                mBuffers[i].queued = state == PRIMED && queueFrame(CAMERA_CAPTURE_MODE, i, V4L2_FIELD_NONE) == 0;
+            }
         }
-
-        ALOGD("Capture thread stopped.");
     }
+
+    // Do not show frames from the previous reverse engagement on resume
+    flushFrames();
+
+    mState = state;
 }
 
 void VideoCapture::collectFrames()
 {
     struct v4l2_buffer buf;
     struct v4l2_plane buf_planes[2];
-    while (mRunMode == RUN)
+    struct pollfd fds[2];
+    fds[0].fd = mControlEventFd;
+    fds[0].events = POLLIN;
+    fds[1].fd = mDeviceFd;
+    fds[1].events = POLLIN;
+
+    // Sequence numbers restart with each STREAMON
+    bool haveSequence = false;
+    uint32_t lastSequence = 0;
+    nsecs_t waitStart = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    while (true)
     {
-        dequeueFrame(CAMERA_CAPTURE_MODE, &buf, buf_planes);
-        ALOGD("dequeued buffer %d (flags:%08x, bytesused:%d, "
-              "offset main: %u mplaneOffset: %d buf.length: %d, buf.sequence:%d, buf.m.planes[0].length:%d buf.field %d buf.m.planes[buf.index].bytesused:%d",
-              buf.index, buf.flags, buf.m.planes[0].bytesused, buf.m.offset, buf.m.planes[0].data_offset, buf.length,
-              buf.sequence, buf.m.planes[0].length, buf.field, buf.m.planes[buf.index].bytesused);
         {
-            const std::lock_guard<std::mutex> lock(mSafeMutex);
-            memcpy(mRawCamera, mPointerBuffersY[buf.index], mCameraWidth * mCameraHeight);
-            memcpy(mRawColorCamera, mPointerBuffersUV[buf.index], mCameraWidth * mCameraHeight / 2);
+            const std::lock_guard<std::mutex> lock(mControlMutex);
+            if (mExitRequested)
+                break;
+
+            if (mRequestedState != mState)
+            {
+                applyState(mRequestedState);
+                mRequestedState = mState;
+                mStateCondition.notify_all();
+                haveSequence = false;
+                waitStart = systemTime(SYSTEM_TIME_MONOTONIC);
+                mDepthController.reset(waitStart);
+            }
+        }
+
+        // Only the control eventfd is watched while the stream is off
+        bool streaming = mState == STREAMING;
+        fds[0].revents = fds[1].revents = 0;
+        int ret = poll(fds, streaming ? 2 : 1, streaming ? mFrameTimeoutMs.load() : -1);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            ALOGD("poll failed (%d = %s)", errno, strerror(errno));
+            poll(fds, 1, CAMERA_ERROR_BACKOFF_MS);
+            continue;
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            uint64_t count;
+            if (read(mControlEventFd, &count, sizeof(count)) < 0)
+            {
+                ALOGD("failed to read control eventfd (%d = %s)", errno, strerror(errno));
+            }
+            continue;
         }
-        queueFrame(CAMERA_CAPTURE_MODE, buf.index, V4L2_FIELD_NONE, mYBufferSize, mUVBufferSize);
+
+        if (ret == 0)
+        {
+            mCaptureStats.timeouts.add();
+            ALOGD("No frame from sensor for %d ms (%llu timeouts)", mFrameTimeoutMs.load(),
+                  static_cast<unsigned long long>(mCaptureStats.timeouts.get()));
+            continue;
+        }
+
+        // POLLERR with nothing queued means the renderer holds every buffer,
+        // not that the device broke: requeue a spare or wait for a release
+        if ((fds[1].revents & (POLLERR | POLLHUP | POLLNVAL)) == POLLERR)
+        {
+            std::unique_lock<std::mutex> lock(mQueueMutex);
+            if (getQueuedCount() == 0)
+            {
+                mCaptureStats.starved.add();
+                fillQueue();
+                mLeaseCondition.wait_for(lock, std::chrono::milliseconds(CAMERA_ERROR_BACKOFF_MS),
+                                         [this]() { return getQueuedCount() > 0; });
+                continue;
+            }
+        }
+
+        if ((fds[1].revents & (POLLERR | POLLHUP | POLLNVAL)) || dequeueFrame(CAMERA_CAPTURE_MODE, &buf, buf_planes) < 0)
+        {
+            if (errno == EAGAIN && !(fds[1].revents & (POLLERR | POLLHUP | POLLNVAL)))
+                continue;
+
+            // Back off on the control eventfd only, so a broken device does not spin the thread
+            mCaptureStats.errors.add();
+            ALOGD("Dequeue error (revents:%x, %llu errors)", fds[1].revents,
+                  static_cast<unsigned long long>(mCaptureStats.errors.get()));
+            poll(fds, 1, CAMERA_ERROR_BACKOFF_MS);
+            continue;
+        }
+
+        if (buf.index >= static_cast<unsigned int>(mNbrBuffers))
+        {
+            mCaptureStats.errors.add();
+            ALOGD("Driver returned invalid buffer index %u", buf.index);
+            continue;
+        }
+
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        mCaptureStats.dequeueWait.record(now - waitStart);
+        waitStart = now;
+        mCaptureStats.frames.add();
+        uint32_t skipped = haveSequence ? buf.sequence - lastSequence - 1 : 0;
+        if (skipped != 0)
+        {
+            mCaptureStats.sequenceGaps.add(skipped);
+        }
+        haveSequence = true;
+        lastSequence = buf.sequence;
+
+        CameraFrame *frame = &mBuffers[buf.index].frame;
+        frame->sequence = buf.sequence;
+        // With alternate fields the driver says which one each buffer holds
+        if (mFieldRate && (buf.field == V4L2_FIELD_TOP || buf.field == V4L2_FIELD_BOTTOM))
+            frame->field = buf.field == V4L2_FIELD_TOP ? FIELD_TOP : FIELD_BOTTOM;
+        else
+            frame->field = mField;
+        // Only monotonic timestamps can be compared with our own clock
+        if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+            frame->timestamp = buf.timestamp.tv_sec * 1000000000LL + buf.timestamp.tv_usec * 1000LL;
+        else
+            frame->timestamp = 0;
+
+        bool depthChanged = mQueueLatencyTargetMs > 0 &&
+                            mDepthController.onFrame(now, frame->timestamp != 0 ? now - frame->timestamp : 0, skipped);
+
+        {
+            const std::lock_guard<std::mutex> lock(mQueueMutex);
+            mBuffers[buf.index].queued = false;
+            mBuffers[buf.index].leased = true;
+            if (depthChanged)
+            {
+                // A lower depth drains as queued buffers come back
+                mQueueDepth = mDepthController.getDepth();
+                mCaptureStats.queueDepth = mQueueDepth;
+            }
+            // Replaces the dequeued buffer with a spare, if one is held back
+            fillQueue();
+        }
+
+        publishFrame(frame, makeLease(buf.index));
     }
 
+    if (mState != IDLE)
+    {
+        applyState(IDLE);
+    }
     ALOGD("VideoCapture thread ending");
-    mRunMode = STOPPED;
 }
 
-int VideoCapture::queueFrame(int type, int index, int field, int size_y, int size_uv)
+int VideoCapture::queueFrame(int type, int index, int field)
 {
     struct v4l2_buffer buffer;
     struct v4l2_plane buf_planes[2];
     int ret = -1;
 
-    buf_planes[0].length = buf_planes[0].bytesused = size_y;
-    buf_planes[1].length = buf_planes[1].bytesused = size_uv;
-    buf_planes[0].data_offset = buf_planes[1].data_offset = 0;
-
-    memset(&buffer, 0, sizeof(buffer));
+    fillV4L2Buffer(index, &buffer, buf_planes);
     buffer.type = type;
-    buffer.memory = V4L2_MEMORY_MMAP;
-    buffer.index = index;
-    buffer.m.planes = buf_planes;
     buffer.field = field;
-    buffer.length = 2;
     gettimeofday(&buffer.timestamp, NULL);
 
     ret = ioctl(mDeviceFd, VIDIOC_QBUF, &buffer);
@@ -356,20 +1067,37 @@ int VideoCapture::dequeueFrame(int type, struct v4l2_buffer *buf, struct v4l2_pl
 
     memset(buf, 0, sizeof(*buf));
     buf->type = type;
-    buf->memory = V4L2_MEMORY_MMAP;
+    buf->memory = getV4L2Memory();
     buf->m.planes = buf_planes;
-    buf->length = 2;
+    buf->length = mNbrPlanes;
     ret = ioctl(mDeviceFd, VIDIOC_DQBUF, buf);
     if (-1 == ret)
     {
-        ALOGD("Failed to dequeueFrame\n");
+        // EAGAIN just means poll() woke us up without a filled buffer
+        if (errno != EAGAIN)
+        {
+            ALOGD("Failed to dequeueFrame (%d = %s)\n", errno, strerror(errno));
+        }
         return -1;
     }
     return ret;
 }
 
-std::tuple<const unsigned char *, const unsigned char *> VideoCapture::getRawBufferCamera()
+FrameLease VideoCapture::makeLease(int index)
 {
-    const std::lock_guard<std::mutex> lock(mSafeMutex);
-    return std::make_tuple(mRawCamera, mRawColorCamera);
+    return FrameLease(&mBuffers[index].frame, [this](const CameraFrame *frame) { releaseFrame(frame->index); });
+}
+
+void VideoCapture::releaseFrame(int index)
+{
+    const std::lock_guard<std::mutex> lock(mQueueMutex);
+    mBuffers[index].leased = false;
+    mLeaseCondition.notify_all();
+    // Beyond the queue depth the buffer stays here as a spare
+    if (isOpen() && !mBuffers[index].queued && getQueuedCount() < mQueueDepth)
+    {
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        mBuffers[index].queued = queueFrame(CAMERA_CAPTURE_MODE, index, V4L2_FIELD_NONE) == 0;
+        mCaptureStats.requeue.record(systemTime(SYSTEM_TIME_MONOTONIC) - start);
+    }
 }
\ No newline at end of file
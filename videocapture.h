@@ -9,75 +9,200 @@
 #include <tuple>
 #include <endian.h>
 #include <mutex>
+#include <memory>
+#include <vector>
 #include "helper.h"
+#include "framesource.h"
+#include "bufferpool.h"
+#include "queuedepth.h"
 
+// Preferred mode, the closest one the driver enumerates is used
 static constexpr int CAMERA_WIDTH = 720;
 static constexpr int CAMERA_HEIGHT = 480;
+static constexpr int CAMERA_FPS = 30;
+// Used as is when the driver enumerates nothing
 static constexpr int CAMERA_FOURCC = V4L2_PIX_FMT_NV21M;
 static constexpr int CAMERA_CAPTURE_MODE = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-
-class VideoCapture
+static constexpr int CAMERA_FRAME_TIMEOUT_MS = 1000;
+static constexpr int CAMERA_ERROR_BACKOFF_MS = 20;
+static constexpr int CAMERA_STATE_TIMEOUT_MS = 1000;
+// close() waits for leased frames, complaining this often while it does
+static constexpr int CAMERA_LEASE_WAIT_MS = 1000;
+static constexpr int CAMERA_DEFAULT_BUFFERS = 6;
+
+// Where frames live: "mmap" (driver memory, default), "dmabuf" (driver
+// memory also exported as dma-buf fds for other processes and APIs) or
+// "userptr" (our own pool, falls back to mmap if the driver refuses it)
+static constexpr const char *CAMERA_MEMORY_PROPERTY = "persist.rearcamera.memory";
+// Number of capture buffers asked for, the driver may adjust it
+static constexpr const char *CAMERA_BUFFERS_PROPERTY = "persist.rearcamera.buffers";
+// Back the userptr pool with huge pages
+static constexpr const char *CAMERA_HUGEPAGES_PROPERTY = "persist.rearcamera.hugepages";
+// Capture to dequeue latency the queue depth is tuned for, 0 keeps every
+// buffer queued
+static constexpr const char *CAMERA_QUEUE_LATENCY_PROPERTY = "persist.rearcamera.queue_latency_ms";
+static constexpr int CAMERA_QUEUE_LATENCY_MS = 20;
+// Ask interlaced sensors for one field per buffer (V4L2_FIELD_ALTERNATE),
+// each shown as soon as it is captured: twice the frame rate and half the
+// capture latency
+static constexpr const char *CAMERA_FIELD_RATE_PROPERTY = "persist.rearcamera.field_rate";
+// Active lines of a 525 line system, which sends the bottom field first
+static constexpr int CAMERA_NTSC_HEIGHT = 480;
+
+class VideoCapture : public FrameSource
 {
 public:
   VideoCapture();
   ~VideoCapture();
 
-  enum RunModes
+  // States of the capture worker, which lives from open() to close()
+  enum CaptureStates
+  {
+    IDLE = 0,      // buffers mapped, all owned by user space
+    PRIMED = 1,    // free buffers queued, stream off: STREAMON is all that is left
+    STREAMING = 2, // frames are being dequeued and published
+  };
+
+  enum MemoryModes
+  {
+    MEMORY_MMAP = 0,
+    MEMORY_DMABUF = 1, // MMAP plus VIDIOC_EXPBUF
+    MEMORY_USERPTR = 2,
+  };
+
+  // Only taken into account by the next open()
+  void setMemoryMode(int mode, bool hugePages)
   {
-    STOPPED = 0,
-    RUN = 1,
-    STOPPING = 2,
+    mMemoryMode = mode;
+    mHugePages = hugePages;
   };
+  void setBufferCount(int count) { mNbrBuffers = count; };
+  // See QueueDepthController, only taken into account by the next open()
+  void setQueueLatencyTarget(int latencyMs) { mQueueLatencyTargetMs = latencyMs; };
+  // Only taken into account by the next open()
+  void setFieldRate(bool fieldRate) { mRequestFieldRate = fieldRate; };
+
+  bool open(const char *deviceName) override;
+  void close() override;
 
-  bool open(const char *deviceName);
-  void close();
+  // Cheap resume/pause of the persistent worker, STREAMON/STREAMOFF only
+  bool startStream() override;
+  void stopStream() override;
 
-  bool startStream();
-  void stopStream();
+  int getState() { return mState; };
 
   // Valid only after open()
-  int getWidth() { return mCameraWidth; };
-  int getHeight() { return mCameraHeight; };
+  int getWidth() override { return mCameraWidth; };
+  int getHeight() override { return mCameraHeight; };
+  int getYStride() override { return mYStride; };
+  int getUVStride() override { return mUVStride; };
 
-  std::tuple<const unsigned char *, const unsigned char *> getRawBufferCamera();
+  bool isOpen() override { return mDeviceFd >= 0; };
+
+  // How long the capture thread waits for the sensor before counting a timeout
+  void setFrameTimeout(int timeoutMs) { mFrameTimeoutMs = timeoutMs; };
 
-  bool isOpen() { return mDeviceFd >= 0; };
 
 private:
-  void collectFrames();
+  // One way the driver can deliver frames
+  struct CaptureMode
+  {
+    uint32_t fourcc;
+    int width;
+    int height;
+    // Seconds per frame, 0/0 when the driver does not enumerate intervals
+    v4l2_fract interval;
+  };
+
+  std::vector<CaptureMode> enumerateModes();
+  void addModeIntervals(uint32_t fourcc, int width, int height, std::vector<CaptureMode> &modes);
+  bool chooseMode(CaptureMode &mode);
+  void setFrameInterval(const v4l2_fract &interval);
+  bool applyViewport(struct v4l2_format &fmt);
+
+  // One V4L2 buffer and where its planes live in this process
+  struct CaptureBuffer
+  {
+    void *planes[2] = {nullptr, nullptr};
+    size_t lengths[2] = {0, 0};
+    // Exported dma-buf of each plane, -1 when not exported
+    int fds[2] = {-1, -1};
+    bool queued = false;
+    bool leased = false;
+    CameraFrame frame;
+  };
 
-  std::mutex mSafeMutex;
+  void collectFrames();
+  bool requestState(int state);
+  void applyState(int state);
+  FrameLease makeLease(int index);
+  void releaseFrame(int index);
 
   int mDeviceFd = -1;
+  // Written on every state request to get the capture thread out of poll()
+  int mControlEventFd = -1;
+  std::atomic<int> mFrameTimeoutMs;
 
   std::thread mCaptureThread;
-  std::atomic<int> mRunMode;
-  std::atomic<bool> mFrameReady;
-
-  unsigned char *mRawCamera = nullptr;
-  unsigned char *mRawColorCamera = nullptr;
+  std::atomic<int> mState;
+
+  // Guards the requested state, the worker acknowledges through mStateCondition
+  std::mutex mControlMutex;
+  std::condition_variable mStateCondition;
+  int mRequestedState = IDLE;
+  bool mExitRequested = false;
+
+  // Which buffers sit in the driver queue and which are leased out. Leases
+  // are released from the render thread, so QBUF and STREAMOFF are
+  // serialized on mQueueMutex. Sized in prepare(), never resized while the
+  // worker runs nor freed while a frame is leased.
+  std::mutex mQueueMutex;
+  // Signalled by every release, for close() and a starved capture thread
+  std::condition_variable mLeaseCondition;
+  std::vector<CaptureBuffer> mBuffers;
+  // How many of them to keep in the driver, the others are held back as
+  // spares. Changed by the capture thread only.
+  int mQueueDepth = 0;
+  int mQueueLatencyTargetMs = CAMERA_QUEUE_LATENCY_MS;
+  QueueDepthController mDepthController;
 
   int mCameraWidth = 0;
   int mCameraHeight = 0;
   int mCameraFourCC = 0;
-
-  int mNbrBuffers = 6;
+  // 2 for NV12M/NV21M, 1 when the UV plane follows Y in the same buffer
+  int mNbrPlanes = 2;
+  // Bytes per line as returned by S_FMT, the driver may pad lines
+  int mYStride = 0;
+  int mUVStride = 0;
+
+  int mNbrBuffers = CAMERA_DEFAULT_BUFFERS;
+  int mMemoryMode = MEMORY_MMAP;
+  bool mHugePages = false;
+  BufferPool mPool;
+  bool mRequestFieldRate = false;
+  // Layout of every frame unless the driver says per buffer (alternate)
+  FrameField mField = FIELD_PROGRESSIVE;
 
   int mYBufferSize = 0;
   int mUVBufferSize = 0;
 
-  void *mPointerBuffersY[6];
-  void *mPointerBuffersUV[6];
-
-  void allocateBuffers(const char *name);
+  bool allocateBuffers(const char *name);
   int prepare();
+  bool setupBuffers();
+  void exportBuffer(int index);
+  void freeBuffers();
+  int getV4L2Memory() { return mMemoryMode == MEMORY_USERPTR ? V4L2_MEMORY_USERPTR : V4L2_MEMORY_MMAP; };
+  void fillV4L2Buffer(int index, struct v4l2_buffer *buffer, struct v4l2_plane *planes);
 
   int queueAllBuffers(int type);
-  void stopV4Lstream(int type);
-  void startV4Lstream(int type);
+  // Need mQueueMutex
+  int getQueuedCount();
+  void fillQueue();
+  int stopV4Lstream(int type);
+  int startV4Lstream(int type);
 
   int dequeueFrame(int type, struct v4l2_buffer *buf, struct v4l2_plane *buf_planes);
-  int queueFrame(int type, int index, int field, int size_y, int size_uv);
+  int queueFrame(int type, int index, int field);
 };
 
 #endif //VIDEO_CAPTURE_H_